@@ -0,0 +1,254 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * -march and -mtune.
+ *
+ * cl.exe only knows instruction set levels (/arch) and three tunings
+ * (/favor), so a CPU name is looked up in a table of what it supports:
+ * the x86-64 microarchitecture levels map to /arch:SSE4.2 (v2), AVX2
+ * (v3) and AVX512 (v4), CPUs without SSE4.2 to no /arch at all (SSE2
+ * is the default). For "native" the levels are read with CPUID from the
+ * processor we are running on, which is the one cl.exe runs on too.
+ */
+
+#include <string>
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "gcc2msvc.h"
+
+enum isa {
+  ISA_SSE2,
+  ISA_SSE42,
+  ISA_AVX,
+  ISA_AVX2,
+  ISA_AVX512
+};
+
+struct cpu {
+  const char *name;
+  enum isa isa;
+  const char *favor;   /* INTEL64, AMD64, ATOM or NULL */
+};
+
+static const struct cpu cpus[] = {
+  { "x86-64",          ISA_SSE2,   NULL      },
+  { "x86-64-v2",       ISA_SSE42,  NULL      },
+  { "x86-64-v3",       ISA_AVX2,   NULL      },
+  { "x86-64-v4",       ISA_AVX512, NULL      },
+  { "generic",         ISA_SSE2,   NULL      },
+  { "intel",           ISA_SSE2,   "INTEL64" },
+
+  /* Intel */
+  { "pentium4",        ISA_SSE2,   "INTEL64" },
+  { "prescott",        ISA_SSE2,   "INTEL64" },
+  { "nocona",          ISA_SSE2,   "INTEL64" },
+  { "core2",           ISA_SSE2,   "INTEL64" },
+  { "nehalem",         ISA_SSE42,  "INTEL64" },
+  { "corei7",          ISA_SSE42,  "INTEL64" },
+  { "westmere",        ISA_SSE42,  "INTEL64" },
+  { "sandybridge",     ISA_AVX,    "INTEL64" },
+  { "corei7-avx",      ISA_AVX,    "INTEL64" },
+  { "ivybridge",       ISA_AVX,    "INTEL64" },
+  { "core-avx-i",      ISA_AVX,    "INTEL64" },
+  { "haswell",         ISA_AVX2,   "INTEL64" },
+  { "core-avx2",       ISA_AVX2,   "INTEL64" },
+  { "broadwell",       ISA_AVX2,   "INTEL64" },
+  { "skylake",         ISA_AVX2,   "INTEL64" },
+  { "alderlake",       ISA_AVX2,   "INTEL64" },
+  { "raptorlake",      ISA_AVX2,   "INTEL64" },
+  { "meteorlake",      ISA_AVX2,   "INTEL64" },
+  { "arrowlake",       ISA_AVX2,   "INTEL64" },
+  { "arrowlake-s",     ISA_AVX2,   "INTEL64" },
+  { "lunarlake",       ISA_AVX2,   "INTEL64" },
+  { "pantherlake",     ISA_AVX2,   "INTEL64" },
+  { "knl",             ISA_AVX2,   "INTEL64" },   /* no AVX512BW/DQ/VL */
+  { "knm",             ISA_AVX2,   "INTEL64" },
+  { "skylake-avx512",  ISA_AVX512, "INTEL64" },
+  { "cascadelake",     ISA_AVX512, "INTEL64" },
+  { "cooperlake",      ISA_AVX512, "INTEL64" },
+  { "cannonlake",      ISA_AVX512, "INTEL64" },
+  { "icelake-client",  ISA_AVX512, "INTEL64" },
+  { "icelake-server",  ISA_AVX512, "INTEL64" },
+  { "tigerlake",       ISA_AVX512, "INTEL64" },
+  { "rocketlake",      ISA_AVX512, "INTEL64" },
+  { "sapphirerapids",  ISA_AVX512, "INTEL64" },
+  { "emeraldrapids",   ISA_AVX512, "INTEL64" },
+  { "graniterapids",   ISA_AVX512, "INTEL64" },
+  { "graniterapids-d", ISA_AVX512, "INTEL64" },
+  { "diamondrapids",   ISA_AVX512, "INTEL64" },
+
+  /* Intel Atom */
+  { "atom",            ISA_SSE2,   "ATOM"    },
+  { "bonnell",         ISA_SSE2,   "ATOM"    },
+  { "silvermont",      ISA_SSE42,  "ATOM"    },
+  { "slm",             ISA_SSE42,  "ATOM"    },
+  { "goldmont",        ISA_SSE42,  "ATOM"    },
+  { "goldmont-plus",   ISA_SSE42,  "ATOM"    },
+  { "tremont",         ISA_SSE42,  "ATOM"    },
+  { "sierraforest",    ISA_AVX2,   "ATOM"    },
+  { "grandridge",      ISA_AVX2,   "ATOM"    },
+  { "clearwaterforest", ISA_AVX2,  "ATOM"    },
+
+  /* AMD */
+  { "k8",              ISA_SSE2,   "AMD64"   },
+  { "opteron",         ISA_SSE2,   "AMD64"   },
+  { "athlon64",        ISA_SSE2,   "AMD64"   },
+  { "athlon-fx",       ISA_SSE2,   "AMD64"   },
+  { "k8-sse3",         ISA_SSE2,   "AMD64"   },
+  { "opteron-sse3",    ISA_SSE2,   "AMD64"   },
+  { "athlon64-sse3",   ISA_SSE2,   "AMD64"   },
+  { "amdfam10",        ISA_SSE2,   "AMD64"   },
+  { "barcelona",       ISA_SSE2,   "AMD64"   },
+  { "btver1",          ISA_SSE2,   "AMD64"   },
+  { "btver2",          ISA_AVX,    "AMD64"   },
+  { "bdver1",          ISA_AVX,    "AMD64"   },
+  { "bdver2",          ISA_AVX,    "AMD64"   },
+  { "bdver3",          ISA_AVX,    "AMD64"   },
+  { "bdver4",          ISA_AVX2,   "AMD64"   },
+  { "znver1",          ISA_AVX2,   "AMD64"   },
+  { "znver2",          ISA_AVX2,   "AMD64"   },
+  { "znver3",          ISA_AVX2,   "AMD64"   },
+  { "znver4",          ISA_AVX512, "AMD64"   },
+  { "znver5",          ISA_AVX512, "AMD64"   },
+};
+
+static const char *isa_options[] = {
+  "", "/arch:SSE4.2", "/arch:AVX", "/arch:AVX2", "/arch:AVX512"
+};
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static bool native_cpu(struct cpu &c)
+{
+  unsigned int a, b, ecx, edx;
+  unsigned int b7 = 0;
+  char vendor[13];
+
+  if (!__get_cpuid(0, &a, &b, &ecx, &edx))
+  {
+    return false;
+  }
+  memcpy(vendor, &b, 4);
+  memcpy(vendor + 4, &edx, 4);
+  memcpy(vendor + 8, &ecx, 4);
+  vendor[12] = 0;
+
+  if (a >= 7)
+  {
+    unsigned int a7, c7, d7;
+    __cpuid_count(7, 0, a7, b7, c7, d7);
+  }
+  __get_cpuid(1, &a, &b, &ecx, &edx);
+
+  /* the AVX registers must also be enabled by the OS (XCR0) */
+  unsigned int xcr0 = 0;
+  if (ecx & bit_OSXSAVE)
+  {
+    unsigned int hi;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (hi) : "c" (0));
+  }
+  bool ymm = (xcr0 & 0x06) == 0x06;
+  bool zmm = ymm && (xcr0 & 0xe0) == 0xe0;
+  bool fma = ecx & bit_FMA;
+  bool bmi = (b7 & bit_BMI) && (b7 & bit_BMI2);
+  unsigned int avx512 = bit_AVX512F | bit_AVX512CD | bit_AVX512BW | bit_AVX512DQ | bit_AVX512VL;
+
+  c.isa = ISA_SSE2;
+  if ((ecx & bit_SSE4_2) && (ecx & bit_POPCNT))     { c.isa = ISA_SSE42; }
+  if (ymm && (ecx & bit_AVX))                       { c.isa = ISA_AVX; }
+  if (ymm && fma && bmi && (b7 & bit_AVX2))         { c.isa = ISA_AVX2; }
+  if (zmm && c.isa == ISA_AVX2 && (b7 & avx512) == avx512) { c.isa = ISA_AVX512; }
+
+  c.favor = strcmp(vendor, "GenuineIntel") == 0 ? "INTEL64" :
+            strcmp(vendor, "AuthenticAMD") == 0 ? "AMD64" : NULL;
+  return true;
+}
+
+#else
+
+static bool native_cpu(struct cpu &)
+{
+  return false;
+}
+
+#endif
+
+static bool find_cpu(const std::string &name, struct cpu &c)
+{
+  if (name == "native")
+  {
+    return native_cpu(c);
+  }
+  for (size_t i = 0; i < sizeof(cpus) / sizeof(cpus[0]); ++i)
+  {
+    if (name == cpus[i].name)
+    {
+      c = cpus[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+/* the /arch option for -march=name, which is empty for the
+ * default (SSE2); false if name is unknown */
+bool arch_option(const std::string &name, std::string &option)
+{
+  struct cpu c;
+
+  if (!find_cpu(name, c))
+  {
+    return false;
+  }
+  option = isa_options[c.isa];
+  return true;
+}
+
+/* the /favor option for -mtune=name; only ATOM exists for 32 bits */
+bool favor_option(const std::string &name, int bits, std::string &option)
+{
+  struct cpu c;
+
+  if (!find_cpu(name, c))
+  {
+    return false;
+  }
+  option.clear();
+  if (c.favor == NULL)
+  {
+    if (name == "generic" && bits == 64) { option = "/favor:blend"; }
+  }
+  else if (bits == 64 || strcmp(c.favor, "ATOM") == 0)
+  {
+    option = std::string("/favor:") + c.favor;
+  }
+  return true;
+}
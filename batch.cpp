@@ -0,0 +1,796 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Batch mode: translate a whole compilation database in one process.
+ *
+ *   gcc2msvc --batch[=]compile_commands.json [--output=file] [--run] [--jobs=N] [--unity=N]
+ *   ... | gcc2msvc --batch [--output=file] [--run] [--jobs=N] [--unity=N]
+ *
+ * The file is a JSON array of entries as written by CMake (with
+ * "directory", "file", "output" and either "arguments" or a shell
+ * quoted "command"); without a file, one entry per line is read from
+ * stdin and each one is written out as soon as it was read. Every entry
+ * goes through translate(), the same code the driver uses, and comes
+ * out as an entry for cl.exe with win32 paths ("arguments" form).
+ * With --run the entries are also compiled, --jobs at a time. With
+ * --unity=N as well, the compiles of each directory are put together
+ * in unity files (see unity.cpp) once all entries have been read.
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+/* one entry of a compilation database */
+struct batch_entry {
+  std::string directory, file, output, command;
+  std::vector<std::string> arguments;
+  bool have_arguments;
+};
+
+struct batch_state {
+  FILE *out;                 /* translated database, NULL if not wanted */
+  bool lines;                /* write JSON lines instead of an array */
+  size_t written;            /* entries written */
+  bool run;
+  long jobs, running;
+  int rv;                    /* highest exit code */
+  struct unity_options unity;
+  std::map<std::string, std::vector<struct compile_job> > unity_jobs;  /* per directory */
+  std::map<std::string, std::string> unity_paths;                      /* CL_PATH of those */
+};
+
+
+/* a small JSON reader: only strings and arrays of strings are kept,
+ * everything else is skipped */
+
+static void skip_space(const char *&p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+  {
+    ++p;
+  }
+}
+
+static void append_utf8(std::string &str, unsigned int cp)
+{
+  if (cp < 0x80)
+  {
+    str += (char)cp;
+  }
+  else if (cp < 0x800)
+  {
+    str += (char)(0xc0 | (cp >> 6));
+    str += (char)(0x80 | (cp & 0x3f));
+  }
+  else if (cp < 0x10000)
+  {
+    str += (char)(0xe0 | (cp >> 12));
+    str += (char)(0x80 | ((cp >> 6) & 0x3f));
+    str += (char)(0x80 | (cp & 0x3f));
+  }
+  else
+  {
+    str += (char)(0xf0 | (cp >> 18));
+    str += (char)(0x80 | ((cp >> 12) & 0x3f));
+    str += (char)(0x80 | ((cp >> 6) & 0x3f));
+    str += (char)(0x80 | (cp & 0x3f));
+  }
+}
+
+static bool parse_hex4(const char *&p, const char *end, unsigned int &cp)
+{
+  if (end - p < 4)
+  {
+    return false;
+  }
+  cp = 0;
+  for (int i = 0; i < 4; ++i, ++p)
+  {
+    char c = *p;
+    cp <<= 4;
+    if      (c >= '0' && c <= '9') { cp |= c - '0';      }
+    else if (c >= 'a' && c <= 'f') { cp |= c - 'a' + 10; }
+    else if (c >= 'A' && c <= 'F') { cp |= c - 'A' + 10; }
+    else                           { return false;       }
+  }
+  return true;
+}
+
+static bool parse_string(const char *&p, const char *end, std::string &str)
+{
+  if (p == end || *p != '"')
+  {
+    return false;
+  }
+  ++p;
+  str.clear();
+
+  while (p < end)
+  {
+    /* copy runs of plain characters in one go */
+    const char *start = p;
+    while (p < end && *p != '"' && *p != '\\')
+    {
+      ++p;
+    }
+    str.append(start, p - start);
+
+    if (p == end)
+    {
+      break;
+    }
+    if (*p++ == '"')
+    {
+      return true;
+    }
+    if (p == end)
+    {
+      break;
+    }
+
+    unsigned int cp, lo;
+    switch (*p++)
+    {
+      case 'b': str += '\b'; break;
+      case 'f': str += '\f'; break;
+      case 'n': str += '\n'; break;
+      case 'r': str += '\r'; break;
+      case 't': str += '\t'; break;
+      case 'u':
+        if (!parse_hex4(p, end, cp))
+        {
+          return false;
+        }
+        if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+        {
+          p += 2;
+          if (!parse_hex4(p, end, lo))
+          {
+            return false;
+          }
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+        }
+        append_utf8(str, cp);
+        break;
+      default:  str += p[-1]; break;
+    }
+  }
+
+  return false;
+}
+
+static bool skip_value(const char *&p, const char *end)
+{
+  std::string str;
+  int depth = 0;
+
+  do {
+    skip_space(p, end);
+    if (p == end)
+    {
+      return false;
+    }
+    if (*p == '"')
+    {
+      if (!parse_string(p, end, str))
+      {
+        return false;
+      }
+    }
+    else if (*p == '{' || *p == '[')
+    {
+      ++depth;
+      ++p;
+    }
+    else if (*p == '}' || *p == ']')
+    {
+      --depth;
+      ++p;
+    }
+    else
+    {
+      /* numbers, true, false, null and the separators within objects */
+      ++p;
+    }
+  } while (depth > 0);
+
+  return true;
+}
+
+static bool parse_entry(const char *&p, const char *end, struct batch_entry &e)
+{
+  std::string key;
+
+  e.directory.clear();
+  e.file.clear();
+  e.output.clear();
+  e.command.clear();
+  e.arguments.clear();
+  e.have_arguments = false;
+
+  skip_space(p, end);
+  if (p == end || *p != '{')
+  {
+    return false;
+  }
+  ++p;
+
+  for (;;)
+  {
+    skip_space(p, end);
+    if (p < end && *p == '}')
+    {
+      ++p;
+      return true;
+    }
+    if (!parse_string(p, end, key))
+    {
+      return false;
+    }
+    skip_space(p, end);
+    if (p == end || *p++ != ':')
+    {
+      return false;
+    }
+    skip_space(p, end);
+
+    bool ok;
+    if      (key == "directory") { ok = parse_string(p, end, e.directory); }
+    else if (key == "file")      { ok = parse_string(p, end, e.file);      }
+    else if (key == "output")    { ok = parse_string(p, end, e.output);    }
+    else if (key == "command")   { ok = parse_string(p, end, e.command);   }
+    else if (key == "arguments" && p < end && *p == '[')
+    {
+      ++p;
+      e.have_arguments = ok = true;
+      skip_space(p, end);
+      while (ok && p < end && *p != ']')
+      {
+        e.arguments.push_back(std::string());
+        ok = parse_string(p, end, e.arguments.back());
+        skip_space(p, end);
+        if (ok && p < end && *p == ',')
+        {
+          ++p;
+          skip_space(p, end);
+        }
+      }
+      ok = ok && p < end;
+      if (ok)
+      {
+        ++p;
+      }
+    }
+    else
+    {
+      ok = skip_value(p, end);
+    }
+    if (!ok)
+    {
+      return false;
+    }
+
+    skip_space(p, end);
+    if (p < end && *p == ',')
+    {
+      ++p;
+    }
+  }
+}
+
+
+/* "command" entries are quoted for a POSIX shell */
+static void split_shell(const std::string &cmd, std::vector<std::string> &args)
+{
+  std::string arg;
+  bool in_arg = false;
+  char quote = 0;
+
+  for (size_t i = 0; i < cmd.size(); ++i)
+  {
+    char c = cmd[i];
+
+    if (quote == '\'')
+    {
+      if (c == '\'') { quote = 0; } else { arg += c; }
+    }
+    else if (c == '\\' && i + 1 < cmd.size())
+    {
+      /* within double quotes only a few characters can be escaped */
+      char n = cmd[++i];
+      if (quote == '"' && strchr("\"\\$`\n", n) == NULL)
+      {
+        arg += c;
+      }
+      if (n != '\n')
+      {
+        arg += n;
+      }
+      in_arg = true;
+    }
+    else if (quote == '"')
+    {
+      if (c == '"') { quote = 0; } else { arg += c; }
+    }
+    else if (c == '\'' || c == '"')
+    {
+      quote = c;
+      in_arg = true;
+    }
+    else if (c == ' ' || c == '\t' || c == '\n')
+    {
+      if (in_arg)
+      {
+        args.push_back(arg);
+        arg.clear();
+        in_arg = false;
+      }
+    }
+    else
+    {
+      arg += c;
+      in_arg = true;
+    }
+  }
+
+  if (in_arg)
+  {
+    args.push_back(arg);
+  }
+}
+
+
+static void write_entry(struct batch_state &b, const struct batch_entry &e,
+                        const struct translation &t)
+{
+  std::string str = (b.lines || b.written == 0) ? "" : ",\n";
+
+  str += "{\"directory\": " + json_quote(win_path(e.directory.c_str()));
+  str += ", \"arguments\": [\"cl.exe\"";
+  for (size_t i = 0; i < t.cl_args.size(); ++i)
+  {
+    str += ", ";
+    str += json_quote(t.cl_args[i]);
+  }
+  str += "], \"file\": " + json_quote(win_path(e.file.c_str()));
+
+  std::string output = t.have_outname ? t.outname :
+    (!t.do_link && t.sources.size() == 1) ? object_name(t.sources[0]) : e.output;
+  if (!output.empty())
+  {
+    str += ", \"output\": " + json_quote(win_path(output.c_str()));
+  }
+  str += b.lines ? "}\n" : "}";
+
+  fwrite(str.data(), 1, str.size(), b.out);
+  if (b.lines)
+  {
+    fflush(b.out);
+  }
+  ++b.written;
+}
+
+static void wait_job(struct batch_state &b)
+{
+  int status;
+  pid_t pid;
+
+  do {
+    pid = waitpid(-1, &status, 0);
+  } while (pid < 0 && errno == EINTR);
+
+  if (pid > 0)
+  {
+    int rv = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (rv > b.rv)
+    {
+      b.rv = rv;
+    }
+    --b.running;
+  }
+}
+
+static void run_entry(struct batch_state &b, const struct batch_entry &e, struct translation &t)
+{
+  while (b.running >= b.jobs)
+  {
+    wait_job(b);
+  }
+
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("fork()");
+    b.rv = (b.rv > 1) ? b.rv : 1;
+    return;
+  }
+  if (pid == 0)
+  {
+    if (!e.directory.empty() && chdir(e.directory.c_str()) != 0)
+    {
+      std::cerr << "error: cannot change to " << e.directory << ": " << strerror(errno) << std::endl;
+      _exit(1);
+    }
+    int rv = run_translation(t);
+    std::cout.flush();
+    std::cerr.flush();
+    _exit(rv);
+  }
+  ++b.running;
+}
+
+/* the compile of a single source entry as a job for unity_compile():
+ * options, source, /Fo */
+static void add_unity_job(struct batch_state &b, const struct batch_entry &e,
+                          const struct translation &t)
+{
+  struct compile_job job;
+  size_t source = t.source_args[0];
+
+  for (size_t i = 0; i < t.cl_args.size(); ++i)
+  {
+    if (i != source && !begins(t.cl_args[i].c_str(), "/Fo"))
+    {
+      job.args.push_back(t.cl_args[i]);
+    }
+  }
+  job.source = t.sources[0];
+  job.object = t.have_outname ? t.outname : object_name(t.sources[0]);
+  job.args.push_back(t.cl_args[source]);
+  job.args.push_back("/Fo" + win_path(job.object.c_str()));
+
+  b.unity_jobs[e.directory].push_back(job);
+  b.unity_paths[e.directory] = t.driver_paths;
+}
+
+static void do_entry(struct batch_state &b, const struct batch_entry &e)
+{
+  std::vector<std::string> args;
+  std::vector<char *> argv;
+  struct translation t;
+
+  if (e.have_arguments)
+  {
+    args = e.arguments;
+  }
+  else
+  {
+    split_shell(e.command, args);
+  }
+  if (args.empty())
+  {
+    std::cerr << "error: no command for " << e.file << std::endl;
+    b.rv = (b.rv > 1) ? b.rv : 1;
+    return;
+  }
+
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    argv.push_back(&args[i][0]);
+  }
+  argv.push_back(NULL);
+
+  /* staged paths are resolved in the entry's directory */
+  stage_base(e.directory);
+  if (translate(args.size(), argv.data(), t) != 0 || t.info != INFO_NONE)
+  {
+    std::cerr << "error: cannot translate the command for " << e.file << std::endl;
+    b.rv = (b.rv > 1) ? b.rv : 1;
+    return;
+  }
+  /* the written command line is complete, as run_translation() would run it */
+  if (t.debug_pending)
+  {
+    t.jobserver = jobserver_init();
+    debug_args(t, t.jobserver);
+  }
+
+  if (b.out != NULL)
+  {
+    write_entry(b, e, t);
+  }
+  /* only an entry that is run needs its inputs mirrored */
+  if (b.run && stage_sync() != 0)
+  {
+    b.rv = (b.rv > 1) ? b.rv : 1;
+    return;
+  }
+  if (b.run && b.unity.size > 1 && !t.do_link && t.sources.size() == 1 && !t.make_deps &&
+      !t.use_shell)
+  {
+    add_unity_job(b, e, t);
+  }
+  else if (b.run)
+  {
+    /* entries compile one source each, running them is the parallelism */
+    t.jobs = 1;
+    run_entry(b, e, t);
+  }
+}
+
+/* compile the jobs collected for --unity, one directory after the other */
+static void run_unity(struct batch_state &b)
+{
+  std::map<std::string, std::vector<struct compile_job> >::iterator it;
+
+  for (it = b.unity_jobs.begin(); it != b.unity_jobs.end(); ++it)
+  {
+    while (b.running > 0)
+    {
+      wait_job(b);
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      perror("fork()");
+      b.rv = (b.rv > 1) ? b.rv : 1;
+      return;
+    }
+    if (pid == 0)
+    {
+      struct tool cl;
+      if (!it->first.empty() && chdir(it->first.c_str()) != 0)
+      {
+        std::cerr << "error: cannot change to " << it->first << ": " << strerror(errno) << std::endl;
+        _exit(1);
+      }
+      if (!find_tool("cl.exe", b.unity_paths[it->first], cl))
+      {
+        std::cerr << "error: cl.exe not found in " << b.unity_paths[it->first] << std::endl;
+        _exit(127);
+      }
+      int rv = unity_compile(cl, it->second, b.unity, b.jobs, false);
+      std::cout.flush();
+      std::cerr.flush();
+      _exit(rv);
+    }
+    ++b.running;
+  }
+}
+
+/* a file is read as a whole: an array of entries (or entries one after another) */
+static bool batch_file(struct batch_state &b, const char *path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    std::cerr << "error: cannot open " << path << ": " << strerror(errno) << std::endl;
+    if (fd >= 0) { close(fd); }
+    return false;
+  }
+  if (st.st_size == 0)
+  {
+    close(fd);
+    return true;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    std::cerr << "error: cannot read " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  const char *p = (const char *)data;
+  const char *end = p + st.st_size;
+  struct batch_entry e;
+  int depth = 0;
+  bool ok = true;
+
+  for (;;)
+  {
+    skip_space(p, end);
+    if (p == end)
+    {
+      break;
+    }
+    if (*p == '[') { ++depth; ++p; continue; }
+    if (*p == ']') { --depth; ++p; continue; }
+    if (*p == ',') { ++p; continue; }
+
+    if (!parse_entry(p, end, e))
+    {
+      std::cerr << "error: " << path << ": invalid entry at offset "
+        << (p - (const char *)data) << std::endl;
+      ok = false;
+      break;
+    }
+    do_entry(b, e);
+  }
+
+  munmap(data, st.st_size);
+  return ok && depth == 0;
+}
+
+/* stdin is read line by line: one entry per line */
+static bool batch_lines(struct batch_state &b, FILE *in)
+{
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  size_t lineno = 0;
+  struct batch_entry e;
+  bool ok = true;
+
+  while ((len = getline(&line, &size, in)) >= 0)
+  {
+    const char *p = line;
+    const char *end = line + len;
+
+    ++lineno;
+    skip_space(p, end);
+    if (p == end)
+    {
+      continue;
+    }
+    if (!parse_entry(p, end, e))
+    {
+      std::cerr << "error: stdin:" << lineno << ": invalid entry" << std::endl;
+      ok = false;
+      continue;
+    }
+    do_entry(b, e);
+  }
+
+  free(line);
+  return ok;
+}
+
+int batch_main(int argc, char **argv)
+{
+  const char *file = NULL;
+  const char *output = NULL;
+  struct batch_state b;
+
+  b.out = NULL;
+  b.written = 0;
+  b.run = false;
+  b.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  b.running = 0;
+  b.rv = 0;
+  b.unity = unity_options();
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (begins(argv[i], "--batch="))
+    {
+      file = argv[i] + 8;
+    }
+    else if (strcmp(argv[i], "--batch") == 0)
+    {
+      if (i + 1 < argc && argv[i+1][0] != '-')
+      {
+        file = argv[++i];
+      }
+    }
+    else if (begins(argv[i], "--output="))
+    {
+      output = argv[i] + 9;
+    }
+    else if (begins(argv[i], "--jobs="))
+    {
+      b.jobs = strtol(argv[i] + 7, NULL, 10);
+    }
+    else if (strcmp(argv[i], "--run") == 0)
+    {
+      b.run = true;
+    }
+    else if (begins(argv[i], "--unity="))
+    {
+      b.unity.size = atoi(argv[i] + 8);
+    }
+    else if (begins(argv[i], "--unity-exclude="))
+    {
+      b.unity.exclude = argv[i] + 16;
+    }
+    else if (begins(argv[i], "--unity-report="))
+    {
+      b.unity.report = argv[i] + 15;
+    }
+    else
+    {
+      std::cerr << "warning: ignoring `" << argv[i] << "' in batch mode" << std::endl;
+    }
+  }
+  if (b.jobs < 1)
+  {
+    b.jobs = 1;
+  }
+  if (file != NULL && strcmp(file, "-") == 0)
+  {
+    file = NULL;
+  }
+
+  /* the database goes to stdout unless the entries are run */
+  if (output != NULL)
+  {
+    b.out = fopen(output, "w");
+    if (b.out == NULL)
+    {
+      std::cerr << "error: cannot write " << output << ": " << strerror(errno) << std::endl;
+      return 1;
+    }
+  }
+  else if (!b.run)
+  {
+    b.out = stdout;
+  }
+  b.lines = (file == NULL);
+
+  if (b.out != NULL && !b.lines)
+  {
+    fputs("[\n", b.out);
+  }
+
+  bool ok = (file != NULL) ? batch_file(b, file) : batch_lines(b, stdin);
+
+  if (b.out != NULL && !b.lines)
+  {
+    fputs("\n]\n", b.out);
+  }
+
+  run_unity(b);
+  while (b.running > 0)
+  {
+    wait_job(b);
+  }
+
+  if (b.out != NULL && (fflush(b.out) != 0 || (b.out != stdout && fclose(b.out) != 0)))
+  {
+    std::cerr << "error: cannot write " << (output ? output : "stdout") << std::endl;
+    ok = false;
+  }
+
+  if (!ok && b.rv == 0)
+  {
+    b.rv = 1;
+  }
+  return b.rv;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+# end-to-end throughput: a generated project of N translation units
+# (default 1000) built by make -j with the stand-in toolchain
+set -e
+
+cd "$(dirname "$0")/.."
+top="$PWD"
+fake="$top/bench/fake"
+n=${1:-1000}
+jobs=${BENCH_JOBS:-$(nproc)}
+
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_CL_SLEEP="${FAKE_CL_SLEEP:-0}"
+
+dir="$top/tmp_bench.make"
+rm -rf "$dir"
+mkdir -p "$dir/src"
+
+i=0
+while [ $i -lt $n ]; do
+  echo "int f$i(void) { return $i; }" > "$dir/src/f$i.c"
+  i=$((i+1))
+done
+
+{
+  echo "CC = $top/gcc2msvc"
+  echo "OBJS = \$(patsubst %.c,%.obj,\$(wildcard src/*.c))"
+  echo "app.exe: \$(OBJS)"
+  printf '\t+@$(CC) -o $@ $(OBJS)\n'
+  echo "%.obj: %.c"
+  printf '\t+@$(CC) $(FLAGS) -c -O2 -Wall -DNDEBUG -Iinclude -o $@ $<\n'
+} > "$dir/Makefile"
+
+report()
+{
+  echo "$1: $2 $3"
+  if [ -n "$BENCH_RESULTS" ]; then
+    printf '{"bench": "%s", "value": %s, "unit": "%s", "runs": %s}\n' "$1" "$2" "$3" "$n" >> "$BENCH_RESULTS"
+  fi
+}
+
+build()
+{
+  label="$1"
+  shift
+  rm -f "$dir"/src/*.obj "$dir/app.exe"
+  start=$(date +%s%N)
+  make -s -C "$dir" -j$jobs "$@"
+  end=$(date +%s%N)
+  [ -f "$dir/app.exe" ]
+  report "make-j$jobs/$label" $(( (end - start) / n / 1000 )) "us/TU"
+}
+
+build "direct"
+build "shell" FLAGS=--shell
+
+rm -rf "$dir"
@@ -0,0 +1,20 @@
+#!/bin/sh
+# runs all benchmarks; results are also written to BENCH_RESULTS
+# (default: bench/results.json) as JSON lines, one per measurement:
+#   {"bench": "...", "value": N, "unit": "...", "runs": N}
+set -e
+
+cd "$(dirname "$0")/.."
+export BENCH_RESULTS="${BENCH_RESULTS:-$PWD/bench/results.json}"
+: > "$BENCH_RESULTS"
+
+echo "== argument translation (in-process)"
+./bench/translate
+echo "== path translation (in-process)"
+./bench/winpath bench/mountinfo.wsl
+echo "== per invocation"
+./bench/spawn.sh
+echo "== make -j, ${BENCH_TUS:-1000} translation units"
+./bench/make.sh ${BENCH_TUS:-1000}
+
+echo "results: $BENCH_RESULTS"
@@ -0,0 +1,47 @@
+#!/bin/sh
+# per-invocation latency of the wrapper alone (--print-only) and of
+# running cl.exe directly compared to running it through /bin/sh and
+# cmd.exe (--shell) and through a cmd.exe of the pool (--pool); the
+# stand-in cmd.exe takes FAKE_CMD_SLEEP seconds (default 0.03) to start,
+# like a Windows process started from Linux
+set -e
+
+cd "$(dirname "$0")/.."
+fake="$PWD/bench/fake"
+n=${1:-200}
+
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_CMD_SLEEP="${FAKE_CMD_SLEEP:-0.03}"
+export GCC2MSVC_POOL_DIR="$PWD/tmp_bench.pool"
+
+run()
+{
+  label="$1"
+  shift
+  start=$(date +%s%N)
+  i=0
+  while [ $i -lt $n ]; do
+    ./gcc2msvc "$@" -c -O2 -Wall -DNDEBUG -Iinclude -o tmp_bench.obj tmp_bench.c > /dev/null
+    i=$((i+1))
+  done
+  end=$(date +%s%N)
+  us=$(( (end - start) / n / 1000 ))
+  echo "$label: $us us/invocation ($n runs)"
+  if [ -n "$BENCH_RESULTS" ]; then
+    printf '{"bench": "spawn/%s", "value": %s, "unit": "us/invocation", "runs": %s}\n' \
+      "$label" "$us" "$n" >> "$BENCH_RESULTS"
+  fi
+}
+
+run "print-only" --print-only
+run "direct"
+run "shell" --shell
+run "pool" --pool=1
+run "shell+pool" --shell --pool=1
+
+for f in tmp_bench.pool/*.lock; do
+  pid=$(cut -d' ' -f1 "$f")
+  [ "$pid" -gt 0 ] && kill "$pid" 2>/dev/null || true
+done
+rm -rf tmp_bench.pool
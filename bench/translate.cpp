@@ -0,0 +1,132 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * cost of translate() for synthetic command lines, in-process
+ *
+ *   bench/translate [rounds]
+ *
+ * Results are printed and, if BENCH_RESULTS is set, appended to that
+ * file as JSON lines.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gcc2msvc.h"
+
+
+static void report(const char *name, double value, const char *unit, long n)
+{
+  printf("%-28s %12.0f %s (%ld runs)\n", name, value, unit, n);
+
+  const char *file = getenv("BENCH_RESULTS");
+  if (file != NULL && *file != 0)
+  {
+    FILE *fp = fopen(file, "a");
+    if (fp != NULL)
+    {
+      fprintf(fp, "{\"bench\": \"%s\", \"value\": %.0f, \"unit\": \"%s\", \"runs\": %ld}\n",
+              name, value, unit, n);
+      fclose(fp);
+    }
+  }
+}
+
+static void run(const char *name, std::vector<std::string> args, long rounds)
+{
+  std::vector<char *> argv;
+  struct translation t;
+  size_t sum = 0;
+
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    argv.push_back(&args[i][0]);
+  }
+  argv.push_back(NULL);
+
+  /* warm up the path cache and the allocator */
+  translate(args.size(), argv.data(), t);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long r = 0; r < rounds; ++r)
+  {
+    translate(args.size(), argv.data(), t);
+    sum += t.cl_args.size();
+  }
+  std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+
+  if (sum == 0)
+  {
+    std::cerr << name << ": nothing translated" << std::endl;
+  }
+  report(name, d.count() / rounds, "ns/translation", rounds);
+}
+
+int main(int argc, char **argv)
+{
+  long rounds = (argc > 1) ? atol(argv[1]) : 20000;
+  std::vector<std::string> a;
+
+  setenv("INCLUDE", "/mnt/c/sdk/include;/mnt/c/sdk/shared", 1);
+  setenv("LIB", "/mnt/c/sdk/lib", 1);
+
+  /* a typical compile line */
+  a = { "gcc", "-c", "-O2", "-g", "-Wall", "-Wextra", "-DNDEBUG", "-Iinclude",
+        "-I/mnt/c/src/project/include", "-std=c++17", "-o", "obj/file.o", "src/file.cpp" };
+  run("translate/short-compile", a, rounds);
+
+  /* a link of 5000 objects and some libraries */
+  a = { "gcc", "-o", "app.exe" };
+  for (int i = 0; i < 5000; ++i)
+  {
+    a.push_back("/mnt/c/src/project/build/obj/module" + std::to_string(i / 100) +
+                "/file" + std::to_string(i) + ".o");
+  }
+  for (int i = 0; i < 50; ++i)
+  {
+    a.push_back("-L/mnt/c/libs/lib" + std::to_string(i));
+    a.push_back("-lfoo" + std::to_string(i));
+  }
+  run("translate/link-5000-objects", a, rounds / 200 + 1);
+
+  /* hundreds of -I and -D */
+  a = { "gcc", "-c", "-O2" };
+  for (int i = 0; i < 300; ++i)
+  {
+    a.push_back("-I/mnt/c/src/project/components/c" + std::to_string(i) + "/include");
+    a.push_back("-DCONFIG_OPTION_" + std::to_string(i) + "=" + std::to_string(i));
+  }
+  a.push_back("-I");
+  a.push_back("/usr/include");
+  a.push_back("src/file.c");
+  run("translate/heavy-I-D", a, rounds / 20 + 1);
+
+  return 0;
+}
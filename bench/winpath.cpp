@@ -0,0 +1,173 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * paths per second of win_path() compared to the /mnt/<letter> only
+ * version it replaced, on a synthetic command line worth of paths
+ *
+ *   bench/winpath [mountinfo] [rounds]
+ *
+ * Results are printed and, if BENCH_RESULTS is set, appended to that
+ * file as JSON lines.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gcc2msvc.h"
+
+
+/* the previous win_path(), leak included */
+static std::string old_win_path(const char *ch)
+{
+  std::string str;
+
+  if (ch[0] == '/')
+  {
+    bool prepend = true;
+
+    if (strncmp(ch, "/mnt/", 5) == 0 && strlen(ch) > 5)
+    {
+      if (strchr("cdefghijklmnopqrstuvwxyzab", ch[5]) != NULL)
+      {
+        char *drive = new char[2];
+        sprintf(drive, "%c", toupper(ch[5]));
+
+        if (strlen(ch) == 6)
+        {
+          prepend = false;
+          str = std::string(drive) + ":/";
+        }
+        else if (ch[6] == '/')
+        {
+          prepend = false;
+          str = std::string(drive) + ":/" + std::string(ch+7);
+        }
+      }
+    }
+
+    if (prepend)
+    {
+      str = "." + std::string(ch);
+    }
+  }
+  else
+  {
+    str = std::string(ch);
+  }
+
+  return str;
+}
+
+static void report(const char *name, double value)
+{
+  printf("%-28s %12.0f paths/s\n", name, value);
+
+  const char *file = getenv("BENCH_RESULTS");
+  if (file != NULL && *file != 0)
+  {
+    FILE *fp = fopen(file, "a");
+    if (fp != NULL)
+    {
+      fprintf(fp, "{\"bench\": \"%s\", \"value\": %.0f, \"unit\": \"paths/s\"}\n", name, value);
+      fclose(fp);
+    }
+  }
+}
+
+template <class F>
+static double paths_per_second(const std::vector<std::string> &paths, int rounds, F f)
+{
+  size_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (int r = 0; r < rounds; ++r)
+  {
+    sum += f(paths);
+  }
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  if (sum == 0)
+  {
+    std::cerr << "nothing translated" << std::endl;
+  }
+  return paths.size() * (double)rounds / d.count();
+}
+
+int main(int argc, char **argv)
+{
+  const char *mountinfo = (argc > 1) ? argv[1] : "bench/mountinfo.wsl";
+  int rounds = (argc > 2) ? atoi(argv[2]) : 2000;
+
+  setenv("WSL_DISTRO_NAME", "Ubuntu", 0);
+  paths_init(mountinfo);
+
+  /* a few hundred -I/-L/source paths, as on a large command line */
+  std::vector<std::string> paths;
+  for (int i = 0; i < 100; ++i)
+  {
+    paths.push_back("/mnt/c/src/project/module" + std::to_string(i) + "/include");
+    paths.push_back("/mnt/d/sdk/lib/x64/part" + std::to_string(i));
+    paths.push_back("/home/dev/src/lib" + std::to_string(i) + "/file.c");
+    paths.push_back("src/relative" + std::to_string(i) + ".c");
+  }
+  paths.push_back("/usr/include");
+  paths.push_back("/mnt/wsl/shared/x.h");
+  paths.push_back("/win/e/data");
+  paths.push_back("/mnt/share drive/docs");
+
+  for (size_t i = paths.size() - 4; i < paths.size(); ++i)
+  {
+    std::cout << paths[i] << " -> " << win_path(paths[i].c_str()) << std::endl;
+  }
+  std::cout << paths[2] << " -> " << win_path(paths[2].c_str()) << std::endl;
+
+  double old_rate = paths_per_second(paths, rounds, [](const std::vector<std::string> &p) {
+    size_t n = 0;
+    for (size_t i = 0; i < p.size(); ++i) { n += old_win_path(p[i].c_str()).size(); }
+    return n;
+  });
+  double new_rate = paths_per_second(paths, rounds, [](const std::vector<std::string> &p) {
+    size_t n = 0;
+    for (size_t i = 0; i < p.size(); ++i) { n += win_path(p[i].c_str()).size(); }
+    return n;
+  });
+  double bulk_rate = paths_per_second(paths, rounds, [](const std::vector<std::string> &p) {
+    std::vector<std::string> out;
+    win_paths(p, "/I", out);
+    return out.size();
+  });
+
+  report("winpath/old", old_rate);
+  report("winpath/win_path", new_rate);
+  report("winpath/win_paths", bulk_rate);
+  return 0;
+}
@@ -0,0 +1,600 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Object cache in front of cl.exe.
+ *
+ * The key is a hash over the toolchain (config.h defaults, the cl.exe
+ * binary and the options in the CL and _CL_ environment variables),
+ * the translated cl.exe options and the preprocessed source
+ * (cl.exe /E). An entry is a directory <dir>/<k0k1>/<key> holding the
+ * object file, the program database (if one was named with /Fd) and the
+ * captured stdout/stderr of the compiler. Entries are assembled in
+ * <dir>/tmp and renamed into place, so concurrent builds never see a
+ * partial entry. The mtime of an entry is its last use; once the cache
+ * grows beyond GCC2MSVC_CACHE_MAX the least recently used entries are
+ * removed.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "config.h"
+#include "gcc2msvc.h"
+#include "hash.h"
+
+#define CACHE_VERSION      "gcc2msvc cache 1"
+#define CACHE_DEFAULT_MAX  (5ULL << 30)
+
+struct cache_stats {
+  unsigned long long hits, misses, uncacheable, size;
+};
+
+struct cache_entry {
+  time_t mtime;
+  unsigned long long size;
+  std::string path;
+};
+
+
+std::string cache_dir()
+{
+  const char *dir = getenv("GCC2MSVC_CACHE_DIR");
+  if (dir != NULL && *dir != 0)
+  {
+    return dir;
+  }
+  dir = getenv("XDG_CACHE_HOME");
+  if (dir != NULL && *dir != 0)
+  {
+    return std::string(dir) + "/gcc2msvc";
+  }
+  dir = getenv("HOME");
+  return std::string(dir ? dir : "/tmp") + "/.cache/gcc2msvc";
+}
+
+/* 5G, 500M, 100K or plain bytes */
+static unsigned long long cache_max()
+{
+  const char *env = getenv("GCC2MSVC_CACHE_MAX");
+  if (env == NULL || *env == 0)
+  {
+    return CACHE_DEFAULT_MAX;
+  }
+
+  char *end;
+  unsigned long long n = strtoull(env, &end, 10);
+  switch (*end)
+  {
+    case 'G': case 'g': n <<= 30; break;
+    case 'M': case 'm': n <<= 20; break;
+    case 'K': case 'k': n <<= 10; break;
+  }
+  return n;
+}
+
+bool mkdirs(const std::string &path)
+{
+  for (size_t pos = 1; pos <= path.size(); ++pos)
+  {
+    if (pos == path.size() || path[pos] == '/')
+    {
+      if (mkdir(path.substr(0, pos).c_str(), 0777) != 0 && errno != EEXIST)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool copy_file(const std::string &src, const std::string &dst)
+{
+  std::string tmp = dst + ".tmp" + std::to_string(getpid());
+  int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0)
+  {
+    return false;
+  }
+  int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (out < 0)
+  {
+    close(in);
+    return false;
+  }
+
+  char buf[65536];
+  ssize_t n = 0;
+  bool ok = true;
+  bool cloned = false;
+
+#ifdef FICLONE
+  /* a reflink shares the data where the filesystem can */
+  cloned = ioctl(out, FICLONE, in) == 0;
+#endif
+  while (!cloned && (n = read(in, buf, sizeof(buf))) > 0)
+  {
+    if (write(out, buf, n) != n)
+    {
+      ok = false;
+      break;
+    }
+  }
+  if (n < 0) { ok = false; }
+  close(in);
+  if (close(out) != 0) { ok = false; }
+
+  if (!ok || rename(tmp.c_str(), dst.c_str()) != 0)
+  {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool write_file(const std::string &path, const std::string &data)
+{
+  std::ofstream out(path.c_str(), std::ios::binary);
+  out << data;
+  return out.good();
+}
+
+static std::string read_file(const std::string &path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+/* remove an entry (a directory of plain files); returns the bytes freed */
+static unsigned long long remove_entry(const std::string &path)
+{
+  unsigned long long freed = 0;
+  DIR *dp = opendir(path.c_str());
+
+  if (dp != NULL)
+  {
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL)
+    {
+      if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      {
+        continue;
+      }
+      std::string file = path + "/" + de->d_name;
+      struct stat st;
+      if (stat(file.c_str(), &st) == 0)
+      {
+        freed += st.st_size;
+      }
+      unlink(file.c_str());
+    }
+    closedir(dp);
+  }
+  rmdir(path.c_str());
+
+  return freed;
+}
+
+static unsigned long long entry_size(const std::string &path)
+{
+  unsigned long long size = 0;
+  DIR *dp = opendir(path.c_str());
+
+  if (dp != NULL)
+  {
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL)
+    {
+      struct stat st;
+      if (de->d_name[0] != '.' && stat((path + "/" + de->d_name).c_str(), &st) == 0)
+      {
+        size += st.st_size;
+      }
+    }
+    closedir(dp);
+  }
+  return size;
+}
+
+/* all entries, found by walking <dir>/<xx>/<key> */
+static std::vector<cache_entry> list_entries(const std::string &dir)
+{
+  std::vector<cache_entry> entries;
+  DIR *top = opendir(dir.c_str());
+
+  if (top == NULL)
+  {
+    return entries;
+  }
+
+  struct dirent *de;
+  while ((de = readdir(top)) != NULL)
+  {
+    if (strlen(de->d_name) != 2 || !isxdigit(de->d_name[0]) || !isxdigit(de->d_name[1]))
+    {
+      continue;
+    }
+    std::string sub = dir + "/" + de->d_name;
+    DIR *dp = opendir(sub.c_str());
+    if (dp == NULL)
+    {
+      continue;
+    }
+
+    struct dirent *ke;
+    while ((ke = readdir(dp)) != NULL)
+    {
+      struct stat st;
+      cache_entry e;
+      e.path = sub + "/" + ke->d_name;
+      if (ke->d_name[0] != '.' && stat(e.path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      {
+        e.mtime = st.st_mtime;
+        e.size = entry_size(e.path);
+        entries.push_back(e);
+      }
+    }
+    closedir(dp);
+  }
+  closedir(top);
+
+  return entries;
+}
+
+
+/* statistics are kept in <dir>/stats and updated under flock() */
+
+static void parse_stats(const std::string &data, cache_stats &st)
+{
+  std::istringstream in(data);
+  std::string name;
+  unsigned long long n;
+
+  memset(&st, 0, sizeof(st));
+  while (in >> name >> n)
+  {
+    if      (name == "hits")        { st.hits = n;        }
+    else if (name == "misses")      { st.misses = n;      }
+    else if (name == "uncacheable") { st.uncacheable = n; }
+    else if (name == "size")        { st.size = n;        }
+  }
+}
+
+static bool update_stats(const std::string &dir, const cache_stats &delta, bool reset_size,
+                         cache_stats *result)
+{
+  std::string path = dir + "/stats";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0)
+  {
+    return false;
+  }
+  flock(fd, LOCK_EX);
+
+  std::string data;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    data.append(buf, n);
+  }
+
+  cache_stats st;
+  parse_stats(data, st);
+  st.hits += delta.hits;
+  st.misses += delta.misses;
+  st.uncacheable += delta.uncacheable;
+  st.size = reset_size ? delta.size : st.size + delta.size;
+
+  data = "hits " + std::to_string(st.hits) + "\n"
+    "misses " + std::to_string(st.misses) + "\n"
+    "uncacheable " + std::to_string(st.uncacheable) + "\n"
+    "size " + std::to_string(st.size) + "\n";
+
+  bool ok = (ftruncate(fd, 0) == 0 && pwrite(fd, data.data(), data.size(), 0) == (ssize_t)data.size());
+  close(fd);
+
+  if (result != NULL)
+  {
+    *result = st;
+  }
+  return ok;
+}
+
+static void count(const std::string &dir, int hits, int misses, int uncacheable,
+                  unsigned long long size, cache_stats *result = NULL)
+{
+  cache_stats delta;
+  delta.hits = hits;
+  delta.misses = misses;
+  delta.uncacheable = uncacheable;
+  delta.size = size;
+  update_stats(dir, delta, false, result);
+}
+
+/* remove the least recently used entries until the cache is below 90% of max */
+static void cleanup(const std::string &dir, unsigned long long max)
+{
+  std::string lock = dir + "/cleanup.lock";
+  int fd = open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0)
+  {
+    return;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+  {
+    /* someone else is already cleaning up */
+    close(fd);
+    return;
+  }
+
+  std::vector<cache_entry> entries = list_entries(dir);
+  std::sort(entries.begin(), entries.end(), [](const cache_entry &a, const cache_entry &b) {
+    return a.mtime < b.mtime;
+  });
+
+  unsigned long long total = 0;
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    total += entries[i].size;
+  }
+  for (size_t i = 0; i < entries.size() && total > max / 10 * 9; ++i)
+  {
+    total -= std::min(total, remove_entry(entries[i].path));
+  }
+
+  cache_stats st;
+  memset(&st, 0, sizeof(st));
+  st.size = total;
+  update_stats(dir, st, true, NULL);
+
+  close(fd);
+}
+
+
+/* returns the value of an option like /FoX or /FdX, or an empty string */
+static std::string option_value(const std::vector<std::string> &args, const char *opt)
+{
+  std::string value;
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    if (begins(args[i].c_str(), opt))
+    {
+      value = args[i].substr(strlen(opt));
+    }
+  }
+  return value;
+}
+
+static bool has_option(const std::vector<std::string> &args, const char *opt)
+{
+  return std::find(args.begin(), args.end(), opt) != args.end();
+}
+
+/* options that only name output files don't change the object */
+static bool is_output_option(const std::string &arg)
+{
+  return begins(arg.c_str(), "/Fo") || begins(arg.c_str(), "/Fd");
+}
+
+void hash_toolchain(struct hash_state *h, const struct tool &cl)
+{
+  struct stat st;
+
+  hash_string(h, CACHE_VERSION);
+  hash_string(h, DEFAULT_CL_PATH_X64);
+  hash_string(h, DEFAULT_CL_PATH_X86);
+  hash_string(h, DEFAULT_INCLUDES);
+  hash_string(h, cl.path.c_str());
+
+  if (stat(cl.path.c_str(), &st) == 0)
+  {
+    hash_update(h, &st.st_size, sizeof(st.st_size));
+    hash_update(h, &st.st_mtime, sizeof(st.st_mtime));
+  }
+
+  /* cl.exe adds the options in CL before and those in _CL_ after its
+   * command line */
+  static const char *const vars[] = { "CL", "_CL_", NULL };
+  for (const char *const *v = vars; *v != NULL; ++v)
+  {
+    const char *val = getenv(*v);
+    hash_string(h, *v);
+    hash_string(h, val ? val : "");
+  }
+}
+
+/* compile a single source file to object through the cache */
+int cache_compile(const struct tool &cl, const std::vector<std::string> &args,
+                  const std::string &object)
+{
+  std::string dir = cache_dir();
+  std::string pdb;
+
+  if (!mkdirs(dir + "/tmp"))
+  {
+    std::cerr << "warning: cannot create cache directory " << dir << std::endl;
+    return run_tool(cl, args);
+  }
+
+  /* /Zi without /Fd writes into a pdb shared by all objects in the directory */
+  if (has_option(args, "/Zi") || has_option(args, "/ZI"))
+  {
+    pdb = option_value(args, "/Fd");
+    if (pdb.empty() || pdb[pdb.size()-1] == '/' || pdb[pdb.size()-1] == '\\')
+    {
+      count(dir, 0, 0, 1, 0);
+      return run_tool(cl, args);
+    }
+    pdb = unix_path(pdb);
+  }
+
+  /* hash the preprocessed source */
+  struct hash_state h;
+  hash_init(&h);
+  hash_toolchain(&h, cl);
+
+  std::vector<std::string> pp_args;
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    if (!is_output_option(args[i]))
+    {
+      hash_string(&h, args[i].c_str());
+      /* the preprocessor reads a precompiled header's source */
+      if (args[i] != "/c" && !begins(args[i].c_str(), "/Yu") && !begins(args[i].c_str(), "/Fp"))
+      {
+        pp_args.push_back(args[i]);
+      }
+    }
+  }
+  pp_args.push_back("/E");
+
+  struct capture pp;
+  pp.echo = false;
+  pp.out_hash = &h;
+
+  if (run_tool_capture(cl, pp_args, pp) != 0)
+  {
+    /* let the real compile report the error */
+    count(dir, 0, 0, 1, 0);
+    return run_tool(cl, args);
+  }
+
+  char key[33];
+  hash_hex(&h, key);
+  std::string entry = dir + "/" + std::string(key, 2) + "/" + key;
+
+  /* hit */
+  struct stat st;
+  if (stat((entry + "/obj").c_str(), &st) == 0 &&
+      copy_file(entry + "/obj", object) &&
+      (pdb.empty() || copy_file(entry + "/pdb", pdb)))
+  {
+    std::string out = read_file(entry + "/stdout");
+    std::string err = read_file(entry + "/stderr");
+    std::cout << out << std::flush;
+    std::cerr << err << std::flush;
+
+    utimes(entry.c_str(), NULL);
+    count(dir, 1, 0, 0, 0);
+    return 0;
+  }
+
+  /* miss: compile and insert */
+  struct capture cap;
+  cap.echo = true;
+  cap.out_hash = NULL;
+
+  int rv = run_tool_capture(cl, args, cap);
+  if (rv != 0)
+  {
+    count(dir, 0, 1, 0, 0);
+    return rv;
+  }
+
+  std::string tmp = dir + "/tmp/" + key + "." + std::to_string(getpid());
+  mkdirs(tmp);
+
+  if (copy_file(object, tmp + "/obj") &&
+      (pdb.empty() || copy_file(pdb, tmp + "/pdb")) &&
+      write_file(tmp + "/stdout", cap.out) &&
+      write_file(tmp + "/stderr", cap.err) &&
+      mkdirs(dir + "/" + std::string(key, 2)) &&
+      rename(tmp.c_str(), entry.c_str()) == 0)
+  {
+    cache_stats now;
+    count(dir, 0, 1, 0, entry_size(entry), &now);
+
+    unsigned long long max = cache_max();
+    if (now.size > max)
+    {
+      cleanup(dir, max);
+    }
+  }
+  else
+  {
+    /* failed, or another process inserted the same entry first */
+    remove_entry(tmp);
+    count(dir, 0, 1, 0, 0);
+  }
+
+  return 0;
+}
+
+int cache_print_stats()
+{
+  std::string dir = cache_dir();
+  cache_stats st;
+
+  parse_stats(read_file(dir + "/stats"), st);
+
+  std::cout << "cache directory:   " << dir << "\n"
+    << "cache hits:        " << st.hits << "\n"
+    << "cache misses:      " << st.misses << "\n"
+    << "uncacheable:       " << st.uncacheable << "\n"
+    << "cache size:        " << st.size / 1024 << " KiB\n"
+    << "max cache size:    " << cache_max() / 1024 << " KiB" << std::endl;
+
+  return 0;
+}
+
+int cache_clear()
+{
+  std::string dir = cache_dir();
+  std::vector<cache_entry> entries = list_entries(dir);
+
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    remove_entry(entries[i].path);
+  }
+
+  cache_stats st;
+  memset(&st, 0, sizeof(st));
+  update_stats(dir, st, true, NULL);
+
+  std::cout << "removed " << entries.size() << " entries from " << dir << std::endl;
+  return 0;
+}
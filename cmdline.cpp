@@ -0,0 +1,247 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Windows command lines: a Windows program receives one string and
+ * splits it into argv itself; cl.exe and link.exe use the rules of the
+ * Microsoft C runtime (same as CommandLineToArgvW()), see
+ * https://msdn.microsoft.com/en-us/library/17w5ykft.aspx
+ *
+ * Also the JSON quoting for the files we write (--batch, --trace).
+ */
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "gcc2msvc.h"
+
+
+/* append a single argument to str, quoted so that the C runtime parses
+ * it back unchanged; with for_cmd set, also quote arguments containing
+ * characters that are special to cmd.exe */
+static void append_quoted(std::string &str, const std::string &arg, bool for_cmd)
+{
+  const char *special = for_cmd ? " \t\n\v\"&|<>^()" : " \t\n\v\"";
+
+  if (!arg.empty() && arg.find_first_of(special) == std::string::npos)
+  {
+    str += arg;
+    return;
+  }
+
+  str += '"';
+
+  for (size_t i = 0; ; ++i)
+  {
+    size_t backslashes = 0;
+
+    while (i < arg.size() && arg[i] == '\\')
+    {
+      ++backslashes;
+      ++i;
+    }
+
+    if (i == arg.size())
+    {
+      /* double them so they don't escape the closing quote */
+      str.append(backslashes * 2, '\\');
+      break;
+    }
+    else if (arg[i] == '"')
+    {
+      str.append(backslashes * 2 + 1, '\\');
+      str += '"';
+    }
+    else
+    {
+      str.append(backslashes, '\\');
+      str += arg[i];
+    }
+  }
+
+  str += '"';
+}
+
+std::string win_quote(const std::string &arg, bool for_cmd)
+{
+  std::string str;
+  append_quoted(str, arg, for_cmd);
+  return str;
+}
+
+/* built in place: link lines can have thousands of arguments */
+std::string join_cmdline(const std::vector<std::string> &args, bool for_cmd)
+{
+  std::string str;
+  size_t len = 0;
+
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    len += args[i].size() + 3;
+  }
+  str.reserve(len);
+
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    if (i > 0)
+    {
+      str += ' ';
+    }
+    append_quoted(str, args[i], for_cmd);
+  }
+
+  return str;
+}
+
+/* the inverse of join_cmdline(): split a command line into arguments
+ * and append them to args */
+void split_cmdline(const std::string &cmdline, std::vector<std::string> &args)
+{
+  size_t i = 0;
+  size_t len = cmdline.size();
+
+  for (;;)
+  {
+    while (i < len && (cmdline[i] == ' ' || cmdline[i] == '\t' || cmdline[i] == '\n'))
+    {
+      ++i;
+    }
+    if (i == len)
+    {
+      break;
+    }
+
+    std::string arg;
+    bool quoted = false;
+
+    while (i < len)
+    {
+      char c = cmdline[i];
+
+      if (c == '\\')
+      {
+        size_t backslashes = 0;
+        while (i < len && cmdline[i] == '\\')
+        {
+          ++backslashes;
+          ++i;
+        }
+        if (i < len && cmdline[i] == '"')
+        {
+          /* 2n backslashes + quote -> n backslashes, quote is a delimiter;
+           * 2n+1 backslashes + quote -> n backslashes and a literal quote */
+          arg.append(backslashes / 2, '\\');
+          if (backslashes % 2 == 1)
+          {
+            arg += '"';
+            ++i;
+          }
+        }
+        else
+        {
+          arg.append(backslashes, '\\');
+        }
+      }
+      else if (c == '"')
+      {
+        if (quoted && i + 1 < len && cmdline[i+1] == '"')
+        {
+          /* "" within a quoted section is a literal quote */
+          arg += '"';
+          i += 2;
+        }
+        else
+        {
+          quoted = !quoted;
+          ++i;
+        }
+      }
+      else if (!quoted && (c == ' ' || c == '\t' || c == '\n'))
+      {
+        break;
+      }
+      else
+      {
+        arg += c;
+        ++i;
+      }
+    }
+
+    args.push_back(arg);
+  }
+}
+
+/* JSON string literal */
+std::string json_quote(const std::string &str)
+{
+  std::string out = "\"";
+
+  for (size_t i = 0; i < str.size(); ++i)
+  {
+    unsigned char c = str[i];
+
+    switch (c)
+    {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n";  break;
+      case '\r': out += "\\r";  break;
+      case '\t': out += "\\t";  break;
+      default:
+        if (c < 0x20)
+        {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        }
+        else
+        {
+          out += c;
+        }
+    }
+  }
+
+  return out + "\"";
+}
+
+/* make's quoting of file names in rules */
+std::string make_quote(const std::string &name)
+{
+  std::string out;
+  for (size_t i = 0; i < name.size(); ++i)
+  {
+    if (name[i] == ' ' || name[i] == '\t' || name[i] == '#')
+    {
+      out += '\\';
+    }
+    else if (name[i] == '$')
+    {
+      out += '$';
+    }
+    out += name[i];
+  }
+  return out;
+}
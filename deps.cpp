@@ -0,0 +1,225 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Make dependency files (-MD, -MMD) from cl.exe /showIncludes.
+ *
+ * cl.exe writes a "Note: including file:" line to stdout for every
+ * header it opens (GCC2MSVC_SHOWINCLUDES_PREFIX if it speaks another
+ * language); the --pch records read them the same way. Those lines are taken out of its output while it
+ * runs, everything else is passed on right away. The headers are mapped
+ * back to Linux paths, each one listed once, and written in GCC's
+ * format to a temporary file that is renamed to the .d file, so make
+ * never reads half of one. With -MMD headers in the system include
+ * directories (INCLUDE and the configured defaults) are left out.
+ * Headers in a precompiled header (--pch) are taken from its record,
+ * cl.exe doesn't report them.
+ */
+
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+struct dep_list {
+  const struct dep_options *opt;
+  std::unordered_set<std::string> seen;
+  std::vector<std::string> headers;
+  struct time_trace *trace;              /* -ftime-trace, or NULL */
+};
+
+
+static void add_header(struct dep_list &d, const std::string &path)
+{
+  if (!d.opt->system)
+  {
+    for (size_t i = 0; i < d.opt->system_dirs.size(); ++i)
+    {
+      const std::string &dir = d.opt->system_dirs[i];
+      if (path.compare(0, dir.size(), dir) == 0 && path.size() > dir.size() &&
+          path[dir.size()] == '/')
+      {
+        return;
+      }
+    }
+  }
+  if (d.seen.insert(path).second)
+  {
+    d.headers.push_back(path);
+  }
+}
+
+/* a /showIncludes line: the header it names is set in path; the
+ * prefix differs with cl.exe's language, GCC2MSVC_SHOWINCLUDES_PREFIX
+ * sets another one */
+bool include_note(const std::string &line, std::string &path)
+{
+  static const char *prefix = NULL;
+
+  if (prefix == NULL)
+  {
+    prefix = getenv("GCC2MSVC_SHOWINCLUDES_PREFIX");
+    if (prefix == NULL || *prefix == 0)
+    {
+      prefix = "Note: including file:";
+    }
+  }
+  size_t len = strlen(prefix);
+  if (line.compare(0, len, prefix) != 0)
+  {
+    return false;
+  }
+
+  size_t begin = line.find_first_not_of(' ', len);
+  size_t end = line.find_last_not_of(" \r\n");
+  path = (begin != std::string::npos && end >= begin) ? line.substr(begin, end + 1 - begin) : "";
+  return true;
+}
+
+static bool note_filter(const std::string &line, void *ctx)
+{
+  struct dep_list &d = *(struct dep_list *)ctx;
+
+  if (d.trace != NULL && time_trace_filter(line, d.trace))
+  {
+    return true;
+  }
+  std::string path;
+  if (!include_note(line, path))
+  {
+    return false;
+  }
+  if (!path.empty())
+  {
+    add_header(d, stage_origin(unix_path(path)));
+  }
+  return true;
+}
+
+static bool write_depfile(const struct dep_list &d, const std::string &file,
+                          const std::vector<std::string> &targets, const std::string &source)
+{
+  std::string text;
+
+  for (size_t i = 0; i < targets.size(); ++i)
+  {
+    text += (i > 0 ? " " : "") + targets[i];
+  }
+  text += ": " + make_quote(source);
+  for (size_t i = 0; i < d.headers.size(); ++i)
+  {
+    text += " \\\n  " + make_quote(d.headers[i]);
+  }
+  text += "\n";
+  if (d.opt->phony)
+  {
+    for (size_t i = 0; i < d.headers.size(); ++i)
+    {
+      text += "\n" + make_quote(d.headers[i]) + ":\n";
+    }
+  }
+
+  std::string tmp = file + ".tmp" + std::to_string(getpid());
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if (fp == NULL)
+  {
+    return false;
+  }
+  bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+  ok = (fclose(fp) == 0) && ok && rename(tmp.c_str(), file.c_str()) == 0;
+  if (!ok)
+  {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+/* compile source with /showIncludes and write the dependency file for
+ * object; the .d file is named after the object unless -MF was given,
+ * and its target is the object unless -MT or -MQ were given; with
+ * time_trace set, the -ftime-trace file is written as well */
+int deps_compile(const struct tool &cl, const std::vector<std::string> &args,
+                 const struct dep_options &opt, const std::string &source,
+                 const std::string &object, const std::string &time_trace)
+{
+  struct dep_list d;
+  std::vector<std::string> cl_args = args;
+  std::vector<std::string> targets = opt.targets;
+  std::string file = opt.file;
+
+  d.opt = &opt;
+  d.trace = NULL;
+  if (file.empty())
+  {
+    size_t slash = object.rfind('/');
+    size_t dot = object.rfind('.');
+    file = ((dot != std::string::npos && (slash == std::string::npos || dot > slash)) ?
+            object.substr(0, dot) : object) + ".d";
+  }
+  if (targets.empty())
+  {
+    targets.push_back(make_quote(object));
+  }
+
+  /* the headers of the precompiled header, the first one is itself */
+  if (!opt.pch_deps.empty())
+  {
+    std::ifstream in(opt.pch_deps.c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+      size_t pos = line.find(' ', line.find(' ') + 1);
+      if (pos != std::string::npos)
+      {
+        add_header(d, line.substr(pos + 1));
+      }
+    }
+  }
+
+  cl_args.insert(cl_args.begin(), "/showIncludes");
+  if (!time_trace.empty())
+  {
+    d.trace = time_trace_begin(time_trace, cl_args);
+  }
+
+  int rv = run_tool_filter(cl, cl_args, note_filter, &d);
+
+  if (d.trace != NULL)
+  {
+    rv = time_trace_end(d.trace, source, rv);
+  }
+  if (rv == 0 && !write_depfile(d, file, targets, source))
+  {
+    fprintf(stderr, "error: cannot write %s\n", file.c_str());
+    return 1;
+  }
+  return rv;
+}
@@ -0,0 +1,342 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Running the msvc tools directly (no /bin/sh, no cmd.exe).
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+#include "memlimit.h"
+
+
+/* the first directory of driver_paths that contains exe is used and
+ * all of them are put in front of PATH, which WSL passes on to Windows
+ * because of WSLENV; where a tool was found is remembered, so the
+ * workers of a compile server don't search again */
+bool find_tool(const char *exe, const std::string &driver_paths, struct tool &t)
+{
+  static std::map<std::string, std::string> found;   /* exe, driver_paths -> path */
+  std::string key = std::string(exe) + '\0' + driver_paths;
+  std::map<std::string, std::string>::iterator it = found.find(key);
+  bool known = (it != found.end());
+  std::string path_dirs;
+  size_t pos = 0;
+
+  t.name = exe;
+  t.path = known ? it->second : "";
+  t.env.clear();
+
+  while (pos <= driver_paths.size())
+  {
+    size_t end = driver_paths.find(';', pos);
+    if (end == std::string::npos)
+    {
+      end = driver_paths.size();
+    }
+    if (end > pos)
+    {
+      std::string dir = unix_path(driver_paths.substr(pos, end - pos));
+      std::string file = dir + "/" + exe;
+
+      if (!known && t.path.empty() && access(file.c_str(), X_OK) == 0)
+      {
+        t.path = file;
+      }
+      path_dirs += dir + ":";
+    }
+    pos = end + 1;
+  }
+  if (!known && !t.path.empty())
+  {
+    found[key] = t.path;
+  }
+
+  bool have_wslenv = false;
+
+  for (char **e = environ; *e != NULL; ++e)
+  {
+    if (begins(*e, "PATH="))
+    {
+      t.env.push_back("PATH=" + path_dirs + std::string(*e + 5));
+    }
+    else if (begins(*e, "WSLENV="))
+    {
+      std::string wslenv = *e;
+      if (wslenv.find("PATH/") == std::string::npos)
+      {
+        wslenv += ":PATH/l";
+      }
+      t.env.push_back(wslenv);
+      have_wslenv = true;
+    }
+    else
+    {
+      t.env.push_back(*e);
+    }
+  }
+  if (!have_wslenv)
+  {
+    t.env.push_back("WSLENV=PATH/l");
+  }
+
+  return !t.path.empty();
+}
+
+/* --mem-limit: waits until there is memory for the tool; returns args,
+ * with /Zm added in copy if the tool needs it */
+static const std::vector<std::string> &admit_tool(const struct tool &t,
+                                                  const std::vector<std::string> &args,
+                                                  std::vector<std::string> &copy)
+{
+  std::string zm = mem_admit(t, args);
+  if (zm.empty())
+  {
+    return args;
+  }
+  copy = args;
+  copy.insert(copy.begin(), zm);
+  return copy;
+}
+
+/* long command lines are passed on in response files, which the caller
+ * removes with remove_response_files() once the tool is done */
+static pid_t start_tool(const struct tool &t, const std::vector<std::string> &tool_args,
+                        int out_fd, int err_fd, std::vector<std::string> &rsp_files)
+{
+  std::vector<std::string> copy;
+  std::vector<std::string> args = admit_tool(t, tool_args, copy);
+  std::vector<char *> argv, envp;
+
+  rsp_files = use_response_files(args, t.name.size() + 1, false);
+
+  argv.push_back((char *)t.name.c_str());
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    argv.push_back((char *)args[i].c_str());
+  }
+  argv.push_back(NULL);
+
+  for (size_t i = 0; i < t.env.size(); ++i)
+  {
+    envp.push_back((char *)t.env[i].c_str());
+  }
+  envp.push_back(NULL);
+
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = spawn_start(t.path.c_str(), argv.data(), envp.data(), out_fd, err_fd);
+  if (pid < 0)
+  {
+    MEM_CHILD(NULL);
+  }
+  return pid;
+}
+
+int run_tool(const struct tool &t, const std::vector<std::string> &args)
+{
+  /* --pool: through a cmd.exe that is already running */
+  std::vector<std::string> copy;
+  const std::vector<std::string> &tool_args = admit_tool(t, args, copy);
+  int rv = pool_run(t, tool_args);
+  if (rv >= 0)
+  {
+    return rv;
+  }
+
+  std::vector<std::string> rsp_files;
+  pid_t pid = start_tool(t, tool_args, -1, -1, rsp_files);
+
+  rv = (pid < 0) ? 127 : wait_return(pid);
+  remove_response_files(rsp_files);
+  return rv;
+}
+
+static bool write_fd(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* like run_tool() but stdout and stderr are read through pipes
+ * while the tool is running; see struct capture */
+int run_tool_capture(const struct tool &t, const std::vector<std::string> &args,
+                     struct capture &cap)
+{
+  int out_pipe[2], err_pipe[2];
+
+  if (pipe2(out_pipe, O_CLOEXEC) != 0)
+  {
+    return 127;
+  }
+  if (pipe2(err_pipe, O_CLOEXEC) != 0)
+  {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    return 127;
+  }
+
+  std::vector<std::string> rsp_files;
+  pid_t pid = start_tool(t, args, out_pipe[1], err_pipe[1], rsp_files);
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+
+  struct pollfd pfd[2];
+  pfd[0].fd = out_pipe[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = err_pipe[0];
+  pfd[1].events = POLLIN;
+
+  char buf[65536];
+  int open_fds = 2;
+
+  while (open_fds > 0)
+  {
+    if (poll(pfd, 2, -1) < 0)
+    {
+      if (errno == EINTR) { continue; }
+      break;
+    }
+
+    for (int i = 0; i < 2; ++i)
+    {
+      if (pfd[i].fd < 0 || pfd[i].revents == 0)
+      {
+        continue;
+      }
+
+      ssize_t n = read(pfd[i].fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n <= 0)
+      {
+        close(pfd[i].fd);
+        pfd[i].fd = -1;
+        --open_fds;
+        continue;
+      }
+
+      if (i == 0 && cap.out_hash != NULL)
+      {
+        hash_update(cap.out_hash, buf, n);
+      }
+      else
+      {
+        (i == 0 ? cap.out : cap.err).append(buf, n);
+      }
+      if (cap.echo)
+      {
+        write_fd(i == 0 ? STDOUT_FILENO : STDERR_FILENO, buf, n);
+      }
+    }
+  }
+
+  for (int i = 0; i < 2; ++i)
+  {
+    if (pfd[i].fd >= 0) { close(pfd[i].fd); }
+  }
+
+  int rv = (pid < 0) ? 127 : wait_return(pid);
+  remove_response_files(rsp_files);
+  return rv;
+}
+
+/* like run_tool() but stdout goes through a pipe and every line of it
+ * to filter() as soon as it is complete; lines it returns false for are
+ * written to our stdout. stderr is not touched. */
+int run_tool_filter(const struct tool &t, const std::vector<std::string> &args,
+                    bool (*filter)(const std::string &line, void *ctx), void *ctx)
+{
+  int out_pipe[2];
+
+  if (pipe2(out_pipe, O_CLOEXEC) != 0)
+  {
+    return 127;
+  }
+
+  std::vector<std::string> rsp_files;
+  pid_t pid = start_tool(t, args, out_pipe[1], -1, rsp_files);
+  close(out_pipe[1]);
+
+  char buf[65536];
+  std::string line;
+  ssize_t n;
+
+  while ((n = read(out_pipe[0], buf, sizeof(buf))) != 0)
+  {
+    if (n < 0)
+    {
+      if (errno == EINTR) { continue; }
+      break;
+    }
+
+    const char *p = buf, *end = buf + n;
+    while (p < end)
+    {
+      const char *nl = (const char *)memchr(p, '\n', end - p);
+      if (nl == NULL)
+      {
+        line.append(p, end - p);
+        break;
+      }
+      line.append(p, nl + 1 - p);
+      if (!filter(line, ctx))
+      {
+        write_fd(STDOUT_FILENO, line.data(), line.size());
+      }
+      line.clear();
+      p = nl + 1;
+    }
+  }
+  if (!line.empty() && !filter(line, ctx))
+  {
+    write_fd(STDOUT_FILENO, line.data(), line.size());
+  }
+  close(out_pipe[0]);
+
+  int rv = (pid < 0) ? 127 : wait_return(pid);
+  remove_response_files(rsp_files);
+  return rv;
+}
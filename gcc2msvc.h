@@ -0,0 +1,251 @@
+#ifndef GCC2MSVC_H
+#define GCC2MSVC_H
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+struct hash_state;
+
+/* a msvc tool and the environment to run it with */
+struct tool {
+  std::string name;              /* e.g. cl.exe */
+  std::string path;              /* where it was found, empty if not found */
+  std::vector<std::string> env;
+};
+
+/* output of a tool run through pipes */
+struct capture {
+  bool echo;                     /* also copy it to our stdout/stderr */
+  struct hash_state *out_hash;   /* if set, stdout is hashed instead of kept */
+  std::string out, err;
+};
+
+/* one cl.exe run of a split up multi-source compile */
+struct compile_job {
+  std::vector<std::string> args;
+  std::string source;
+  std::string object;            /* the object file it creates */
+  std::string time_trace;        /* -ftime-trace file, empty if off */
+};
+
+/* -MD, -MMD and friends */
+struct dep_options {
+  std::string file;                      /* -MF */
+  std::vector<std::string> targets;      /* -MT, -MQ */
+  std::vector<std::string> system_dirs;  /* left out without system */
+  std::string pch_deps;                  /* headers of the PCH in use */
+  bool system, phony;                    /* -MD (not -MMD), -MP */
+};
+
+/* --unity=N and friends */
+struct unity_options {
+  int size;                  /* sources per unity file, 0 if off */
+  std::string exclude;       /* file of patterns of sources to leave alone */
+  std::string report;        /* file the groups are appended to */
+  bool verbose;
+};
+
+/* where cl.exe, the headers and the libraries are */
+struct toolchain {
+  std::string name;
+  std::string cl_path_x64, cl_path_x86;    /* like CL_PATH */
+  std::string includes;                    /* /I"dir" ... */
+  std::string libpaths_x64, libpaths_x86;  /* /libpath:"dir" ... */
+};
+
+/* what translate() found was asked for besides compiling */
+enum translate_info {
+  INFO_NONE,
+  INFO_HELP,
+  INFO_HELP_CL,
+  INFO_HELP_LINK,
+  INFO_VERSION,
+  INFO_SEARCH_DIRS,
+  INFO_CACHE_STATS,
+  INFO_CACHE_CLEAR,
+  INFO_TOOLCHAINS
+};
+
+/* -g, -g1, -g0 */
+enum debug_level {
+  DEBUG_NONE,
+  DEBUG_LINES,
+  DEBUG_FULL
+};
+
+/* -fprofile-generate, -fprofile-use */
+enum pgo_mode {
+  PGO_NONE,
+  PGO_GENERATE,
+  PGO_USE
+};
+
+/* a gcc command line translated into a cl.exe command line */
+struct translation {
+  std::vector<std::string> cl_args;
+  std::vector<std::string> sources;
+  std::vector<size_t> source_args;   /* positions of the sources in cl_args */
+  std::string driver_paths;          /* where to look for cl.exe */
+  std::string outname;               /* value of -o */
+  const struct toolchain *toolchain;
+  int bits;                          /* 32 or 64 */
+  int jobs;                          /* value of -j, 0 if not given */
+  int pool;                          /* cmd.exe processes kept running, 0 if off */
+  std::string mem_limit;             /* value of --mem-limit, empty if off */
+  enum translate_info info;
+  struct dep_options deps;
+  struct unity_options unity;
+  enum pgo_mode pgo;
+  std::string pgo_dir;               /* value of -fprofile-generate/-use */
+  std::string pgo_pgd;               /* the .pgd of the linked program */
+  bool pgo_exact;                    /* -fprofile-update=atomic */
+  int lto_threads;                   /* code generation threads, 0: default */
+  bool lto;
+  enum debug_level debug;
+  std::string debug_format;          /* --debug-format=z7|zi, empty: auto */
+  bool debug_split;                  /* -gsplit-dwarf */
+  bool debug_pending;                /* /Z7 or /Zi is still to be chosen */
+  bool jobserver;                    /* make's jobserver, set by run_translation() */
+  std::string time_trace;            /* value of -ftime-trace= */
+  bool use_time_trace;
+  bool cxx;                          /* run as g++ or c++: headers are C++ */
+  bool do_link, have_outname, make_deps;
+  bool verbose, print_only, use_shell, use_cache, use_mp, use_pch;
+};
+
+/* arch.cpp */
+bool arch_option(const std::string &name, std::string &option);
+bool favor_option(const std::string &name, int bits, std::string &option);
+
+/* jobserver.cpp */
+bool jobserver_init();
+bool jobserver_serial();
+int jobserver_fd();
+bool jobserver_try_acquire();
+int jobserver_acquire_upto(int n);
+void jobserver_release();
+void jobserver_release_all();
+int jobserver_held();
+
+/* ledger.cpp */
+void ledger_start(const struct translation &t);
+void ledger_finish(const struct translation &t, int status);
+
+/* link.cpp */
+int link_objects(struct translation &t);
+
+/* main.cpp */
+bool begins(const char *p, const char *str);
+std::string object_name(const std::string &source);
+void debug_args(struct translation &t, bool embed);
+int translate(int argc, char **argv, struct translation &t);
+int run_translation(struct translation &t);
+int run_driver(int argc, char **argv);
+
+/* batch.cpp */
+int batch_main(int argc, char **argv);
+
+/* cache.cpp */
+int cache_compile(const struct tool &cl, const std::vector<std::string> &args,
+                  const std::string &object);
+int cache_print_stats();
+int cache_clear();
+bool copy_file(const std::string &src, const std::string &dst);
+std::string cache_dir();
+bool mkdirs(const std::string &path);
+void hash_toolchain(struct hash_state *h, const struct tool &cl);
+
+/* cmdline.cpp */
+std::string win_quote(const std::string &arg, bool for_cmd);
+std::string join_cmdline(const std::vector<std::string> &args, bool for_cmd);
+void split_cmdline(const std::string &cmdline, std::vector<std::string> &args);
+std::string json_quote(const std::string &str);
+std::string make_quote(const std::string &name);
+
+/* deps.cpp */
+bool include_note(const std::string &line, std::string &path);
+int deps_compile(const struct tool &cl, const std::vector<std::string> &args,
+                 const struct dep_options &opt, const std::string &source,
+                 const std::string &object, const std::string &time_trace);
+
+/* exec.cpp */
+bool find_tool(const char *exe, const std::string &driver_paths, struct tool &t);
+int run_tool(const struct tool &t, const std::vector<std::string> &args);
+int run_tool_capture(const struct tool &t, const std::vector<std::string> &args,
+                     struct capture &cap);
+int run_tool_filter(const struct tool &t, const std::vector<std::string> &args,
+                    bool (*filter)(const std::string &line, void *ctx), void *ctx);
+
+/* parallel.cpp */
+int compile_parallel(const struct tool &cl, const std::vector<struct compile_job> &jobs,
+                     int max_jobs, bool use_cache, const struct dep_options *deps);
+
+/* memlimit.cpp */
+void mem_enable(const std::string &limit);
+std::string mem_admit(const struct tool &t, const std::vector<std::string> &args);
+
+/* paths.cpp */
+void paths_init(const char *mountinfo);
+std::string win_path(const char *ch);
+void win_paths(const std::vector<std::string> &paths, const char *prefix,
+               std::vector<std::string> &out);
+std::string unix_path(const std::string &path);
+bool drvfs_path(const std::string &path);
+
+/* pgo.cpp */
+int pgo_prepare(struct translation &t);
+
+/* pch.cpp */
+int pch_prepare(const struct tool &cl, struct translation &t);
+
+/* pool.cpp */
+void pool_enable(int slots);
+int pool_run(const struct tool &t, const std::vector<std::string> &args);
+
+/* response.cpp */
+int expand_response_files(int argc, char **argv, std::vector<std::string> &args);
+std::vector<std::string> use_response_files(std::vector<std::string> &args, size_t overhead,
+                                            bool for_cmd);
+void remove_response_files(std::vector<std::string> &files);
+
+/* server.cpp */
+int server_main(int argc, char **argv);
+int client_forward(const char *socket_path, int argc, char **argv);
+
+/* timetrace.cpp */
+struct time_trace;
+std::string time_trace_file(const std::string &where, const std::string &object);
+struct time_trace *time_trace_begin(const std::string &file, std::vector<std::string> &args);
+bool time_trace_filter(const std::string &line, void *ctx);
+int time_trace_end(struct time_trace *tt, const std::string &source, int status);
+int time_trace_compile(const struct tool &cl, const std::vector<std::string> &args,
+                       const std::string &source, const std::string &file);
+
+/* toolchain.cpp */
+const struct toolchain &toolchain_builtin();
+const struct toolchain *toolchain_get(const std::string &name);
+int toolchain_list();
+
+/* unity.cpp */
+int unity_compile(const struct tool &cl, const std::vector<struct compile_job> &jobs,
+                  const struct unity_options &u, int max_jobs, bool use_cache);
+std::vector<std::string> unity_rewrite(struct translation &t);
+
+/* stage.cpp */
+void stage_init(const std::string &dir);
+void stage_base(const std::string &dir);
+std::string stage_path(const char *path, bool source);
+std::string stage_origin(const std::string &path);
+int stage_sync();
+
+/* system_return.c */
+extern "C" {
+int system_return(const char *command);
+int wait_return(pid_t pid);
+pid_t spawn_start(const char *path, char *const argv[], char *const envp[], int out_fd, int err_fd);
+int spawn_return(const char *path, char *const argv[], char *const envp[]);
+}
+
+#endif  /* GCC2MSVC_H */
@@ -0,0 +1,304 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * genopts: reads commands.txt on stdin and writes options_table.h
+ * (the option table used by the driver) to stdout.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "options.h"
+
+struct row {
+  std::string key, next, msvc, action;
+  int kind;
+  char type;
+  bool link;
+  int line;
+};
+
+static void fail(int line, const std::string &msg)
+{
+  std::cerr << "commands.txt:" << line << ": " << msg << std::endl;
+  exit(1);
+}
+
+/* split "%s"-style patterns into the literal part and the value type */
+static void split_value(const std::string &pat, std::string &literal, char &type, int line)
+{
+  size_t pos = pat.find('%');
+
+  if (pos == std::string::npos)
+  {
+    literal = pat;
+    type = 0;
+    return;
+  }
+  if (pos + 2 != pat.size() || std::string("sdpi").find(pat[pos+1]) == std::string::npos)
+  {
+    fail(line, "value must be %s, %d, %p or %i at the end of the pattern: " + pat);
+  }
+  literal = pat.substr(0, pos);
+  type = pat[pos+1];
+}
+
+static std::string c_str(const std::string &s)
+{
+  std::string str = "\"";
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    if (s[i] == '"' || s[i] == '\\') { str += '\\'; }
+    str += s[i];
+  }
+  return str + "\"";
+}
+
+static std::string action_name(const std::string &action)
+{
+  std::string str = "ACT_";
+  for (size_t i = 0; i < action.size(); ++i)
+  {
+    str += (action[i] == '-') ? '_' : toupper(action[i]);
+  }
+  return str;
+}
+
+int main()
+{
+  std::vector<row> rows;
+  std::vector<std::string> actions;
+  std::string line;
+  bool link = false;
+  int lineno = 0;
+
+  while (std::getline(std::cin, line))
+  {
+    ++lineno;
+
+    if (line == "# cl")   { link = false; continue; }
+    if (line == "# link") { link = true;  continue; }
+
+    /* keep "[ ]" and "{ }" within the pattern */
+    size_t pos;
+    while ((pos = line.find("[ ]")) != std::string::npos) { line.replace(pos, 3, "\x01"); }
+    while ((pos = line.find("{ }")) != std::string::npos) { line.replace(pos, 3, "\x02"); }
+
+    std::istringstream in(line);
+    std::string pattern, tok;
+    if (!(in >> pattern) || pattern[0] == '#')
+    {
+      continue;
+    }
+
+    row r;
+    r.link = link;
+    r.line = lineno;
+
+    while (in >> tok)
+    {
+      if (tok[0] == '@')
+      {
+        r.action = tok.substr(1);
+        if (std::find(actions.begin(), actions.end(), r.action) == actions.end())
+        {
+          actions.push_back(r.action);
+        }
+      }
+      else if (tok != "\"\"")
+      {
+        r.msvc += (r.msvc.empty() ? "" : " ") + tok;
+      }
+    }
+
+    /* X[ ]Y: joined or separate, X{ }Y: separate only */
+    size_t opt = pattern.find('\x01');
+    size_t sep = pattern.find('\x02');
+    size_t split = (opt != std::string::npos) ? opt : sep;
+
+    if (split == std::string::npos || opt != std::string::npos)
+    {
+      std::string joined = pattern;
+      if (split != std::string::npos)
+      {
+        joined.erase(split, 1);
+      }
+      split_value(joined, r.key, r.type, lineno);
+      r.kind = r.type ? OPT_PREFIX : OPT_EXACT;
+      if (r.key.empty())
+      {
+        fail(lineno, "empty option name");
+      }
+      rows.push_back(r);
+    }
+
+    if (split != std::string::npos)
+    {
+      r.key = pattern.substr(0, split);
+      split_value(pattern.substr(split + 1), r.next, r.type, lineno);
+      r.kind = OPT_SEPARATE;
+      rows.push_back(r);
+    }
+  }
+
+  /* group the entries by key; within a key, separate entries
+   * with a longer fixed next argument are tried first */
+  std::stable_sort(rows.begin(), rows.end(), [](const row &a, const row &b) {
+    if (a.key != b.key)   { return a.key < b.key; }
+    if (a.kind != b.kind) { return a.kind < b.kind; }
+    return a.next.size() > b.next.size();
+  });
+
+  for (size_t i = 1; i < rows.size(); ++i)
+  {
+    const row &a = rows[i-1];
+    const row &b = rows[i];
+    if (a.key == b.key && a.kind == b.kind && a.next == b.next && a.type == b.type)
+    {
+      fail(b.line, "duplicate of line " + std::to_string(a.line) + ": " + b.key);
+    }
+  }
+
+  std::vector<option_key> keys;
+  std::vector<size_t> prefix_lengths;
+
+  for (size_t i = 0; i < rows.size(); ++i)
+  {
+    if (keys.empty() || rows[i].key != keys.back().key)
+    {
+      option_key k;
+      k.key = rows[i].key.c_str();
+      k.len = rows[i].key.size();
+      k.first = i;
+      k.count = 0;
+      keys.push_back(k);
+    }
+    keys.back().count++;
+
+    if (rows[i].kind == OPT_PREFIX &&
+        std::find(prefix_lengths.begin(), prefix_lengths.end(), rows[i].key.size()) == prefix_lengths.end())
+    {
+      prefix_lengths.push_back(rows[i].key.size());
+    }
+  }
+  std::sort(prefix_lengths.begin(), prefix_lengths.end());
+
+  /* find a seed that maps every key to its own slot */
+  size_t size = 16;
+  while (size < keys.size() * 2)
+  {
+    size *= 2;
+  }
+
+  uint32_t seed = 0;
+  std::vector<int> slots;
+
+  for (;;)
+  {
+    bool ok = false;
+
+    for (seed = 1; seed < 100000 && !ok; ++seed)
+    {
+      slots.assign(size, -1);
+      ok = true;
+
+      for (size_t i = 0; i < keys.size() && ok; ++i)
+      {
+        uint32_t h = option_hash(keys[i].key, keys[i].len, seed) & (size - 1);
+        if (slots[h] != -1)
+        {
+          ok = false;
+        }
+        slots[h] = i;
+      }
+    }
+    if (ok)
+    {
+      --seed;
+      break;
+    }
+    size *= 2;
+  }
+
+  std::cout << "/* generated by genopts from commands.txt -- do not edit */\n\n"
+    << "#ifndef OPTIONS_TABLE_H\n#define OPTIONS_TABLE_H\n\n"
+    << "enum option_action {\n  ACT_NONE";
+  for (size_t i = 0; i < actions.size(); ++i)
+  {
+    std::cout << ",\n  " << action_name(actions[i]);
+  }
+  std::cout << "\n};\n\n#endif  /* OPTIONS_TABLE_H */\n\n"
+    << "#ifdef OPTIONS_TABLE_DATA\n\n"
+    << "#define OPTION_HASH_SEED " << seed << "u\n"
+    << "#define OPTION_HASH_MASK " << (size - 1) << "u\n"
+    << "#define OPTION_MAX_PREFIX_LEN " << (prefix_lengths.empty() ? 0 : prefix_lengths.back()) << "\n\n";
+
+  static const char *kinds[] = { "OPT_EXACT", "OPT_PREFIX", "OPT_SEPARATE" };
+
+  std::cout << "static const struct option_entry option_entries[] = {\n";
+  for (size_t i = 0; i < rows.size(); ++i)
+  {
+    const row &r = rows[i];
+    std::cout << "  { " << c_str(r.key) << ", " << kinds[r.kind] << ", "
+      << (r.type ? "'" + std::string(1, r.type) + "'" : "0") << ", "
+      << c_str(r.next) << ", " << (r.link ? "true" : "false") << ", "
+      << c_str(r.msvc) << ", " << (r.action.empty() ? "ACT_NONE" : action_name(r.action))
+      << " },\n";
+  }
+  std::cout << "};\n\n";
+
+  std::cout << "static const struct option_key option_keys[] = {\n";
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    std::cout << "  { " << c_str(keys[i].key) << ", " << keys[i].len << ", "
+      << keys[i].first << ", " << keys[i].count << " },\n";
+  }
+  std::cout << "};\n\n";
+
+  std::cout << "static const int16_t option_slots[" << size << "] = {";
+  for (size_t i = 0; i < size; ++i)
+  {
+    std::cout << (i % 16 == 0 ? "\n  " : " ") << slots[i] << ",";
+  }
+  std::cout << "\n};\n\n";
+
+  std::cout << "/* lengths of the keys of OPT_PREFIX entries */\n"
+    << "static const bool option_prefix_length[OPTION_MAX_PREFIX_LEN + 1] = {";
+  for (size_t i = 0; i <= (prefix_lengths.empty() ? 0 : prefix_lengths.back()); ++i)
+  {
+    bool is = std::find(prefix_lengths.begin(), prefix_lengths.end(), i) != prefix_lengths.end();
+    std::cout << (i % 16 == 0 ? "\n  " : " ") << (is ? "true" : "false") << ",";
+  }
+  std::cout << "\n};\n\n#endif  /* OPTIONS_TABLE_DATA */\n";
+
+  return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * 128 bit FNV-1a, used for cache keys and content hashes;
+ * see http://www.isthe.com/chongo/tech/comp/fnv/
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hash.h"
+
+#define FNV128_OFFSET \
+  (((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+#define FNV128_PRIME \
+  (((unsigned __int128)0x0000000001000000ULL << 64) | 0x000000000000013bULL)
+
+void hash_init(struct hash_state *h)
+{
+  h->value = FNV128_OFFSET;
+}
+
+void hash_update(struct hash_state *h, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  unsigned __int128 v = h->value;
+
+  for (size_t i = 0; i < len; ++i)
+  {
+    v ^= p[i];
+    v *= FNV128_PRIME;
+  }
+  h->value = v;
+}
+
+/* strings are hashed including their terminating null byte
+ * so that "ab","c" and "a","bc" differ */
+void hash_string(struct hash_state *h, const char *str)
+{
+  hash_update(h, str, strlen(str) + 1);
+}
+
+int hash_file(struct hash_state *h, const char *path)
+{
+  char buf[65536];
+  size_t n;
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL)
+  {
+    return -1;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+  {
+    hash_update(h, buf, n);
+  }
+  n = ferror(fp);
+  fclose(fp);
+
+  return n ? -1 : 0;
+}
+
+/* 32 hex digits plus null byte */
+void hash_hex(const struct hash_state *h, char *out)
+{
+  static const char digits[] = "0123456789abcdef";
+  unsigned __int128 v = h->value;
+
+  for (int i = 31; i >= 0; --i)
+  {
+    out[i] = digits[v & 0xf];
+    v >>= 4;
+  }
+  out[32] = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hash_state {
+  unsigned __int128 value;
+};
+
+void hash_init(struct hash_state *h);
+void hash_update(struct hash_state *h, const void *data, size_t len);
+void hash_string(struct hash_state *h, const char *str);
+int hash_file(struct hash_state *h, const char *path);
+void hash_hex(const struct hash_state *h, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* HASH_H */
@@ -0,0 +1,212 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * GNU make jobserver client, see
+ * https://www.gnu.org/software/make/manual/html_node/Job-Slots.html
+ *
+ * make passes the jobserver in MAKEFLAGS, either as a pipe
+ * (--jobserver-auth=R,W or --jobserver-fds=R,W) or as a named pipe
+ * (--jobserver-auth=fifo:PATH). Every job started by make owns one
+ * implicit token; for each additional process we run at the same time
+ * we read one byte from the jobserver and write it back when done.
+ *
+ * The pipe is reopened through /proc/self/fd so that reads can be
+ * non-blocking without changing the file status flags make shares
+ * with its other children. make only leaves the pipe open for
+ * recursive commands (marked with `+' or using $(MAKE)).
+ */
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+static bool js_initialized = false;
+static int js_read = -1;
+static int js_write = -1;
+static bool js_serial = false;
+static std::vector<char> js_tokens;  /* tokens we hold, to be written back */
+
+
+static bool is_fifo(int fd)
+{
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static int reopen(const std::string &path, int flags)
+{
+  return open(path.c_str(), flags | O_CLOEXEC);
+}
+
+/* returns true if we have a jobserver to talk to */
+bool jobserver_init()
+{
+  if (js_initialized)
+  {
+    return js_read >= 0;
+  }
+  js_initialized = true;
+
+  const char *flags = getenv("MAKEFLAGS");
+  if (flags == NULL)
+  {
+    return false;
+  }
+
+  /* the last occurrence wins */
+  std::string auth;
+  const char *p = flags;
+  while ((p = strstr(p, "--jobserver-")) != NULL)
+  {
+    if (begins(p, "--jobserver-auth=") || begins(p, "--jobserver-fds="))
+    {
+      const char *v = strchr(p, '=') + 1;
+      auth = std::string(v, strcspn(v, " "));
+    }
+    p += 12;
+  }
+  if (auth.empty())
+  {
+    /* make only creates a jobserver for -jN with N > 1; a make
+     * without -j or with -j1 runs one job at a time */
+    std::string f = std::string(" ") + flags + " ";
+    js_serial = f.find(" -j") == std::string::npos || f.find(" -j1 ") != std::string::npos;
+    return false;
+  }
+
+  if (begins(auth.c_str(), "fifo:"))
+  {
+    std::string path = auth.substr(5);
+    js_read = reopen(path, O_RDONLY | O_NONBLOCK);
+    js_write = reopen(path, O_WRONLY);
+  }
+  else
+  {
+    int r, w;
+    if (sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 || !is_fifo(r) || !is_fifo(w))
+    {
+      return false;
+    }
+    js_read = reopen("/proc/self/fd/" + std::to_string(r), O_RDONLY | O_NONBLOCK);
+    js_write = reopen("/proc/self/fd/" + std::to_string(w), O_WRONLY);
+  }
+
+  if (js_read < 0 || js_write < 0)
+  {
+    if (js_read >= 0)  { close(js_read);  }
+    if (js_write >= 0) { close(js_write); }
+    js_read = js_write = -1;
+    return false;
+  }
+
+  /* tokens must go back to make however we exit (forked children
+   * leave with _exit() and don't hand back their parent's tokens) */
+  atexit(jobserver_release_all);
+  return true;
+}
+
+/* true if run by a make that allows only one job */
+bool jobserver_serial()
+{
+  jobserver_init();
+  return js_serial;
+}
+
+/* readable when a token may be available; -1 if there's no jobserver */
+int jobserver_fd()
+{
+  return jobserver_init() ? js_read : -1;
+}
+
+/* take one token without blocking */
+bool jobserver_try_acquire()
+{
+  if (!jobserver_init())
+  {
+    return false;
+  }
+
+  char c;
+  ssize_t n;
+  do {
+    n = read(js_read, &c, 1);
+  } while (n < 0 && errno == EINTR);
+
+  if (n == 1)
+  {
+    js_tokens.push_back(c);
+    return true;
+  }
+  return false;
+}
+
+/* take up to n tokens without blocking, returns how many were taken */
+int jobserver_acquire_upto(int n)
+{
+  int got = 0;
+  while (got < n && jobserver_try_acquire())
+  {
+    ++got;
+  }
+  return got;
+}
+
+void jobserver_release()
+{
+  if (js_tokens.empty())
+  {
+    return;
+  }
+
+  char c = js_tokens.back();
+  ssize_t n;
+  do {
+    n = write(js_write, &c, 1);
+  } while (n < 0 && errno == EINTR);
+
+  js_tokens.pop_back();
+}
+
+void jobserver_release_all()
+{
+  while (!js_tokens.empty())
+  {
+    jobserver_release();
+  }
+}
+
+int jobserver_held()
+{
+  return js_tokens.size();
+}
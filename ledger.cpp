@@ -0,0 +1,223 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Build telemetry: with --ledger=file (or GCC2MSVC_LEDGER=file) every
+ * invocation appends one fixed-size struct ledger_record to the file.
+ *
+ * The file is opened with O_APPEND and the record written with a single
+ * write(), so concurrent invocations don't need a lock. Besides the
+ * times of gcc2msvc itself it holds the wall time and rusage (wait4) of
+ * the tools it ran, the sizes of inputs and outputs and a hash of the
+ * translated options without the file names. The options behind a hash
+ * are written once to <file>.flags, one "<hash> <options>" line each
+ * (without include and library directories, to keep it readable).
+ * gcc2msvc-report reads both.
+ */
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+#include "ledger.h"
+#include "trace.h"
+
+static_assert(sizeof(struct ledger_record) == 256, "ledger records are 256 bytes");
+
+int ledger_on = 0;
+
+static std::string ledger_file;
+static struct ledger_record rec;
+
+
+static int64_t realtime_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t timeval_us(const struct timeval &tv)
+{
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static int64_t file_size(const std::string &path)
+{
+  struct stat st;
+  return (stat(path.c_str(), &st) == 0) ? st.st_size : 0;
+}
+
+static std::string absolute(const std::string &path)
+{
+  if (path.empty() || path[0] == '/')
+  {
+    return path;
+  }
+  char cwd[PATH_MAX];
+  return getcwd(cwd, sizeof(cwd)) ? std::string(cwd) + "/" + path : path;
+}
+
+void ledger_init(const char *file)
+{
+  ledger_file = file;
+  ledger_on = !ledger_file.empty();
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = LEDGER_MAGIC;
+  rec.size = sizeof(rec);
+  rec.start_us = realtime_us();
+  rec.pid = getpid();
+}
+
+/* a tool started at start (trace_clock()) was waited for */
+void ledger_child(long long start, const struct rusage *ru)
+{
+  rec.child_wall_us += trace_clock() - start;
+  if (ru != NULL)
+  {
+    rec.child_user_us += timeval_us(ru->ru_utime);
+    rec.child_sys_us += timeval_us(ru->ru_stime);
+  }
+  ++rec.children;
+}
+
+/* adds "<hash> <options>" to <ledger>.flags unless it is there */
+static void write_flags(const char *hex, const std::string &flags)
+{
+  std::string file = ledger_file + ".flags";
+  std::string data;
+  char buf[65536];
+  ssize_t n;
+
+  int fd = open(file.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    return;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    data.append(buf, n);
+  }
+
+  std::string key = std::string(hex) + " ";
+  if (data.compare(0, key.size(), key) != 0 && data.find("\n" + key) == std::string::npos)
+  {
+    std::string line = key + flags + "\n";
+    if (write(fd, line.data(), line.size()) < 0) { /* it's only telemetry */ }
+  }
+  close(fd);
+}
+
+/* what is known before the tools run: the name, inputs and options */
+void ledger_start(const struct translation &t)
+{
+  std::string name = absolute(!t.sources.empty() ? t.sources[0] : t.outname);
+  if (name.size() >= sizeof(rec.name))
+  {
+    name = "..." + name.substr(name.size() - sizeof(rec.name) + 4);
+  }
+  strncpy(rec.name, name.c_str(), sizeof(rec.name) - 1);
+
+  rec.sources = t.sources.size();
+  rec.link = t.do_link;
+  for (size_t i = 0; i < t.sources.size(); ++i)
+  {
+    rec.input_bytes += file_size(t.sources[i]);
+  }
+
+  /* the options without files and output names; the text in the
+   * .flags file also leaves out the include and library directories */
+  std::vector<std::string> flags, shown;
+  for (size_t i = 0; i < t.cl_args.size(); ++i)
+  {
+    const char *a = t.cl_args[i].c_str();
+    if ((a[0] == '/' && a[1] != '/' && !begins(a, "/Fo") && !begins(a, "/out:")) || a[0] == '-')
+    {
+      flags.push_back(a);
+      if (!begins(a, "/I") && !begins(a, "/libpath:"))
+      {
+        shown.push_back(a);
+      }
+    }
+  }
+
+  std::string str = join_cmdline(flags, false);
+  struct hash_state h;
+  char hex[33];
+
+  hash_init(&h);
+  hash_update(&h, str.data(), str.size());
+  memcpy(rec.flags_hash, &h.value, sizeof(rec.flags_hash));
+  hash_hex(&h, hex);
+  write_flags(hex, join_cmdline(shown, false));
+}
+
+/* appends the record of this invocation */
+void ledger_finish(const struct translation &t, int status)
+{
+  struct rusage self;
+
+  if (getrusage(RUSAGE_SELF, &self) == 0)
+  {
+    rec.user_us = timeval_us(self.ru_utime);
+    rec.sys_us = timeval_us(self.ru_stime);
+  }
+  rec.status = status;
+
+  /* what was built: the program or library, the object or objects */
+  if (t.do_link)
+  {
+    rec.output_bytes = file_size(t.have_outname ? t.outname : "a.exe");
+  }
+  else if (t.have_outname)
+  {
+    rec.output_bytes = file_size(t.outname);
+  }
+  else
+  {
+    for (size_t i = 0; i < t.sources.size(); ++i)
+    {
+      rec.output_bytes += file_size(object_name(t.sources[i]));
+    }
+  }
+  rec.end_us = realtime_us();
+
+  int fd = open(ledger_file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd >= 0)
+  {
+    if (write(fd, &rec, sizeof(rec)) < 0) { /* it's only telemetry */ }
+    close(fd);
+  }
+}
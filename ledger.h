@@ -0,0 +1,48 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEDGER_MAGIC  0x3167646c  /* "ldg1" */
+
+/* one invocation of gcc2msvc; appended to the ledger in a single write */
+struct ledger_record {
+  uint32_t magic;                 /* LEDGER_MAGIC */
+  uint32_t size;                  /* sizeof(struct ledger_record) */
+  int64_t start_us, end_us;       /* CLOCK_REALTIME, microseconds */
+  int64_t user_us, sys_us;        /* CPU time of gcc2msvc itself */
+  int64_t child_wall_us;          /* tools run, from start to wait4() */
+  int64_t child_user_us, child_sys_us;
+  int64_t input_bytes;            /* the sources */
+  int64_t output_bytes;           /* objects, program or library */
+  uint8_t flags_hash[16];         /* translated options without the files */
+  int32_t status;                 /* exit code */
+  uint32_t pid;
+  uint16_t sources;
+  uint16_t children;              /* tools run */
+  uint8_t link;                   /* 1 if it linked */
+  uint8_t reserved[3];
+  char name[144];                 /* first source (or output), absolute;
+                                     the end is kept if it is longer */
+};
+
+/* set by ledger_init() if --ledger=file or GCC2MSVC_LEDGER was given;
+ * ledger_child() is only called when it is set */
+extern int ledger_on;
+
+struct rusage;
+
+#define LEDGER_CHILD(start, ru) do { if (ledger_on) { ledger_child(start, ru); } } while (0)
+
+void ledger_init(const char *file);
+void ledger_child(long long start, const struct rusage *ru);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LEDGER_H */
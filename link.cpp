@@ -0,0 +1,297 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Links without a compile run link.exe directly.
+ *
+ * When all inputs are objects and libraries, the options cl.exe would
+ * have passed on to link.exe (/DLL for /LD, /DEBUG for /Zi) are added
+ * to the ones after /link and link.exe is run by itself. A manifest
+ * <output>.link records the link.exe binary, the options, a content
+ * hash of every input and the output's mtime; if none of that changed
+ * the link is skipped. Otherwise links are incremental (/INCREMENTAL,
+ * or /DEBUG:FASTLINK with debug info), unless the options rule that
+ * out (/LTCG, /OPT:REF, /INCREMENTAL:NO, ...); debug info then gets
+ * /DEBUG:FULL. The .ilk file is
+ * removed when the options change, so link.exe starts from scratch.
+ * Libraries found in a /libpath: directory are recorded by size and
+ * mtime only; they are usually the toolchain's own.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+#include "trace.h"
+
+#define LINK_VERSION  "gcc2msvc link 1"
+
+
+static bool has_arg(const std::vector<std::string> &args, const char *prefix)
+{
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    if (strncasecmp(args[i].c_str(), prefix, strlen(prefix)) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* options start with one '/', paths of files only reached through
+ * //server/share with two */
+static bool is_input(const std::string &arg)
+{
+  return !arg.empty() && (arg[0] != '/' || arg[1] == '/');
+}
+
+static std::string hex_of(struct hash_state &h)
+{
+  char hex[33];
+  hash_hex(&h, hex);
+  return hex;
+}
+
+/* the hash of an input: its content, or for a library from a /libpath:
+ * directory its size and mtime; "-" if it isn't found (system libraries
+ * in directories from the LIB variable of link.exe's environment) */
+static std::string input_hash(const std::string &input, const std::vector<std::string> &libpaths)
+{
+  struct hash_state h;
+  struct stat st;
+  std::string path = unix_path(input);
+
+  hash_init(&h);
+  if (stat(path.c_str(), &st) == 0)
+  {
+    return (hash_file(&h, path.c_str()) == 0) ? hex_of(h) : "-";
+  }
+  if (path.find('/') != std::string::npos)
+  {
+    return "-";
+  }
+
+  for (size_t i = 0; i < libpaths.size(); ++i)
+  {
+    std::string file = unix_path(libpaths[i]) + "/" + path;
+    if (stat(file.c_str(), &st) == 0)
+    {
+      hash_string(&h, file.c_str());
+      hash_update(&h, &st.st_size, sizeof(st.st_size));
+      hash_update(&h, &st.st_mtime, sizeof(st.st_mtime));
+      return hex_of(h);
+    }
+  }
+  return "-";
+}
+
+static std::string read_manifest(const std::string &file)
+{
+  std::ifstream in(file.c_str());
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+/* link the object files and libraries of t with link.exe */
+int link_objects(struct translation &t)
+{
+  std::vector<std::string> args, inputs, libpaths;
+  std::string out;
+  bool debug = false, dll = false, after_link = false;
+
+  /* what cl.exe would hand over to link.exe */
+  for (size_t i = 0; i < t.cl_args.size(); ++i)
+  {
+    const std::string &arg = t.cl_args[i];
+
+    if (arg == "/link")
+    {
+      after_link = true;
+    }
+    else if (after_link)
+    {
+      args.push_back(arg);
+      if (strncasecmp(arg.c_str(), "/out:", 5) == 0)
+      {
+        out = unix_path(arg.substr(5));
+      }
+      else if (strncasecmp(arg.c_str(), "/libpath:", 9) == 0)
+      {
+        libpaths.push_back(arg.substr(9));
+      }
+      else if (is_input(arg))
+      {
+        inputs.push_back(arg);
+      }
+    }
+    else if (is_input(arg))
+    {
+      inputs.push_back(arg);
+    }
+    else if (arg == "/nologo")
+    {
+      args.push_back(arg);
+    }
+    else if (arg == "/Zi" || arg == "/ZI" || arg == "/Z7")
+    {
+      debug = true;
+    }
+    else if (arg == "/LD" || arg == "/LDd")
+    {
+      dll = true;
+    }
+  }
+
+  if (dll && !has_arg(args, "/dll"))
+  {
+    args.push_back("/DLL");
+  }
+  bool incremental = !has_arg(args, "/incremental") && !has_arg(args, "/ltcg") &&
+    !has_arg(args, "/opt:ref") && !has_arg(args, "/opt:icf") && !has_arg(args, "/order");
+  if (debug && !has_arg(args, "/debug"))
+  {
+    args.push_back(incremental ? "/DEBUG:FASTLINK" : "/DEBUG:FULL");
+  }
+  else if (!has_arg(args, "/debug") && incremental)
+  {
+    args.push_back("/INCREMENTAL");
+  }
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    if (std::find(args.begin(), args.end(), inputs[i]) == args.end())
+    {
+      args.push_back(inputs[i]);
+    }
+  }
+
+  struct tool link;
+  TRACE_BEGIN("find_tool");
+  find_tool("link.exe", t.driver_paths, link);
+  TRACE_END();
+
+  if (t.verbose)
+  {
+    std::cout << (link.path.empty() ? link.name : link.path) << " "
+      << join_cmdline(args, false) << std::endl;
+  }
+  if (t.print_only)
+  {
+    return 0;
+  }
+  if (link.path.empty())
+  {
+    std::cerr << "error: link.exe not found in " << t.driver_paths << std::endl;
+    return 127;
+  }
+
+  /* the manifest: link.exe and options, one line per input, the output */
+  TRACE_BEGIN("link manifest");
+  std::string manifest_file = out + ".link";
+  struct hash_state h;
+  struct stat st;
+
+  hash_init(&h);
+  hash_string(&h, LINK_VERSION);
+  hash_string(&h, link.path.c_str());
+  if (stat(link.path.c_str(), &st) == 0)
+  {
+    hash_update(&h, &st.st_size, sizeof(st.st_size));
+    hash_update(&h, &st.st_mtime, sizeof(st.st_mtime));
+  }
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    hash_string(&h, args[i].c_str());
+  }
+
+  std::string flags = "flags " + hex_of(h) + "\n";
+  std::string manifest = flags;
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    manifest += input_hash(inputs[i], libpaths) + " " + inputs[i] + "\n";
+  }
+  if (t.pgo == PGO_USE)
+  {
+    manifest += input_hash(t.pgo_pgd, libpaths) + " " + t.pgo_pgd + "\n";
+  }
+
+  std::string old = read_manifest(manifest_file);
+  bool up_to_date = false;
+  if (!out.empty() && stat(out.c_str(), &st) == 0)
+  {
+    up_to_date = (old == manifest + "output " + std::to_string((long long)st.st_mtime) + "\n");
+  }
+  TRACE_END();
+
+  if (up_to_date)
+  {
+    if (t.verbose)
+    {
+      std::cout << out << " is up to date" << std::endl;
+    }
+    return 0;
+  }
+
+  /* an .ilk of other options would only be thrown away by link.exe */
+  unlink(manifest_file.c_str());
+  if (old.compare(0, flags.size(), flags) != 0)
+  {
+    size_t dot = out.rfind('.');
+    if (dot == std::string::npos || dot < out.rfind('/') + 1)
+    {
+      dot = out.size();
+    }
+    std::string ilk = out.substr(0, dot) + ".ilk";
+    unlink(ilk.c_str());
+  }
+
+  TRACE_BEGIN("link.exe");
+  int rv = run_tool(link, args);
+  TRACE_END();
+
+  if (rv == 0 && !out.empty() && stat(out.c_str(), &st) == 0)
+  {
+    /* a concurrent or interrupted link must never leave half a manifest */
+    std::string tmp = manifest_file + ".tmp" + std::to_string(getpid());
+    std::ofstream os(tmp.c_str());
+    os << manifest << "output " << (long long)st.st_mtime << "\n";
+    os.close();
+    if (!os || rename(tmp.c_str(), manifest_file.c_str()) != 0)
+    {
+      unlink(tmp.c_str());
+    }
+  }
+  return rv;
+}
@@ -38,6 +38,12 @@
   "  -nostdinc++ -nostdlib -O0 -O1 -O2 -O3 -Os -o file -print-search-dirs -shared\n" \
   "  -std=c<..>|gnu<..> -trigraphs -UDEFINE -w -Wall -Werror -Wextra\n" \
   "  -Wl,--out-implib,libname -Wl,-output-def,defname -Wl,--whole-archive -x <c|c++>\n" \
+  "  -MD -MMD -MF file -MP -MQ target -MT target\n" \
+  "  -fprofile-generate[=dir] -fprofile-use[=dir] -fprofile-update=atomic\n" \
+  "  -flto[=N|auto] -flto-partition=one|none -fno-lto\n" \
+  "  -march=cpu|native -mtune=cpu -msse4.2 -mavx512f -mavx512bw -mavx512cd -mavx512dq\n" \
+  "  -mavx512vl -fopt-info-vec -fopt-info-vec-missed -fopt-info-vec-all\n" \
+  "  -ftime-trace[=file|dir] -g0 -g1 -g2 -g3 -ggdb -gline-tables-only -gsplit-dwarf\n" \
   "\n" \
   "Other options:\n" \
   "  --help                display this information\n" \
@@ -46,19 +52,77 @@
   "  --version             display version information of cl.exe and link.exe\n" \
   "  --verbose             print commands\n" \
   "  --print-only          print commands and don't to anything\n" \
+  "  @file                 read more options and files from file (GCC quoting)\n" \
   "  --path=path           semicolon (;) separated list of win32 paths to run cl.exe\n" \
+  "  --toolchain=name      use the newest Visual Studio installation called name\n" \
+  "                        (e.g. vs2019, vs2022-BuildTools, auto) instead of the\n" \
+  "                        built-in paths; name:vcvars runs its vcvarsall.bat\n" \
+  "  --toolchains          list the installations that were found\n" \
+  "  --shell               run cl.exe through /bin/sh and cmd.exe instead of directly\n" \
+  "  --pool[=N]            keep N cmd.exe processes running (default: number of\n" \
+  "                        CPUs) and start the tools through them\n" \
+  "  --debug-format=z7|zi  debug info in the objects or in a PDB per object\n" \
+  "                        (default: z7 for parallel builds and compile + link)\n" \
+  "  --mem-limit[=size]    only start cl.exe and link.exe while the memory they are\n" \
+  "                        expected to need fits in size, e.g. 16G or 75% of\n" \
+  "                        MemAvailable (default: 80%); shared by all invocations\n" \
+  "  --stage=dir           mirror inputs that only exist on the Linux side (sources,\n" \
+  "                        -I directories, -include files and the headers they\n" \
+  "                        include) into dir on a windows drive; --stage=unc\n" \
+  "                        passes \\\\wsl$ paths for them (the default)\n" \
+  "  -j N                  compile several sources given with -c in N parallel cl.exe\n" \
+  "                        processes (default: number of CPUs)\n" \
+  "  --mp                  use cl.exe's /MP for that instead of separate processes\n" \
+  "  --unity=N             compile up to N sources with the same options as one\n" \
+  "                        (see also --unity-exclude=file, --unity-report=file)\n" \
+  "  --cache               look up and store objects compiled with -c in the cache\n" \
+  "  --cache-stats         display cache statistics\n" \
+  "  --cache-clear         remove all objects from the cache\n" \
+  "  --pch                 precompile the header given with -include once it is\n" \
+  "                        used twice with the same options; -c file.h creates\n" \
+  "                        a precompiled header file.h.gch\n" \
+  "  --server[=socket]     run as a compile server listening on a unix socket;\n" \
+  "                        use --jobs=N to limit the number of concurrent jobs\n" \
+  "  --trace=file.json     append Chrome trace events of the driver's phases to file\n" \
+  "  --ledger=file         append a record of times and sizes to file, for\n" \
+  "                        gcc2msvc-report\n" \
+  "  --batch[=]file        translate a compile_commands.json (or, without a file,\n" \
+  "                        JSON lines from stdin) into one for cl.exe; also\n" \
+  "                        --output=file, --run to compile the entries and --jobs=N\n" \
   "  -Wcl,arg -Wlink,arg   parse msvc options directly to cl.exe/link.exe;\n" \
   "                        see also https://msdn.microsoft.com/en-us/library/19z1t1wy.aspx\n" \
   "\n" \
   "Environment variables:\n" \
   "  CL_PATH     semicolon (;) separated list of paths to run cl.exe\n" \
+  "  GCC2MSVC_CACHE      if set (and not 0), enables the object cache\n" \
+  "  GCC2MSVC_CACHE_DIR  cache directory (default: ~/.cache/gcc2msvc)\n" \
+  "  GCC2MSVC_CACHE_MAX  maximum cache size, e.g. 500M or 5G (default: 5G)\n" \
+  "  GCC2MSVC_LEDGER     ledger file, like --ledger\n" \
+  "  GCC2MSVC_MEM_LIMIT  like --mem-limit=size\n" \
+  "  GCC2MSVC_DEBUG_FORMAT  like --debug-format\n" \
+  "  GCC2MSVC_PCH        if set (and not 0), enables precompiled headers (--pch)\n" \
+  "  GCC2MSVC_PCH_DIR    precompiled header directory (default: pch/ in the cache)\n" \
+  "  GCC2MSVC_PCH_MIN    uses of a header before it is precompiled (default: 2)\n" \
+  "  GCC2MSVC_POOL       number of cmd.exe processes to keep running, like --pool=N\n" \
+  "  GCC2MSVC_POOL_DIR   where their lock files and FIFOs are\n" \
+  "                      (default: $XDG_RUNTIME_DIR/gcc2msvc-pool)\n" \
+  "  GCC2MSVC_POOL_JOBS  jobs before a cmd.exe is replaced (default: 100)\n" \
+  "  GCC2MSVC_RSP_LIMIT  longest command line passed on as is; longer ones are\n" \
+  "                      put in response files (default: 32000, 8000 with --shell)\n" \
+  "  GCC2MSVC_SHOWINCLUDES_PREFIX  how cl.exe's /showIncludes lines begin\n" \
+  "                      (default: \"Note: including file:\")\n" \
+  "  GCC2MSVC_STAGE      staging directory, like --stage\n" \
+  "  GCC2MSVC_TOOLCHAIN  toolchain to use, like --toolchain\n" \
+  "  GCC2MSVC_PROGRAM_FILES  where to look for toolchains\n" \
+  "                      (default: C:/Program Files (x86);C:/Program Files)\n" \
+  "  GCC2MSVC_SERVER  socket of a compile server to forward invocations to\n" \
   "  INCLUDE     semicolon (;) separated list of include paths\n" \
   "  LIB         semicolon (;) separated list of library search paths\n"
 
 #include <iostream>
 #include <string>
+#include <vector>
 
-#include <ctype.h>
 #include <errno.h>
 #include <libgen.h>
 #include <stdio.h>
@@ -68,573 +132,450 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-#include "config.h"
+#include "gcc2msvc.h"
+#include "ledger.h"
+#include "trace.h"
 
 #define STR(x) std::string(x)
 
-bool begins(const char *p, const char *str);
-std::string win_path(char *ch);
-void split_env(const char *env_var, std::string msvc_arg, std::string &str);
+std::vector<struct compile_job> split_sources(const std::vector<std::string> &args,
+                                              const std::vector<std::string> &sources,
+                                              const std::vector<size_t> &source_args);
 void print_help(char *self);
-extern "C" {
-int system_return(const char *command);
-}
-
-
-/* check if the beginning of p equals str and if p is longer than str */
-bool begins(const char *p, const char *str)
-{
-  size_t n = strlen(str);
-
-  if (strncmp(p, str, n) == 0 && strlen(p) > n)
-  {
-    return true;
-  }
-  return false;
-}
 
-/* C: is mounted as "/mnt/c", D: as "/mnt/d", and so on;
- * forward slashes (/) are not converted to backslashes (\)
- * because Windows actually supports them */
 
-std::string win_path(char *ch)
+/* one job per source file with the options shared by all of them;
+ * an existing /Fo naming a directory is kept as the objects' location */
+std::vector<struct compile_job> split_sources(const std::vector<std::string> &args,
+                                              const std::vector<std::string> &sources,
+                                              const std::vector<size_t> &source_args)
 {
-  std::string str;
+  std::vector<std::string> common;
+  std::vector<struct compile_job> jobs;
+  std::string dir;
 
-  if (ch[0] == '/')
+  for (size_t i = 0, k = 0; i < args.size(); ++i)
   {
-    bool prepend = true;
-
-    if (begins(ch, "/mnt/"))
+    if (k < source_args.size() && source_args[k] == i)
+    {
+      ++k;
+    }
+    else if (begins(args[i].c_str(), "/Fo"))
     {
-      if (strchr("cdefghijklmnopqrstuvwxyzab", ch[5]) != NULL)
+      dir = args[i].substr(3);
+      if (dir[dir.size()-1] != '/' && dir[dir.size()-1] != '\\')
       {
-        char *drive = new char[2];
-        sprintf(drive, "%c", toupper(ch[5]));
-
-        if (strlen(ch) == 6)
-        {
-          /* /mnt/d -> D:/ */
-          prepend = false;
-          str = STR(drive) + ":/";
-        }
-        else if (ch[6] == '/')
-        {
-          /* /mnt/d/ -> D:/
-           * /mnt/d/dir -> D:/dir */
-          prepend = false;
-          str = STR(drive) + ":/" + STR(ch+7);
-        }
+        /* a single object for several sources is an error cl.exe should report */
+        return jobs;
       }
     }
-
-    if (prepend)
+    else
     {
-      /* /usr/include -> ./usr/include */
-      str = "." + STR(ch);
+      common.push_back(args[i]);
     }
   }
-  else
+
+  for (size_t k = 0; k < sources.size(); ++k)
   {
-    str = STR(ch);
+    struct compile_job job;
+    job.source = sources[k];
+    job.object = unix_path(dir) + object_name(sources[k]);
+    job.args = common;
+    job.args.push_back(args[source_args[k]]);
+    job.args.push_back("/Fo" + dir + object_name(sources[k]));
+    jobs.push_back(job);
   }
 
-  return str;
+  return jobs;
 }
 
-void split_env(const char *env_var, std::string msvc_arg, std::string &str)
+void print_help(char *self)
 {
-  char *env = getenv(env_var);
-  if (env != NULL)
+  std::cout << "Usage: " << self << " [options] file...\n" << USAGE << std::endl;
+}
+
+
+int main(int argc, char **argv)
+{
+  if (argc > 1 && (STR(argv[1]) == "--server" || begins(argv[1], "--server=")))
+  {
+    return server_main(argc, argv);
+  }
+  if (argc > 1 && (STR(argv[1]) == "--batch" || begins(argv[1], "--batch=")))
+  {
+    return batch_main(argc, argv);
+  }
+
+  /* hand the invocation over to a running compile server;
+   * fall back to doing the work ourselves if there is none */
+  char *server = getenv("GCC2MSVC_SERVER");
+  if (server != NULL && *server != 0)
   {
-    char *token = strtok(env, ";");
-    while (token != NULL)
+    int rv = client_forward(server, argc, argv);
+    if (rv >= 0)
     {
-      str += " /" + msvc_arg + "\"" + win_path(token) + "\"";
-      token = strtok(NULL, ";");
+      return rv;
     }
   }
+
+  return run_driver(argc, argv);
 }
 
-void print_help(char *self)
+/* print the information translate() found was asked for */
+static int print_info(char *self, const struct translation &t)
 {
-  std::cout << "Usage: " << self << " [options] file...\n" << USAGE << std::endl;
-}
+  std::string cmd;
+  std::string run_exe = "cmd.exe /C 'set PATH=" + t.driver_paths + ";%PATH% & ";
 
+  switch (t.info)
+  {
+    case INFO_NONE:
+      break;
+
+    case INFO_HELP:
+      print_help(self);
+      return 0;
+
+    case INFO_HELP_CL:
+      /* piping to cat helps to display the
+       * output correctly and in one go */
+      cmd = run_exe + "cl.exe /help' 2>&1 | cat";
+      std::cout << cmd << std::endl;
+      return system(cmd.c_str());
+
+    case INFO_HELP_LINK:
+      cmd = run_exe + "link.exe' 2>&1 | cat";
+      return system(cmd.c_str());
+
+    case INFO_VERSION:
+      cmd = run_exe + "cl.exe' 2>&1 | head -n3 ; " + run_exe + "link.exe' 2>&1 | head -n3";
+      return system(cmd.c_str());
+
+    case INFO_SEARCH_DIRS:
+      std::cout << "toolchain: " << t.toolchain->name << std::endl;
+      std::cout << "cl.exe: " << (t.bits == 32 ? t.toolchain->cl_path_x86 : t.toolchain->cl_path_x64) << std::endl;
+      std::cout << "includes: " << t.toolchain->includes << std::endl;
+      std::cout << "libraries: " << (t.bits == 32 ? t.toolchain->libpaths_x86 : t.toolchain->libpaths_x64) << std::endl;
+      return 0;
+
+    case INFO_CACHE_STATS:
+      return cache_print_stats();
+
+    case INFO_CACHE_CLEAR:
+      return cache_clear();
+
+    case INFO_TOOLCHAINS:
+      return toolchain_list();
+  }
+  return 0;
+}
 
-int main(int argc, char **argv)
+/* run cl.exe for a translated command line */
+int run_translation(struct translation &t)
 {
-  std::string str, cmd, lnk, driver_paths, run_exe;
-  std::string driver_default = DEFAULT_CL_PATH_X64;
-  std::string includes_default = DEFAULT_INCLUDES;
-  std::string lib_paths_default = DEFAULT_LIBPATHS_X64;
-  int bits = 64;
+  std::string str, cmd;
+  std::vector<std::string> &cl_args = t.cl_args;
+  int jobs = (t.jobs > 0) ? t.jobs : sysconf(_SC_NPROCESSORS_ONLN);
 
-  bool verbose = false;
-  bool print_only = false;
-  bool have_outname = false;
-  bool print_search_dirs = false;
-  bool print_help_cl = false;
-  bool print_help_link = false;
-  bool print_version = false;
-  bool do_link = true;
-  bool use_default_driver = true;
-  bool use_default_inc_paths = true;
-  bool default_lib_paths = true;
-  bool dll = false;
+  /* several sources with -c: let cl.exe compile them in parallel (/MP)
+   * or run one cl.exe per source */
+  std::vector<struct compile_job> compile_jobs;
+  bool split = false;
+  int rv;
 
-  char *driver_env = getenv("CL_PATH");
-  if (driver_env != NULL)
+  if (jobserver_serial())
+  {
+    jobs = 1;
+  }
+  /* under make, other jobs compile beside this one: see debug_args() */
+  t.jobserver = jobserver_init();
+  if (t.debug_pending)
   {
-    driver_paths = driver_env;
-    use_default_driver = false;
+    debug_args(t, t.jobserver);
   }
+  pool_enable(t.pool);
+  mem_enable(t.mem_limit);
 
+  /* --stage: mirror the inputs cl.exe can't reach before anything runs */
+  if (!t.print_only && stage_sync() != 0)
+  {
+    return 1;
+  }
 
-  /* parse arguments */
+  /* --unity: several sources compiled as one; when they are also linked
+   * the unity files simply replace them on the command line */
+  bool unity = t.unity.size > 1 && t.sources.size() > 1 && !t.make_deps && !t.use_time_trace;
 
-  for (int i = 1; i < argc; ++i)
+  if (unity && t.do_link && !t.print_only)
   {
-    size_t len = strlen(argv[i]);
-    char *arg = argv[i];
-    str = STR(argv[i]);
+    std::vector<std::string> files = unity_rewrite(t);
+    t.unity.size = 0;
+    rv = run_translation(t);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+      unlink(files[i].c_str());
+    }
+    return rv;
+  }
 
-    if (arg[0] == '-')
+  /* -ftime-trace needs a cl.exe per source to tell their reports apart */
+  if (!t.do_link && !t.have_outname && t.sources.size() > 1 &&
+      (jobs > 1 || unity || t.use_time_trace))
+  {
+    if (t.use_mp && !t.make_deps && !t.use_time_trace && !unity)
     {
-      if (arg[1] == '-')
-      {
-        if      (begins(arg, "--path=")) { driver_paths = arg+7;
-                                           use_default_driver = false;    }
-        else if (str == "--verbose")     { verbose = true;                }
-        else if (str == "--print-only")  { verbose = print_only = true;   }
-        else if (str == "--help")        { print_help(argv[0]); return 0; }
-        else if (begins(arg, "--help-"))
-        {
-          if      (str == "--help-cl")   { print_help_cl = true;   }
-          else if (str == "--help-link") { print_help_link = true; }
-        }
-        else if (str == "--version")     { print_version = true;   }
-      }
-      else
-      {
-        if ((arg[1] == '?' || arg[1] == 'h') && (len == 2 || str == "-help"))
-        {
-          print_help(argv[0]);
-          return 0;
-        }
-
-        /*  -c -C -w  */
-        else if (str == "-c" || str == "-C" || str == "-w")
-        {
-          cmd += " /" + std::string(arg+1);
-          if (str == "-c") {
-            do_link = false;
-          }
-        }
-
-        /*  -g  */
-        else if (str == "-g")
-        {
-          cmd += " /Zi";
-        }
-
-        /*  -x c  -x c++  */
-        else if (arg[1] == 'x')
-        {
-          if (len == 2) {
-            ++i;
-            if (i < argc) {
-              if      (STR(argv[i]) == "c")   { cmd += " /TC"; }
-              else if (STR(argv[i]) == "c++") { cmd += " /TP"; }
-            }
-          }
-          else if (str == "-xc")   { cmd += " /TC"; }
-          else if (str == "-xc++") { cmd += " /TP"; }
-        }
-
-        /*  -o file  */
-        else if (arg[1] == 'o')
-        {
-          if (len == 2) {
-            ++i;
-            if (i < argc) {
-              lnk += " /out:\"" + STR(argv[i]) + "\"";
-            }
-          } else {
-            lnk += " /out:\"" + STR(arg+2) + "\"";
-          }
-          have_outname = true;
-        }
-
-        /*  -I path  */
-        else if (arg[1] == 'I')
-        {
-          if (len == 2) {
-            ++i;
-            if (i < argc) {
-              cmd += " /I\"" + win_path(argv[i]) + "\"";
-            }
-          } else {
-            cmd += " /I\"" + win_path(arg+2) + "\"";
-          }
-        }
-
-        /*  -DDEFINE[=ARG]  -UDEFINE  */
-        else if (arg[1] == 'D' || arg[1] == 'U')
-        {
-          if (len == 2) {
-            ++i;
-            if (i < argc) {
-              cmd += " /" + str.substr(1,1) + "\"" + STR(argv[i]) + "\"";
-            }
-          } else {
-            cmd += " /" + str.substr(1,1) + "\"" + STR(arg+2) + "\"";
-          }
-        }
-
-        /*  -L path  */
-        else if (arg[1] == 'L')
-        {
-          if (len == 2) {
-            ++i;
-            if (i < argc) {
-              lnk += " /libpath:\"" + win_path(argv[i]) + "\"";
-            }
-          } else {
-            lnk += " /libpath:\"" + win_path(arg+2) + "\"";
-          }
-        }
-
-        /*  -llibname  */
-        else if (arg[1] == 'l' && len > 2)
-        {
-          if      (str == "-lmsvcrt")      { cmd += " /MD"; }
-          else if (str == "-lcmt" ||
-                   str == "-llibcmt")      { cmd += " /MT"; } /* however libcmt is not part of mingw-w64 */
-          else if (str != "-lc"         &&
-                   str != "-lm"         &&
-                   str != "-lrt"        && /* always ignore these libraries */
-                   str != "-lstdc++"    &&
-                   str != "-lgcc_s"     &&
-                   str != "-lmingw32"   && /* TODO: maybe add an option   */
-                   str != "-lmingwex"   && /* to disable the blacklisting */
-                   str != "-lmingwthrd" &&
-                   str != "-lmoldname"  &&
-                   str != "-lpthread")     { lnk += " \"" + STR(arg+2) + ".lib\""; }
-        }
-
-        /*  -O0 -O1 -O2 -O3 -Os  */
-        else if (arg[1] == 'O' && len == 3)
-        {
-          if      (arg[2] == '1' ||
-                   arg[2] == '2')   { cmd += " /O2 /Ot"; }
-          else if (arg[2] == '3')   { cmd += " /Ox";     }
-          else if (arg[2] == 's')   { cmd += " /O1 /Os"; }
-          else if (arg[2] == '0')   { cmd += " /Od";     }
-        }
-
-        /*  -Wl,--whole-archive
-         *  -Wl,--out-implib,libname
-         *  -Wl,-output-def,defname
-         *  -Wall  -Wextra  -Werror
-         *  -Wcl,arg  -Wlink,arg  */
-        else if (arg[1] == 'W' && len > 2)
-        {
-          if (arg[2] == 'l')
-          {
-            std::string lopt;
-            if (len == 3) {
-              ++i;
-              if (i < argc) {
-                lopt = STR(argv[i]);
-              }
-            } else {
-              lopt = STR(arg+4);
-            }
-
-            if (lopt == "--whole-archive")
-            {
-              lnk += " /wholearchive";
-            }
-
-            else if (begins(lopt.c_str(), "--out-implib,"))
-            {
-              lnk += " /implib:\"" + STR(arg+17) + "\"";
-            }
-            else if (str == "-Wl,--out-implib")
-            {
-              ++i;
-              if (i < argc && begins(argv[i], "-Wl,")) {
-                lnk += " /implib:\"" + STR(argv[i]+4) + "\"";
-              }
-            }
-
-            else if (begins(lopt.c_str(), "-output-def,"))
-            {
-              lnk += " /def:\"" + STR(arg+16) + "\"";
-            }
-            else if (str == "-Wl,-output-def")
-            {
-              ++i;
-              if (i < argc && begins(argv[i], "-Wl,")) {
-                lnk += " /def:\"" + STR(argv[i]+4) + "\"";
-              }
-            }
-
-            else if (str == "-Wlink" || begins(arg, "-Wlink,"))
-            {
-              std::string s;
-              if (str == "-Wlink" && i+1 < argc)
-              {
-                ++i;
-                s = STR(argv[i]);
-              }
-              else
-              {
-                s = STR(arg+7);
-              }
-
-              if (!s.empty())
-              {
-                if (s[0] == '-')
-                {
-                  lnk += " /" + s.substr(1);
-                }
-                else if (s[0] != '/')
-                {
-                  lnk += " /" + s;
-                }
-                else
-                {
-                  lnk += " " + s;
-                }
-              }
-            }
-          }
-
-          else if (str == "-Wcl" || begins(arg, "-Wcl,"))
-          {
-            std::string s;
-            if (str == "-Wcl" && i+1 < argc)
-            {
-              ++i;
-              s = STR(argv[i]);
-            }
-            else
-            {
-              s = STR(arg+5);
-            }
-
-            if (!s.empty())
-            {
-              if (s[0] == '-')
-              {
-                cmd += " /" + s.substr(1);
-              }
-              else if (s[0] != '/')
-              {
-                cmd += " /" + s;
-              }
-              else
-              {
-                cmd += " " + s;
-              }
-            }
-          }
-
-          else if (str == "-Wall")   { cmd += " /W3";   }
-          else if (str == "-Wextra") { cmd += " /Wall"; }
-          else if (str == "-Werror") { cmd += " /WX";   }
-        }
-
-        /*  -mdll  -msse -msse2  -mavx -mavx2  */
-        else if (arg[1] == 'm' && len > 2)
-        {
-          if      (str == "-m32")   { bits = 32;                 }
-          else if (str == "-m64")   { bits = 64;                 }
-          else if (str == "-mdll")  { cmd += " /LD"; dll = true; }
-          else if (str == "-msse")  { cmd += " /arch:SSE";       }
-          else if (str == "-msse2") { cmd += " /arch:SSE2";      }
-          else if (str == "-mavx")  { cmd += " /arch:AVX";       }
-          else if (str == "-mavx2") { cmd += " /arch:AVX2";      }
-        }
-
-        /*  -frtti -fthreadsafe-statics -fno-inline -fomit-frame-pointer
-         *  -fpermissive -finline-functions -fopenmp -fstack-protector -fstack-check
-         *  -fstack-protector-strong -fstack-protector-all
-         *  -funsigned-char -fsized-deallocation -fconstexpr-depth=num
-         *  -ffp-contract=fast|off -fwhole-program  */
-        else if (arg[1] == 'f' && len > 2)
-        {
-          if (begins(arg, "-fno-"))
-          {
-            if      (str == "-fno-rtti")                { cmd += " /GR-";                }
-            else if (str == "-fno-threadsafe-statics")  { cmd += " /Zc:threadSafeInit-"; }
-            else if (str == "-fno-inline")              { cmd += " /Ob0";                }
-            else if (str == "-fno-stack-protector" ||
-                     str == "-fno-stack-check")         { cmd += " /GS- /guard:cf-";     }
-            else if (str == "-fno-sized-deallocation")  { cmd += " /Zc:sizedDealloc-";   }
-            else if (str == "-fno-whole-program")       { cmd += " /GL-";                }
-          }
-          else
-          {
-            if      (str == "-fomit-frame-pointer")     { cmd += " /Oy";                 }
-            else if (str == "-fpermissive")             { cmd += " /permissive";         }
-            else if (str == "-fstack-protector" ||
-                     str == "-fstack-check")            { cmd += " /GS";                 }
-            else if (str == "-fstack-protector-strong" ||
-                     str == "-fstack-protector-all")    { cmd += " /GS /guard:cf";       }
-            else if (str == "-finline-functions")       { cmd += " /Ob2";                }
-            else if (str == "-frtti")                   { cmd += " /GR";                 }
-            else if (str == "-fthreadsafe-statics")     { cmd += " /Zc:threadSafeInit";  }
-            else if (str == "-fopenmp")                 { cmd += " /openmp";             }
-            else if (str == "-funsigned-char")          { cmd += " /J";                  }
-            else if (str == "-fsized-deallocation")     { cmd += " /Zc:sizedDealloc";    }
-            else if (begins(arg, "-fconstexpr-depth=")) { cmd += " /constexpr:depth" + STR(arg+18); }
-            else if (begins(arg, "-ffp-contract="))
-            {
-              if      (STR(arg+14) == "fast")           { cmd += " /fp:fast";            }
-              else if (STR(arg+14) == "off")            { cmd += " /fp:strict";          }
-            }
-            else if (str == "-fwhole-program")          { cmd += " /GL";                 }
-          }
-        }
-
-        /*  -nostdinc  -nostdinc++  -nostdlib  -nodefaultlibs  */
-        else if (arg[1] == 'n' && len > 8)
-        {
-          if      (str == "-nostdinc" ||
-                   str == "-nostdinc++")    { use_default_inc_paths = false; }
-          else if (str == "-nostdlib")      { default_lib_paths = false;     }
-          else if (str == "-nodefaultlibs") { lnk += " /nodefaultlib";
-                                              default_lib_paths = false;     }
-        }
-
-        /*  -shared  -std=c<..>|gnu<..>  */
-        else if (arg[1] == 's' && len > 5)
-        {
-          if      (str == "-shared")       { cmd += " /LD"; dll = true;     }
-          else if (begins(arg, "-std="))
-          {
-            if   (begins(arg, "-std=gnu")) { cmd += " /std:c" + STR(arg+8); }
-            else                           { cmd += " /std:" + STR(arg+5);  }
-          }
-        }
-
-        /*  -include file  */
-        else if (str == "-include")
-        {
-          ++i;
-          if (i < argc) {
-            cmd += " /FI\"" + STR(argv[i]) + "\"";
-          }
-        }
-
-        /*  -trigraphs  */
-        else if (str == "-trigraphs")
-        {
-          cmd += " /Zc:trigraphs";
-        }
-
-        /*  -print-search-dirs  */
-        else if (str == "-print-search-dirs")
-        {
-          print_search_dirs = true;
-        }
-      }
+      /* under make, one process for the token we run on plus
+       * one for every token we can get from the jobserver */
+      int n = t.jobserver ? 1 + jobserver_acquire_upto(jobs - 1) : jobs;
+      cl_args.push_back("/MP" + std::to_string(n));
     }
     else
     {
-      cmd += " \"" + win_path(arg) + "\"";
+      split = !t.use_shell;
+    }
+  }
+
+  if (t.pgo != PGO_NONE && t.do_link && !t.print_only && (rv = pgo_prepare(t)) != 0)
+  {
+    return rv;
+  }
+
+  /* nothing to compile: link.exe can do without cl.exe */
+  if (t.do_link && t.sources.empty() && !t.use_shell)
+  {
+    return link_objects(t);
+  }
+
+  if (t.use_shell)
+  {
+    std::string run_exe = "cmd.exe /C 'set PATH=" + t.driver_paths + ";%PATH% & ";
+
+    /* long command lines are passed on in response files; run_tool()
+     * and the others do the same for the tools they start */
+    std::vector<std::string> rsp_files;
+    if (!t.print_only)
+    {
+      rsp_files = use_response_files(cl_args, run_exe.size() + 8, true);
+    }
+
+    /* the whole command line is wrapped within single quotes so
+     * we can pass it as a single command line argument to cmd.exe */
+    str = join_cmdline(cl_args, true);
+    cmd.reserve(run_exe.size() + str.size() + 16);
+    cmd = run_exe + "cl.exe ";
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+      if (str[i] == '\'') { cmd += "'\\''"; }
+      else                { cmd += str[i];   }
+    }
+    cmd += "'";
+
+    if (t.verbose)
+    {
+      std::cout << cmd << std::endl;
     }
+    if (t.print_only)
+    {
+      return 0;
+    }
+    /* --pool: a cmd.exe that is already running does the same */
+    struct tool cl;
+    rv = -1;
+    if (t.pool > 0 && find_tool("cl.exe", t.driver_paths, cl))
+    {
+      TRACE_BEGIN(t.do_link ? "pooled cmd.exe + cl.exe (compile + link)" : "pooled cmd.exe + cl.exe");
+      rv = pool_run(cl, cl_args);
+      TRACE_END();
+    }
+    if (rv < 0)
+    {
+      TRACE_BEGIN(t.do_link ? "sh + cmd.exe + cl.exe (compile + link)" : "sh + cmd.exe + cl.exe");
+      rv = system_return(cmd.c_str());
+      TRACE_END();
+    }
+    remove_response_files(rsp_files);
+    return rv;
   }
 
-  if (bits == 32)
+  struct tool cl;
+  TRACE_BEGIN("find_tool");
+  find_tool("cl.exe", t.driver_paths, cl);
+  TRACE_END();
+
+  /* /Yu for the -include header, built first if needed */
+  if (t.use_pch && !t.print_only && !cl.path.empty())
   {
-    if (!use_default_driver)
+    TRACE_BEGIN("precompiled header");
+    rv = pch_prepare(cl, t);
+    TRACE_END();
+    if (rv >= 0)
     {
-      std::cerr << "warning: ignoring `-m32' when using a custom cl.exe" << std::endl;
+      return rv;
     }
-    driver_default = DEFAULT_CL_PATH_X86;
-    lib_paths_default = DEFAULT_LIBPATHS_X86;
   }
-  if (use_default_driver)
+
+  if (split)
   {
-    driver_paths = driver_default;
+    compile_jobs = split_sources(cl_args, t.sources, t.source_args);
+    for (size_t i = 0; t.use_time_trace && i < compile_jobs.size(); ++i)
+    {
+      compile_jobs[i].time_trace = time_trace_file(t.time_trace, compile_jobs[i].object);
+    }
   }
 
-  run_exe = "cmd.exe /C 'set PATH=" + driver_paths + ";%PATH% & ";
+  if (t.verbose && !unity)
+  {
+    for (size_t i = 0; i < compile_jobs.size(); ++i)
+    {
+      std::cout << (cl.path.empty() ? cl.name : cl.path) << " "
+        << join_cmdline(compile_jobs[i].args, false) << std::endl;
+    }
+    if (compile_jobs.empty())
+    {
+      std::cout << (cl.path.empty() ? cl.name : cl.path) << " "
+        << join_cmdline(cl_args, false) << std::endl;
+    }
+  }
+  if (t.print_only)
+  {
+    return 0;
+  }
+  if (cl.path.empty())
+  {
+    std::cerr << "error: cl.exe not found in " << t.driver_paths << std::endl;
+    return 127;
+  }
 
+  if (!compile_jobs.empty())
+  {
+    TRACE_BEGIN("parallel compile");
+    rv = unity ? unity_compile(cl, compile_jobs, t.unity, jobs, t.use_cache) :
+      compile_parallel(cl, compile_jobs, jobs, t.use_cache && !t.use_time_trace,
+                       t.make_deps ? &t.deps : NULL);
+    TRACE_END();
+    return rv;
+  }
 
-  /* print information and exit */
+  /* gcc -ftime-trace foo.c -o foo writes foo-foo.json */
+  std::string object = (!t.do_link && t.have_outname) ? t.outname :
+    t.sources.empty() ? "" : object_name(t.sources[0]);
+  std::string trace;
+  if (t.use_time_trace && t.sources.size() == 1)
+  {
+    trace = time_trace_file(t.time_trace, (t.do_link && t.have_outname) ?
+                            t.outname + "-" + object : object);
+  }
 
-  if (print_help_cl)
+  if (t.make_deps && t.sources.size() == 1)
   {
-    /* piping to cat helps to display the
-     * output correctly and in one go */
-    cmd = run_exe + "cl.exe /help' 2>&1 | cat";
-    std::cout << cmd << std::endl;
-    return system(cmd.c_str());
+    /* gcc -MD foo.c -o foo writes foo.d */
+    if (t.do_link && t.have_outname && t.deps.file.empty())
+    {
+      size_t dot = t.outname.rfind('.');
+      t.deps.file = (dot != std::string::npos && dot > t.outname.rfind('/') + 1) ?
+        t.outname.substr(0, dot) + ".d" : t.outname + ".d";
+    }
+    TRACE_BEGIN(t.do_link ? "cl.exe (compile + link)" : "cl.exe");
+    rv = deps_compile(cl, cl_args, t.deps, t.sources[0], object, trace);
+    TRACE_END();
+    return rv;
   }
-  else if (print_help_link)
+  if (t.make_deps)
   {
-    cmd = run_exe + "link.exe' 2>&1 | cat";
-    return system(cmd.c_str());
+    std::cerr << "warning: no dependency files for several sources compiled and linked at once"
+      << std::endl;
   }
-  else if (print_version)
+  if (!trace.empty())
   {
-    cmd = run_exe + "cl.exe' 2>&1 | head -n3 ; " + run_exe + "link.exe' 2>&1 | head -n3";
-    return system(cmd.c_str());
+    TRACE_BEGIN(t.do_link ? "cl.exe (compile + link)" : "cl.exe");
+    rv = time_trace_compile(cl, cl_args, t.sources[0], trace);
+    TRACE_END();
+    return rv;
   }
-
-  if (print_search_dirs)
+  if (t.use_time_trace && !t.sources.empty())
   {
-    std::cout << "cl.exe: " << driver_default << std::endl;
-    std::cout << "includes: " << includes_default << std::endl;
-    std::cout << "libraries: " << lib_paths_default << std::endl;
-    return 0;
+    std::cerr << "warning: no time traces for several sources compiled and linked at once"
+      << std::endl;
   }
 
+  if (t.use_cache && !t.do_link && t.sources.size() == 1)
+  {
+    TRACE_BEGIN("cached compile");
+    rv = cache_compile(cl, cl_args, object);
+    TRACE_END();
+    return rv;
+  }
 
-  /* turn lists obtained from environment variables INCLUDE and
-   * and LIB into command line arguments /I\"dir\" and /libpath\"dir\" */
-  split_env("INCLUDE", "I", cmd);
-  split_env("LIB", "libpath", cmd);
+  TRACE_BEGIN(t.do_link ? "cl.exe (compile + link)" : "cl.exe");
+  rv = run_tool(cl, cl_args);
+  TRACE_END();
+  return rv;
+}
 
+static int driver(int argc, char **argv)
+{
+  struct translation t;
 
-  /* create the final command to execute */
+  /* @file arguments are replaced with the arguments in the file */
+  std::vector<std::string> expanded;
+  std::vector<char *> expanded_argv;
+  int rsp_count = expand_response_files(argc, argv, expanded);
 
-  if (use_default_inc_paths) { cmd += " " + includes_default;  }
-  if (do_link)
+  if (rsp_count < 0)
+  {
+    return 1;
+  }
+  if (rsp_count > 0)
   {
-    if (!have_outname)
+    for (size_t i = 0; i < expanded.size(); ++i)
     {
-      if (dll) { lnk += " /out:\"a.dll\""; }
-      else     { lnk += " /out:\"a.exe\""; }
+      expanded_argv.push_back(&expanded[i][0]);
     }
-    if (default_lib_paths) { lnk += " " + lib_paths_default; }
-    cmd += " /link" + lnk;
+    expanded_argv.push_back(NULL);
+    argc = expanded.size();
+    argv = expanded_argv.data();
   }
 
-  /* replace all occurences of single quotes (') with double quotes (");
-   * this is needed to wrap everything within singles quotes so we can
-   * parse it as a single command line argument to cmd.exe */
-  for (size_t i = 0; (i = cmd.find("'", i)) != std::string::npos; ++i)
+  if (translate(argc, argv, t) != 0)
   {
-    cmd.replace(i, 1, "\"");
+    return 1;
+  }
+  if (t.info != INFO_NONE)
+  {
+    return print_info(argv[0], t);
+  }
+  if (!ledger_on || t.print_only)
+  {
+    return run_translation(t);
   }
 
-  cmd = run_exe + "cl.exe" + cmd + "'";
+  ledger_start(t);
+  int rv = run_translation(t);
+  ledger_finish(t, rv);
+  return rv;
+}
+
+int run_driver(int argc, char **argv)
+{
+  const char *ledger = getenv("GCC2MSVC_LEDGER");
 
-  if (verbose)
+  for (int i = 1; i < argc; ++i)
   {
-    std::cout << cmd << std::endl;
+    if (begins(argv[i], "--trace="))
+    {
+      trace_init(argv[i] + 8, argc, argv);
+    }
+    else if (begins(argv[i], "--ledger="))
+    {
+      ledger = argv[i] + 9;
+    }
   }
-  if (print_only)
+  if (ledger != NULL && *ledger != 0)
   {
-    return 0;
+    ledger_init(ledger);
   }
 
-  return system_return(cmd.c_str());
+  int rv = driver(argc, argv);
+  trace_finish();
+  return rv;
 }
-
@@ -0,0 +1,410 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Memory-aware admission of tools (--mem-limit).
+ *
+ * Under `make -j64' a few LTCG links or template heavy sources at once
+ * can use more memory than there is, and a machine that swaps is much
+ * slower than one running fewer jobs. With --mem-limit every cl.exe and
+ * link.exe (run directly or through the pool) first waits until the
+ * memory it is expected to need fits next to that of the tools already
+ * running, in this and every other gcc2msvc process.
+ *
+ * They share the file mem.db in the cache directory, mmap()ed and
+ * locked with flock() while it is read or changed:
+ *
+ *   running   pid and expected memory of every tool admitted; entries
+ *             of processes that are gone are dropped
+ *   peaks     hash of tool, directory and output file -> the peak RSS
+ *             (wait4) of its last run
+ *
+ * A tool without history is expected to need MEM_DEFAULT_CL or
+ * MEM_DEFAULT_LINK. The limit is a size (--mem-limit=8G) or a share of
+ * MemAvailable (--mem-limit=75%), sampled when the first of the running
+ * tools is admitted. A tool is always admitted when nothing else runs,
+ * so one that is larger than the limit still gets its turn. A cl.exe
+ * using a precompiled header that is expected to need more than the
+ * memory cl.exe reserves for it by default gets a matching /Zm.
+ *
+ * Under WSL the Linux side only sees what the interop process uses;
+ * the history then mostly holds the defaults.
+ */
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+#include "memlimit.h"
+#include "trace.h"
+
+#define MEM_MAGIC         0x316d656d  /* "mem1" */
+#define MEM_RUNNING       256
+#define MEM_PEAKS         8192
+#define MEM_PROBES        16
+#define MEM_DEFAULT_CL    (512LL << 20)
+#define MEM_DEFAULT_LINK  (1LL << 30)
+#define MEM_DEFAULT_SHARE 80          /* percent of MemAvailable */
+#define ZM_UNIT           (75LL << 20)  /* what /Zm100 reserves */
+#define ZM_MAX            2000
+
+struct mem_running {
+  int32_t pid;
+  int32_t reserved;
+  int64_t bytes;
+};
+
+struct mem_peak {
+  uint64_t key;
+  int64_t bytes;
+};
+
+struct mem_db {
+  uint32_t magic;
+  uint32_t size;
+  int64_t available;                 /* MemAvailable when running became non-empty */
+  struct mem_running running[MEM_RUNNING];
+  struct mem_peak peaks[MEM_PEAKS];
+};
+
+int mem_on = 0;
+
+static long long mem_limit;          /* bytes, or 0 */
+static int mem_share;                /* percent of MemAvailable if mem_limit is 0 */
+static int db_fd = -1;
+static struct mem_db *db;
+static pid_t db_pid;                 /* flock()s of a parent would be shared */
+static uint64_t admitted_key;        /* of the tool admitted last, 0 if none */
+static bool admitted;
+
+
+/* "8G", "512M", "75%" */
+static bool parse_limit(const char *str)
+{
+  char *end;
+  unsigned long long n = strtoull(str, &end, 10);
+
+  if (end == str)
+  {
+    return false;
+  }
+  switch (*end)
+  {
+    case '%': mem_share = (n > 0 && n <= 100) ? n : MEM_DEFAULT_SHARE;
+              mem_limit = 0;
+              return true;
+    case 'G': case 'g': n <<= 30; break;
+    case 'M': case 'm': n <<= 20; break;
+    case 'K': case 'k': n <<= 10; break;
+    case 0: break;
+    default: return false;
+  }
+  mem_limit = n;
+  return n > 0;
+}
+
+static long long mem_available()
+{
+  FILE *fp = fopen("/proc/meminfo", "r");
+  char line[256];
+  long long kb = 0;
+
+  if (fp == NULL)
+  {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    if (strncmp(line, "MemAvailable:", 13) == 0)
+    {
+      kb = atoll(line + 13);
+      break;
+    }
+  }
+  fclose(fp);
+  return kb * 1024;
+}
+
+static bool open_db()
+{
+  if (db != NULL && db_pid == getpid())
+  {
+    return true;
+  }
+  if (db != NULL)
+  {
+    munmap(db, sizeof(struct mem_db));
+    close(db_fd);
+    db = NULL;
+  }
+  std::string dir = cache_dir();
+  if (!mkdirs(dir))
+  {
+    return false;
+  }
+  std::string file = dir + "/mem.db";
+  db_fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (db_fd < 0)
+  {
+    return false;
+  }
+
+  /* a new or foreign file is cleared */
+  flock(db_fd, LOCK_EX);
+  uint32_t head[2];
+  if (pread(db_fd, head, sizeof(head), 0) != sizeof(head) || head[0] != MEM_MAGIC ||
+      head[1] != sizeof(struct mem_db))
+  {
+    if (ftruncate(db_fd, 0) != 0 || ftruncate(db_fd, sizeof(struct mem_db)) != 0)
+    {
+      flock(db_fd, LOCK_UN);
+      close(db_fd);
+      db_fd = -1;
+      return false;
+    }
+    head[0] = MEM_MAGIC;
+    head[1] = sizeof(struct mem_db);
+    if (pwrite(db_fd, head, sizeof(head), 0) != sizeof(head))
+    {
+      flock(db_fd, LOCK_UN);
+      close(db_fd);
+      db_fd = -1;
+      return false;
+    }
+  }
+  flock(db_fd, LOCK_UN);
+
+  void *p = mmap(NULL, sizeof(struct mem_db), PROT_READ | PROT_WRITE, MAP_SHARED, db_fd, 0);
+  if (p == MAP_FAILED)
+  {
+    close(db_fd);
+    db_fd = -1;
+    return false;
+  }
+  db = (struct mem_db *)p;
+  db_pid = getpid();
+  return true;
+}
+
+static struct mem_peak *find_peak(uint64_t key, bool add)
+{
+  for (int i = 0; i < MEM_PROBES; ++i)
+  {
+    struct mem_peak *p = &db->peaks[(key + i) % MEM_PEAKS];
+    if (p->key == key)
+    {
+      return p;
+    }
+    if (p->key == 0)
+    {
+      return add ? p : NULL;
+    }
+  }
+  /* full around here: the first one is replaced */
+  return add ? &db->peaks[key % MEM_PEAKS] : NULL;
+}
+
+/* the output of a tool run; empty if it can't be told */
+static std::string output_of(const std::vector<std::string> &args)
+{
+  std::string source;
+
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    const char *a = args[i].c_str();
+    if (begins(a, "/Fo") || begins(a, "/Fe"))
+    {
+      return args[i].substr(3);
+    }
+    if (begins(a, "/out:"))
+    {
+      return args[i].substr(5);
+    }
+    if (source.empty() && *a != '/' && *a != '-' && *a != '@')
+    {
+      source = args[i];
+    }
+  }
+  return source;
+}
+
+static uint64_t tool_key(const struct tool &t, const std::vector<std::string> &args)
+{
+  std::string output = output_of(args);
+  if (output.empty())
+  {
+    return 0;
+  }
+
+  struct hash_state h;
+  char cwd[4096];
+  hash_init(&h);
+  hash_string(&h, t.name.c_str());
+  hash_string(&h, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+  hash_string(&h, output.c_str());
+  uint64_t key = (uint64_t)h.value;
+  return key ? key : 1;
+}
+
+/* /ZmN for a cl.exe that uses or creates a precompiled header and is
+ * expected to need more than /Zm100 */
+static std::string zm_option(const std::vector<std::string> &args, long long bytes)
+{
+  bool pch = false;
+
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    const char *a = args[i].c_str();
+    if (begins(a, "/Zm"))
+    {
+      return "";
+    }
+    pch = pch || begins(a, "/Yc") || begins(a, "/Yu");
+  }
+  long long factor = (bytes * 100 + ZM_UNIT - 1) / ZM_UNIT;
+  if (!pch || factor <= 100)
+  {
+    return "";
+  }
+  return "/Zm" + std::to_string(factor < ZM_MAX ? factor : ZM_MAX);
+}
+
+void mem_enable(const std::string &limit)
+{
+  mem_on = !limit.empty() && parse_limit(limit.c_str());
+  if (!limit.empty() && !mem_on)
+  {
+    fprintf(stderr, "warning: ignoring --mem-limit=%s\n", limit.c_str());
+  }
+}
+
+/* waits until t fits in the limit and registers it as running; returns
+ * a /Zm option to add or "" */
+std::string mem_admit(const struct tool &t, const std::vector<std::string> &args)
+{
+  if (!mem_on || admitted || !open_db())
+  {
+    return "";
+  }
+
+  uint64_t key = tool_key(t, args);
+  bool link = (t.name == "link.exe");
+  long long bytes = link ? MEM_DEFAULT_LINK : MEM_DEFAULT_CL;
+  pid_t self = getpid();
+  useconds_t delay = 10000;
+
+  TRACE_BEGIN("memory admission");
+  for (;;)
+  {
+    flock(db_fd, LOCK_EX);
+
+    struct mem_peak *p = key ? find_peak(key, false) : NULL;
+    if (p != NULL && p->bytes > 0)
+    {
+      bytes = p->bytes;
+    }
+
+    long long used = 0;
+    int free_slot = -1, count = 0;
+    for (int i = 0; i < MEM_RUNNING; ++i)
+    {
+      struct mem_running &r = db->running[i];
+      if (r.pid != 0 && kill(r.pid, 0) != 0 && errno == ESRCH)
+      {
+        r.pid = 0;
+      }
+      if (r.pid == 0)
+      {
+        if (free_slot < 0) { free_slot = i; }
+        continue;
+      }
+      used += r.bytes;
+      ++count;
+    }
+    if (count == 0)
+    {
+      db->available = mem_available();
+    }
+    long long limit = mem_limit > 0 ? mem_limit : db->available / 100 * mem_share;
+
+    if (free_slot >= 0 && (count == 0 || used + bytes <= limit))
+    {
+      db->running[free_slot].pid = self;
+      db->running[free_slot].bytes = bytes;
+      flock(db_fd, LOCK_UN);
+      break;
+    }
+    flock(db_fd, LOCK_UN);
+
+    usleep(delay);
+    delay = (delay < 200000) ? delay * 2 : delay;
+  }
+  TRACE_END();
+
+  admitted = true;
+  admitted_key = key;
+  return link ? "" : zm_option(args, bytes);
+}
+
+/* the tool admitted last has exited: it no longer counts and its peak
+ * RSS is remembered */
+extern "C" void mem_child(const struct rusage *ru)
+{
+  if (!admitted)
+  {
+    return;
+  }
+  admitted = false;
+
+  pid_t self = getpid();
+  flock(db_fd, LOCK_EX);
+  for (int i = 0; i < MEM_RUNNING; ++i)
+  {
+    if (db->running[i].pid == self)
+    {
+      db->running[i].pid = 0;
+      break;
+    }
+  }
+  if (ru != NULL && ru->ru_maxrss > 0 && admitted_key != 0)
+  {
+    struct mem_peak *p = find_peak(admitted_key, true);
+    p->key = admitted_key;
+    p->bytes = ru->ru_maxrss * 1024LL;
+  }
+  flock(db_fd, LOCK_UN);
+}
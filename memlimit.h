@@ -0,0 +1,23 @@
+#ifndef MEMLIMIT_H
+#define MEMLIMIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* set by mem_enable() if --mem-limit or GCC2MSVC_MEM_LIMIT was given;
+ * mem_child() is only called when it is set */
+extern int mem_on;
+
+struct rusage;
+
+/* the tool admitted last has exited (ru is NULL if it wasn't measured) */
+#define MEM_CHILD(ru) do { if (mem_on) { mem_child(ru); } } while (0)
+
+void mem_child(const struct rusage *ru);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* MEMLIMIT_H */
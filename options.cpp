@@ -0,0 +1,145 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "options.h"
+#define OPTIONS_TABLE_DATA
+#include "options_table.h"
+
+
+static const struct option_key *find_key(const char *s, size_t len, uint32_t h)
+{
+  int slot = option_slots[h & OPTION_HASH_MASK];
+
+  if (slot >= 0)
+  {
+    const struct option_key *k = &option_keys[slot];
+    if (k->len == len && memcmp(k->key, s, len) == 0)
+    {
+      return k;
+    }
+  }
+  return NULL;
+}
+
+static bool valid_value(const char *value, char type)
+{
+  if (*value == 0)
+  {
+    return false;
+  }
+  if (type == 'd')
+  {
+    for (const char *p = value; *p != 0; ++p)
+    {
+      if (!isdigit(*p)) { return false; }
+    }
+  }
+  return true;
+}
+
+/**
+ * Look up argv[i]. The argument is hashed once from left to right;
+ * on the way the hashes of all its beginnings that have the length
+ * of some OPT_PREFIX key are checked as well, so that the longest
+ * matching prefix is known when the full argument is not a key.
+ *
+ * value is set to the option's value (inside argv[i] or argv[i+1])
+ * and consumed to the number of extra arguments used (0 or 1).
+ * Returns NULL for unknown options.
+ */
+const struct option_entry *option_lookup(int argc, char **argv, int i,
+                                         const char **value, int *consumed)
+{
+  const char *arg = argv[i];
+  const struct option_entry *prefix = NULL;
+  uint32_t h = option_hash_init(OPTION_HASH_SEED);
+  size_t len = 0;
+
+  *value = NULL;
+  *consumed = 0;
+
+  for ( ; arg[len] != 0; ++len)
+  {
+    if (len > 0 && len <= OPTION_MAX_PREFIX_LEN && option_prefix_length[len])
+    {
+      const struct option_key *k = find_key(arg, len, h);
+
+      for (int n = 0; k != NULL && n < k->count; ++n)
+      {
+        const struct option_entry *e = &option_entries[k->first + n];
+        if (e->kind == OPT_PREFIX && valid_value(arg + len, e->type))
+        {
+          prefix = e;
+          break;
+        }
+      }
+    }
+    h = option_hash_step(h, arg[len]);
+  }
+
+  const struct option_key *k = find_key(arg, len, h);
+  bool takes_next = false;
+
+  for (int n = 0; k != NULL && n < k->count; ++n)
+  {
+    const struct option_entry *e = &option_entries[k->first + n];
+
+    if (e->kind == OPT_EXACT)
+    {
+      return e;
+    }
+    else if (e->kind == OPT_SEPARATE && i + 1 < argc)
+    {
+      const char *next = argv[i+1];
+      size_t next_len = strlen(e->next);
+
+      takes_next = true;
+
+      if (e->type == 0 ? strcmp(next, e->next) == 0
+                       : (strncmp(next, e->next, next_len) == 0 &&
+                          valid_value(next + next_len, e->type)))
+      {
+        *value = e->type ? next + next_len : NULL;
+        *consumed = 1;
+        return e;
+      }
+    }
+  }
+
+  if (takes_next)
+  {
+    /* an option that takes an argument, but not this one */
+    *consumed = 1;
+    return NULL;
+  }
+
+  if (prefix != NULL)
+  {
+    *value = arg + strlen(prefix->key);
+  }
+  return prefix;
+}
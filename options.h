@@ -0,0 +1,63 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/**
+ * Option table: the gcc -> msvc mapping in commands.txt is turned into
+ * options_table.h by genopts at build time. Every distinct option name
+ * or prefix is a key in a collision-free (perfect) hash table; the keys
+ * point to one or more entries describing the translation.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+enum option_kind {
+  OPT_EXACT,     /* the argument equals the key */
+  OPT_PREFIX,    /* the argument starts with the key, the rest is the value */
+  OPT_SEPARATE   /* the argument equals the key, the value is the next argument */
+};
+
+struct option_entry {
+  const char *key;
+  unsigned char kind;
+  char type;         /* 's' string, 'd' number, 'p' path, 'i' input
+                        path (staged) or 0 for no value */
+  const char *next;  /* OPT_SEPARATE: the next argument or its fixed beginning */
+  bool link;         /* the msvc options are passed to link.exe */
+  const char *msvc;  /* space separated msvc options, %s/%d/%p/%i is the value */
+  int action;        /* enum option_action */
+};
+
+struct option_key {
+  const char *key;
+  uint16_t len;
+  uint16_t first;    /* index of the first entry for this key */
+  uint16_t count;
+};
+
+/* FNV-1a, seeded so that genopts can pick a seed without collisions */
+static inline uint32_t option_hash_init(uint32_t seed)
+{
+  return 2166136261u ^ seed;
+}
+
+static inline uint32_t option_hash_step(uint32_t h, unsigned char c)
+{
+  return (h ^ c) * 16777619u;
+}
+
+static inline uint32_t option_hash(const char *s, size_t len, uint32_t seed)
+{
+  uint32_t h = option_hash_init(seed);
+  for (size_t i = 0; i < len; ++i)
+  {
+    h = option_hash_step(h, s[i]);
+  }
+  return h;
+}
+
+/* options.cpp */
+const struct option_entry *option_lookup(int argc, char **argv, int i,
+                                         const char **value, int *consumed);
+
+#endif  /* OPTIONS_H */
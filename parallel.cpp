@@ -0,0 +1,288 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Running several cl.exe processes at once (one per source file).
+ *
+ * Every job runs in a forked child whose stdout and stderr are pipes;
+ * the output is collected per job and written out in the order of the
+ * jobs, each job as soon as it and all jobs before it have finished,
+ * so the diagnostics look exactly like those of a serial build.
+ * Under make, the jobserver decides how many jobs may run at once.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "ledger.h"
+#include "trace.h"
+
+struct running_job {
+  pid_t pid;
+  int fd[2];         /* stdout, stderr; -1 once closed */
+  bool done;
+  int status;
+  std::string out, err;
+  long long start;   /* for --trace and the ledger */
+  int track;
+};
+
+
+static void write_out(int fd, const std::string &data)
+{
+  const char *p = data.data();
+  size_t len = data.size();
+
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { break; }
+    p += n;
+    len -= n;
+  }
+}
+
+static pid_t start_job(const struct tool &cl, const struct compile_job &job, bool use_cache,
+                       const struct dep_options *deps, running_job &r)
+{
+  int out_pipe[2], err_pipe[2];
+
+  if (pipe2(out_pipe, O_CLOEXEC) != 0)
+  {
+    return -1;
+  }
+  if (pipe2(err_pipe, O_CLOEXEC) != 0)
+  {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    return -1;
+  }
+
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    dup2(out_pipe[1], STDOUT_FILENO);
+    dup2(err_pipe[1], STDERR_FILENO);
+
+    int rv = deps ? deps_compile(cl, job.args, *deps, job.source, job.object, job.time_trace) :
+      !job.time_trace.empty() ? time_trace_compile(cl, job.args, job.source, job.time_trace) :
+      use_cache ? cache_compile(cl, job.args, job.object) : run_tool(cl, job.args);
+
+    std::cout.flush();
+    std::cerr.flush();
+    _exit(rv);
+  }
+
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+
+  if (pid < 0)
+  {
+    close(out_pipe[0]);
+    close(err_pipe[0]);
+    std::cerr << "failed to fork()" << std::endl;
+    return -1;
+  }
+
+  r.pid = pid;
+  r.fd[0] = out_pipe[0];
+  r.fd[1] = err_pipe[0];
+  r.done = false;
+  r.status = 0;
+
+  return pid;
+}
+
+/* returns the highest exit code of all jobs; when run by make with a
+ * jobserver, every job but the first needs a token from the jobserver */
+int compile_parallel(const struct tool &cl, const std::vector<struct compile_job> &jobs,
+                     int max_jobs, bool use_cache, const struct dep_options *deps)
+{
+  bool js = jobserver_init();
+  std::vector<running_job> r(jobs.size());
+  size_t next = 0;      /* next job to start */
+  size_t flushed = 0;   /* jobs whose output has been written */
+  int running = 0;
+  int worst = 0;
+  std::vector<bool> tracks;   /* --trace rows in use, one per running job */
+
+  while (flushed < jobs.size())
+  {
+    while (running < max_jobs && next < jobs.size())
+    {
+      if (js && running > 0 && !jobserver_try_acquire())
+      {
+        break;
+      }
+      if (start_job(cl, jobs[next], use_cache, deps, r[next]) < 0)
+      {
+        r[next].pid = -1;
+        r[next].fd[0] = r[next].fd[1] = -1;
+        r[next].done = true;
+        r[next].status = 127;
+      }
+      else
+      {
+        ++running;
+        r[next].start = trace_clock();
+        if (trace_on)
+        {
+          size_t t = 0;
+          while (t < tracks.size() && tracks[t]) { ++t; }
+          if (t == tracks.size()) { tracks.push_back(true); } else { tracks[t] = true; }
+          r[next].track = t + 1;
+        }
+      }
+      ++next;
+    }
+
+    /* give back tokens of jobs that are gone */
+    while (jobserver_held() > std::max(running - 1, 0))
+    {
+      jobserver_release();
+    }
+
+    /* read from every running job; also wake up when a token
+     * becomes available for a job we couldn't start yet */
+    std::vector<struct pollfd> pfd;
+    std::vector<size_t> owner;
+
+    if (js && running > 0 && running < max_jobs && next < jobs.size())
+    {
+      struct pollfd p;
+      p.fd = jobserver_fd();
+      p.events = POLLIN;
+      p.revents = 0;
+      pfd.push_back(p);
+      owner.push_back((size_t)-1);
+    }
+
+    for (size_t i = flushed; i < next; ++i)
+    {
+      for (int k = 0; k < 2; ++k)
+      {
+        if (r[i].fd[k] >= 0)
+        {
+          struct pollfd p;
+          p.fd = r[i].fd[k];
+          p.events = POLLIN;
+          p.revents = 0;
+          pfd.push_back(p);
+          owner.push_back(i * 2 + k);
+        }
+      }
+    }
+
+    if (!pfd.empty() && poll(pfd.data(), pfd.size(), -1) < 0 && errno != EINTR)
+    {
+      break;
+    }
+
+    char buf[65536];
+    for (size_t n = 0; n < pfd.size(); ++n)
+    {
+      if (pfd[n].revents == 0 || owner[n] == (size_t)-1)
+      {
+        continue;
+      }
+
+      running_job &job = r[owner[n] / 2];
+      int k = owner[n] % 2;
+      ssize_t len = read(pfd[n].fd, buf, sizeof(buf));
+
+      if (len > 0)
+      {
+        (k == 0 ? job.out : job.err).append(buf, len);
+      }
+      else if (len == 0 || errno != EINTR)
+      {
+        close(job.fd[k]);
+        job.fd[k] = -1;
+      }
+    }
+
+    /* a job is done once both of its pipes are closed */
+    for (size_t i = flushed; i < next; ++i)
+    {
+      if (!r[i].done && r[i].fd[0] < 0 && r[i].fd[1] < 0)
+      {
+        int status;
+        struct rusage ru;
+        r[i].status = 127;
+        if (wait4(r[i].pid, &status, 0, &ru) > 0)
+        {
+          LEDGER_CHILD(r[i].start, &ru);
+          if (WIFEXITED(status))
+          {
+            r[i].status = WEXITSTATUS(status);
+          }
+        }
+        r[i].done = true;
+        --running;
+        if (trace_on)
+        {
+          trace_complete(jobs[i].object.c_str(), r[i].track, r[i].start, trace_clock());
+          tracks[r[i].track - 1] = false;
+        }
+      }
+    }
+
+    while (jobserver_held() > std::max(running - 1, 0))
+    {
+      jobserver_release();
+    }
+
+    /* write out finished jobs in order */
+    while (flushed < next && r[flushed].done)
+    {
+      write_out(STDOUT_FILENO, r[flushed].out);
+      write_out(STDERR_FILENO, r[flushed].err);
+      if (r[flushed].status > worst)
+      {
+        worst = r[flushed].status;
+      }
+      r[flushed].out.clear();
+      r[flushed].err.clear();
+      ++flushed;
+    }
+  }
+
+  return worst;
+}
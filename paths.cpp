@@ -0,0 +1,366 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Translation between Linux and win32 paths, driven by the mount table.
+ *
+ * /proc/self/mountinfo is read once. Every drvfs mount (WSL 1 `drvfs',
+ * WSL 2 `9p'/`virtiofs' with a windows path) maps its mount point to a
+ * windows directory: /mnt/c -> C:/, but also roots set in /etc/wsl.conf
+ * (/c, /win/c), bind mounts of subdirectories (root field of the mount)
+ * and network shares. Paths are looked up by their longest mount point
+ * prefix; paths not on a drvfs mount only exist within the Linux
+ * distribution and are reached through \\wsl$\<distro>. Results of
+ * absolute paths are memoized.
+ *
+ * Without any drvfs mounts (not running on WSL) /mnt/<letter> is taken
+ * to be the drive, as before.
+ */
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gcc2msvc.h"
+
+struct mount_entry {
+  std::string point;         /* /mnt/c */
+  std::string win;           /* C:, without a trailing slash */
+};
+
+static bool paths_loaded = false;
+static std::vector<struct mount_entry> mounts;
+static std::unordered_map<std::string, size_t> mount_index;  /* point -> mounts[] */
+static std::vector<size_t> prefix_lengths;                  /* longest first */
+static std::string wsl_root;                                 /* \\wsl$\<distro> */
+static std::string wsl_slashes;                              /* //wsl$/<distro> */
+static std::unordered_map<std::string, std::string> memo;
+
+
+/* mountinfo escapes space, tab, newline and backslash as \ooo */
+static std::string unescape(const char *p, size_t len)
+{
+  std::string str;
+
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (p[i] == '\\' && i + 3 < len &&
+        isdigit(p[i+1]) && isdigit(p[i+2]) && isdigit(p[i+3]))
+    {
+      str += (char)((p[i+1] - '0') * 64 + (p[i+2] - '0') * 8 + (p[i+3] - '0'));
+      i += 3;
+    }
+    else
+    {
+      str += p[i];
+    }
+  }
+  return str;
+}
+
+static std::string slashes(std::string str)
+{
+  std::replace(str.begin(), str.end(), '\\', '/');
+  while (str.size() > 1 && str[str.size()-1] == '/')
+  {
+    str.erase(str.size() - 1);
+  }
+  return str;
+}
+
+/* the windows directory a drvfs mount shows, or "" if it isn't one */
+static std::string drvfs_root(const std::string &fstype, const std::string &source,
+                              const std::string &options)
+{
+  if (fstype != "drvfs" && fstype != "9p" && fstype != "virtiofs")
+  {
+    return "";
+  }
+
+  /* WSL 2: ...;path=C:\;... */
+  size_t pos = options.find("path=");
+  if (pos != std::string::npos && (pos == 0 || options[pos-1] == ';' || options[pos-1] == ','))
+  {
+    pos += 5;
+    return slashes(options.substr(pos, options.find_first_of(";,", pos) - pos));
+  }
+
+  /* WSL 1: the source is C:, C:\ or \\server\share */
+  if (fstype == "drvfs" &&
+      ((source.size() >= 2 && isalpha(source[0]) && source[1] == ':') ||
+       (source.size() > 2 && source[0] == '\\' && source[1] == '\\')))
+  {
+    return slashes(source);
+  }
+  return "";
+}
+
+static void add_mount(const std::string &point, const std::string &win)
+{
+  struct mount_entry m;
+  m.point = (point == "/") ? "" : point;
+  m.win = win;
+
+  /* later mounts hide earlier ones on the same mount point */
+  std::unordered_map<std::string, size_t>::iterator it = mount_index.find(m.point);
+  if (it != mount_index.end())
+  {
+    mounts[it->second] = m;
+    return;
+  }
+  mount_index[m.point] = mounts.size();
+  mounts.push_back(m);
+
+  if (std::find(prefix_lengths.begin(), prefix_lengths.end(), m.point.size()) == prefix_lengths.end())
+  {
+    prefix_lengths.push_back(m.point.size());
+    std::sort(prefix_lengths.rbegin(), prefix_lengths.rend());
+  }
+}
+
+/* read the mount table; mountinfo is a path for testing or NULL */
+void paths_init(const char *mountinfo)
+{
+  paths_loaded = true;
+  mounts.clear();
+  mount_index.clear();
+  prefix_lengths.clear();
+  memo.clear();
+
+  const char *distro = getenv("WSL_DISTRO_NAME");
+  wsl_slashes = (distro != NULL && *distro != 0) ? std::string("//wsl$/") + distro : "";
+  wsl_root = wsl_slashes;
+  std::replace(wsl_root.begin(), wsl_root.end(), '/', '\\');
+
+  FILE *fp = fopen(mountinfo ? mountinfo : "/proc/self/mountinfo", "re");
+  if (fp != NULL)
+  {
+    char *line = NULL;
+    size_t size = 0;
+
+    while (getline(&line, &size, fp) >= 0)
+    {
+      /* id parent major:minor root mount-point options [optional...] - fstype source super-options */
+      std::vector<std::string> f;
+      const char *p = line;
+
+      while (*p != 0 && *p != '\n')
+      {
+        size_t len = strcspn(p, " \n");
+        f.push_back(unescape(p, len));
+        p += len;
+        while (*p == ' ') { ++p; }
+      }
+
+      size_t sep = std::find(f.begin(), f.end(), "-") - f.begin();
+      if (sep < 6 || sep + 1 >= f.size())
+      {
+        continue;
+      }
+
+      std::string win = drvfs_root(f[sep+1], sep + 2 < f.size() ? f[sep+2] : "",
+                                   sep + 3 < f.size() ? f[sep+3] : "");
+      if (!win.empty())
+      {
+        /* a bind mount of a subdirectory has it as its root */
+        add_mount(f[4], (f[3] == "/") ? win : win + slashes(f[3]));
+      }
+    }
+    free(line);
+    fclose(fp);
+  }
+}
+
+static void load()
+{
+  if (!paths_loaded)
+  {
+    paths_init(NULL);
+  }
+}
+
+/* the old convention: /mnt/d -> D:/, /mnt/d/dir -> D:/dir */
+static bool mnt_drive(const char *ch, std::string &str)
+{
+  if (strncmp(ch, "/mnt/", 5) == 0 && ch[5] != 0 &&
+      strchr("abcdefghijklmnopqrstuvwxyz", ch[5]) != NULL && (ch[6] == 0 || ch[6] == '/'))
+  {
+    str.assign(1, toupper(ch[5]));
+    str += ":/";
+    if (ch[6] == '/')
+    {
+      str += ch + 7;
+    }
+    return true;
+  }
+  return false;
+}
+
+static std::string translate_path(const char *ch)
+{
+  std::string str;
+  size_t len = strlen(ch);
+
+  for (size_t i = 0; i < prefix_lengths.size(); ++i)
+  {
+    size_t n = prefix_lengths[i];
+    if (n > len || (ch[n] != '/' && ch[n] != 0))
+    {
+      continue;
+    }
+
+    std::unordered_map<std::string, size_t>::iterator it =
+      mount_index.find(std::string(ch, n));
+    if (it != mount_index.end())
+    {
+      /* /mnt/d -> D:/, /mnt/d/dir -> D:/dir */
+      str = mounts[it->second].win;
+      str += (ch[n] == 0) ? "/" : ch + n;
+      if (str[0] == '/')
+      {
+        /* a share: \\server\share\dir, //server/... would be an option */
+        std::replace(str.begin(), str.end(), '/', '\\');
+      }
+      return str;
+    }
+  }
+
+  if (mounts.empty() && mnt_drive(ch, str))
+  {
+    return str;
+  }
+  if (!wsl_root.empty())
+  {
+    /* /usr/include -> \\wsl$\Ubuntu\usr\include; cl.exe would take
+     * //wsl$/... for an option */
+    str = wsl_root + ch;
+    std::replace(str.begin() + wsl_root.size(), str.end(), '/', '\\');
+    return str;
+  }
+
+  /* /usr/include -> ./usr/include */
+  return "." + std::string(ch);
+}
+
+/* memoized translation of an absolute path */
+static const std::string &lookup(const std::string &path)
+{
+  std::unordered_map<std::string, std::string>::iterator it = memo.find(path);
+  if (it != memo.end())
+  {
+    return it->second;
+  }
+  return memo.emplace(path, translate_path(path.c_str())).first->second;
+}
+
+/* whether an absolute path is on a windows drive (or share) */
+bool drvfs_path(const std::string &path)
+{
+  load();
+  const std::string &str = lookup(path);
+  return str[0] != '.' && (wsl_root.empty() || str.compare(0, wsl_root.size(), wsl_root) != 0);
+}
+
+/* forward slashes (/) are not converted to backslashes (\)
+ * because Windows actually supports them, except in \\wsl$ paths */
+std::string win_path(const char *ch)
+{
+  if (ch[0] != '/')
+  {
+    return ch;
+  }
+  load();
+  return lookup(ch);
+}
+
+/* append prefix + win_path() of every path to out */
+void win_paths(const std::vector<std::string> &paths, const char *prefix,
+               std::vector<std::string> &out)
+{
+  size_t n = out.size();
+
+  load();
+  out.resize(n + paths.size());
+
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    const std::string &path = (paths[i][0] == '/') ? lookup(paths[i]) : paths[i];
+    std::string &str = out[n + i];
+
+    str.reserve(strlen(prefix) + path.size());
+    str = prefix;
+    str += path;
+  }
+}
+
+/* D:/dir -> /mnt/d/dir, the inverse of win_path() */
+std::string unix_path(const std::string &path)
+{
+  std::string str = path;
+
+  std::replace(str.begin(), str.end(), '\\', '/');
+
+  if (!wsl_slashes.empty() && str.size() > wsl_slashes.size() &&
+      strncasecmp(str.c_str(), wsl_slashes.c_str(), wsl_slashes.size()) == 0 &&
+      str[wsl_slashes.size()] == '/')
+  {
+    return str.substr(wsl_slashes.size());
+  }
+  if (str.size() < 2 || str[1] != ':' || !isalpha(str[0]))
+  {
+    return path;
+  }
+
+  load();
+
+  /* the mount showing the longest part of the path */
+  const struct mount_entry *best = NULL;
+  for (size_t i = 0; i < mounts.size(); ++i)
+  {
+    const std::string &w = mounts[i].win;
+    if (w.size() <= str.size() && strncasecmp(w.c_str(), str.c_str(), w.size()) == 0 &&
+        (w.size() == str.size() || str[w.size()] == '/' || w[w.size()-1] == ':') &&
+        (best == NULL || w.size() > best->win.size()))
+    {
+      best = &mounts[i];
+    }
+  }
+  if (best != NULL)
+  {
+    std::string rest = str.substr(best->win.size());
+    if (!rest.empty() && rest[0] != '/')
+    {
+      rest = "/" + rest;
+    }
+    return best->point + rest;
+  }
+
+  return "/mnt/" + std::string(1, tolower(str[0])) + str.substr(2);
+}
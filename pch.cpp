@@ -0,0 +1,482 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Precompiled headers for -include (--pch or GCC2MSVC_PCH=1).
+ *
+ * The first header forced in with -include (/FI) is precompiled once
+ * it has been seen GCC2MSVC_PCH_MIN times (default 2) with the same
+ * options, and from then on every compile gets /Yu and /Fp for it. A
+ * PCH lives in <dir>/<key>/ (GCC2MSVC_PCH_DIR, default: pch/ in the
+ * object cache directory), where the key covers the toolchain, the
+ * working directory, the language, the header and all translated
+ * options except the source and output names; different options just
+ * mean a different PCH. The PCH is built from an empty stub source
+ * with /Yc and /showIncludes under a lock on the entry, and rebuilt
+ * when one of the headers it included has changed.
+ *
+ * Compiling a header (gcc -c foo.h [-o foo.h.gch]) builds a PCH with
+ * /Yc instead of an object, plus foo.h.gch.key naming the options it
+ * was made with; -include foo.h uses it when they match, like GCC
+ * picks up a valid foo.h.gch.
+ *
+ * With debug info objects using a PCH must be linked together with the
+ * PCH's object (LNK2011). For /Z7 the object is kept next to the PCH
+ * and added to the link of a compile + link; compiles with -c and
+ * /Zi go without a PCH, with a warning.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+
+#define PCH_VERSION  "gcc2msvc pch 1"
+
+
+static std::string pch_dir()
+{
+  const char *dir = getenv("GCC2MSVC_PCH_DIR");
+  if (dir != NULL && *dir != 0)
+  {
+    return dir;
+  }
+  return cache_dir() + "/pch";
+}
+
+static long pch_min()
+{
+  const char *env = getenv("GCC2MSVC_PCH_MIN");
+  return (env != NULL && *env != 0) ? atol(env) : 2;
+}
+
+static std::string absolute(const std::string &path)
+{
+  if (path.empty() || path[0] == '/')
+  {
+    return path;
+  }
+  char cwd[PATH_MAX];
+  return (getcwd(cwd, sizeof(cwd)) != NULL) ? std::string(cwd) + "/" + path : path;
+}
+
+static bool is_header(const std::string &file)
+{
+  std::string ext = file.substr(file.rfind('.') + 1);
+  return file.find('.') != std::string::npos &&
+    (ext == "h" || ext == "hh" || ext == "hpp" || ext == "hxx" || ext == "H");
+}
+
+static bool is_c_source(const std::string &file)
+{
+  return file.size() > 2 && file.compare(file.size() - 2, 2, ".c") == 0;
+}
+
+/* options naming inputs and outputs of one compile, not its result */
+static bool is_per_file(const std::string &arg)
+{
+  return begins(arg.c_str(), "/Fo") || begins(arg.c_str(), "/Fd") ||
+    begins(arg.c_str(), "/MP") || arg == "/MP" || arg == "/c";
+}
+
+/* the key of a PCH of header (as given to /FI) for a compile with args;
+ * sources are the positions of the inputs in args */
+static std::string pch_key(const struct tool &cl, const std::vector<std::string> &args,
+                           const std::vector<size_t> &sources, const std::string &header,
+                           bool c_lang)
+{
+  struct hash_state h;
+  char hex[33];
+  char cwd[PATH_MAX];
+
+  hash_init(&h);
+  hash_string(&h, PCH_VERSION);
+  hash_toolchain(&h, cl);
+  hash_string(&h, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+  hash_string(&h, c_lang ? "C" : "C++");
+  /* the same header whether it was compiled (foo.h.gch) or forced in */
+  hash_string(&h, absolute(stage_origin(unix_path(header))).c_str());
+
+  for (size_t i = 0, k = 0; i < args.size(); ++i)
+  {
+    if (k < sources.size() && sources[k] == i)
+    {
+      ++k;
+      continue;
+    }
+    if (args[i] == "/link")
+    {
+      break;
+    }
+    if (!is_per_file(args[i]) && args[i] != "/FI" + header)
+    {
+      hash_string(&h, args[i].c_str());
+    }
+  }
+
+  hash_hex(&h, hex);
+  return hex;
+}
+
+static bool has_prefix_option(const std::vector<std::string> &args, const char *const *opts)
+{
+  for (size_t i = 0; i < args.size() && args[i] != "/link"; ++i)
+  {
+    for (const char *const *o = opts; *o != NULL; ++o)
+    {
+      if (args[i] == *o || begins(args[i].c_str(), *o))
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool has_arg(const std::vector<std::string> &args, const char *opt)
+{
+  for (size_t i = 0; i < args.size() && args[i] != "/link"; ++i)
+  {
+    if (args[i] == opt)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* the headers a PCH was built from, one "mtime size path" per line */
+static bool deps_unchanged(const std::string &file)
+{
+  std::ifstream in(file.c_str());
+  std::string line;
+  bool any = false;
+
+  while (std::getline(in, line))
+  {
+    std::istringstream ss(line);
+    long long mtime, size;
+    std::string path;
+    struct stat st;
+
+    ss >> mtime >> size;
+    std::getline(ss >> std::ws, path);
+    if (stat(path.c_str(), &st) != 0 || st.st_mtime != mtime || st.st_size != size)
+    {
+      return false;
+    }
+    any = true;
+  }
+  return any;
+}
+
+static void write_deps(const std::string &file, const std::string &header, const std::string &out)
+{
+  std::ofstream deps(file.c_str());
+  std::istringstream ss(out);
+  std::string line;
+  std::vector<std::string> paths(1, absolute(unix_path(header)));
+  std::string path;
+
+  while (std::getline(ss, line))
+  {
+    if (include_note(line, path) && !path.empty())
+    {
+      path = absolute(unix_path(path));
+      if (std::find(paths.begin(), paths.end(), path) == paths.end())
+      {
+        paths.push_back(path);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    struct stat st;
+    if (stat(paths[i].c_str(), &st) == 0)
+    {
+      deps << (long long)st.st_mtime << " " << (long long)st.st_size << " " << paths[i] << "\n";
+    }
+  }
+}
+
+/* run cl.exe /Yc on a stub source that includes nothing but the header;
+ * pch and keep_obj are unix paths, the PCH (and its object if keep_obj
+ * is set) are renamed into place when done */
+static bool build_pch(const struct tool &cl, const std::vector<std::string> &args,
+                      const std::vector<size_t> &sources, const std::string &header,
+                      bool c_lang, const std::string &pch, const std::string &deps,
+                      const std::string &keep_obj)
+{
+  std::string tmp = pch + ".tmp" + std::to_string(getpid());
+  std::string stub = pch + ".stub" + std::to_string(getpid()) + (c_lang ? ".c" : ".cpp");
+  std::string obj = stub + ".obj";
+
+  std::ofstream(stub.c_str()) << "/* precompiled header stub */\n";
+
+  std::vector<std::string> yc;
+  for (size_t i = 0, k = 0; i < args.size() && args[i] != "/link"; ++i)
+  {
+    if (k < sources.size() && sources[k] == i)
+    {
+      ++k;
+    }
+    else if (!is_per_file(args[i]) && args[i] != "/FI" + header)
+    {
+      yc.push_back(args[i]);
+    }
+  }
+  yc.push_back("/c");
+  yc.push_back("/showIncludes");
+  yc.push_back("/FI" + header);
+  yc.push_back("/Yc" + header);
+  yc.push_back("/Fp" + win_path(tmp.c_str()));
+  yc.push_back("/Fo" + win_path(obj.c_str()));
+  yc.push_back(win_path(stub.c_str()));
+
+  struct capture cap;
+  cap.echo = false;
+  cap.out_hash = NULL;
+
+  int rv = run_tool_capture(cl, yc, cap);
+  unlink(stub.c_str());
+
+  struct stat st;
+  if (rv != 0 || stat(tmp.c_str(), &st) != 0 ||
+      (!keep_obj.empty() && rename(obj.c_str(), keep_obj.c_str()) != 0) ||
+      rename(tmp.c_str(), pch.c_str()) != 0)
+  {
+    unlink(obj.c_str());
+    unlink(tmp.c_str());
+    std::cerr << "warning: cannot precompile " << header << ", compiling without" << std::endl;
+    std::cerr << cap.out << cap.err;
+    return false;
+  }
+  unlink(obj.c_str());
+
+  if (!deps.empty())
+  {
+    write_deps(deps, header, cap.out);
+  }
+  return true;
+}
+
+/* count the uses of an entry, returns the new count */
+static long count_use(const std::string &file)
+{
+  long n = 0;
+  {
+    std::ifstream in(file.c_str());
+    in >> n;
+  }
+  std::ofstream(file.c_str()) << ++n << "\n";
+  return n;
+}
+
+/* /Yu and /Fp after the /FI at fi; sources behind it move along */
+static void use_pch(struct translation &t, size_t fi, const std::string &header,
+                    const std::string &pch)
+{
+  std::vector<std::string> yu;
+  yu.push_back("/Yu" + header);
+  yu.push_back("/Fp" + win_path(pch.c_str()));
+  t.cl_args.insert(t.cl_args.begin() + fi + 1, yu.begin(), yu.end());
+  for (size_t i = 0; i < t.source_args.size(); ++i)
+  {
+    if (t.source_args[i] > fi)
+    {
+      t.source_args[i] += yu.size();
+    }
+  }
+}
+
+/* the PCH's object goes into the link: it has the debug info of its types */
+static void link_pch_object(std::vector<std::string> &args, const std::string &obj)
+{
+  std::vector<std::string>::iterator link = std::find(args.begin(), args.end(), "/link");
+  args.insert(link, win_path(obj.c_str()));
+}
+
+/* compiling a header: build its PCH at object (default: header.gch);
+ * C or C++ as -x says, otherwise as gcc or g++ would. With debug info
+ * it is built with /Z7 and its object is kept next to it, to be linked
+ * into the programs that use it. */
+static int compile_header(const struct tool &cl, struct translation &t)
+{
+  /* named like -include names it */
+  const std::string &source = t.sources[0];
+  const std::string &header = t.cl_args[t.source_args[0]];
+  bool c_lang = has_arg(t.cl_args, "/TC") || (!has_arg(t.cl_args, "/TP") && !t.cxx);
+  std::string out = t.have_outname ? t.outname : source + ".gch";
+  std::vector<std::string> args;
+  std::vector<size_t> sources;
+  bool debug = false;
+
+  /* the options of a compile + link that would use it */
+  for (size_t i = 0; i < t.cl_args.size(); ++i)
+  {
+    const std::string &arg = t.cl_args[i];
+    if (arg == "/Zi" || arg == "/ZI" || arg == "/Z7")
+    {
+      args.push_back("/Z7");
+      debug = true;
+    }
+    else if (arg != "/FS")
+    {
+      if (i == t.source_args[0])
+      {
+        sources.push_back(args.size());
+      }
+      args.push_back(arg);
+    }
+  }
+  std::string key = pch_key(cl, args, sources, header, c_lang);
+
+  if (!build_pch(cl, args, sources, header, c_lang, absolute(out), "",
+                 debug ? absolute(out) + ".obj" : ""))
+  {
+    return 1;
+  }
+  if (!debug)
+  {
+    unlink((out + ".obj").c_str());
+  }
+  std::ofstream(std::string(out + ".key").c_str()) << key << "\n";
+  return 0;
+}
+
+/* add /Yu and /Fp for the first -include header to t.cl_args, building
+ * the PCH if needed; or compile a header into a PCH. Returns -1 if
+ * the compile is to go on, otherwise the exit code. */
+int pch_prepare(const struct tool &cl, struct translation &t)
+{
+  static const char *const user_pch[] = { "/Yc", "/Yu", "/Fp", "/Y-", NULL };
+  static const char *const pdb_debug[] = { "/Zi", "/ZI", NULL };
+  std::vector<std::string> &args = t.cl_args;
+  bool z7 = has_arg(args, "/Z7");
+
+  if (t.sources.empty() || has_prefix_option(args, user_pch))
+  {
+    return -1;
+  }
+  if (!t.do_link && t.sources.size() == 1 && is_header(t.sources[0]))
+  {
+    return compile_header(cl, t);
+  }
+  if (has_prefix_option(args, pdb_debug) || (z7 && !t.do_link))
+  {
+    std::cerr << "warning: not using a precompiled header: with debug info the objects "
+      "would have to be linked together with its object" << std::endl;
+    return -1;
+  }
+
+  size_t fi = 0;
+  while (fi < args.size() && args[fi] != "/link" && !begins(args[fi].c_str(), "/FI"))
+  {
+    ++fi;
+  }
+  if (fi == args.size() || args[fi] == "/link")
+  {
+    return -1;
+  }
+
+  std::string header = args[fi].substr(3);
+  bool c_lang = has_arg(args, "/TC") || (is_c_source(t.sources[0]) && !has_arg(args, "/TP"));
+
+  /* languages can't be mixed with one PCH */
+  for (size_t i = 1; i < t.sources.size(); ++i)
+  {
+    if (is_c_source(t.sources[i]) != is_c_source(t.sources[0]))
+    {
+      return -1;
+    }
+  }
+
+  std::string key = pch_key(cl, args, t.source_args, header, c_lang);
+
+  /* a header.gch made with the same options */
+  std::string gch = unix_path(header) + ".gch";
+  std::string gch_key;
+  std::ifstream(std::string(gch + ".key").c_str()) >> gch_key;
+  if (gch_key == key && access(gch.c_str(), R_OK) == 0 &&
+      (!z7 || access((gch + ".obj").c_str(), R_OK) == 0))
+  {
+    use_pch(t, fi, header, absolute(gch));
+    if (z7)
+    {
+      link_pch_object(args, absolute(gch + ".obj"));
+    }
+    return -1;
+  }
+
+  std::string dir = pch_dir() + "/" + key.substr(0, 2) + "/" + key;
+  if (!mkdirs(dir))
+  {
+    return -1;
+  }
+
+  /* one invocation at a time looks at and builds the entry */
+  int lock = open((dir + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (lock < 0)
+  {
+    return -1;
+  }
+  while (flock(lock, LOCK_EX) != 0 && errno == EINTR)
+  {
+  }
+
+  std::string pch = dir + "/pch.pch";
+  std::string obj = z7 ? dir + "/pch.obj" : "";
+  bool ok = count_use(dir + "/count") >= pch_min() &&
+    ((access(pch.c_str(), R_OK) == 0 && (obj.empty() || access(obj.c_str(), R_OK) == 0) &&
+      deps_unchanged(dir + "/deps")) ||
+     build_pch(cl, args, t.source_args, header, c_lang, pch, dir + "/deps", obj));
+
+  close(lock);
+
+  if (ok)
+  {
+    use_pch(t, fi, header, pch);
+    t.deps.pch_deps = dir + "/deps";
+    if (!obj.empty())
+    {
+      link_pch_object(args, obj);
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,153 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Profile-guided optimization (-fprofile-generate, -fprofile-use).
+ *
+ * Both compile with /GL and link with /LTCG; an instrumented link adds
+ * /GENPROFILE (with EXACT counters for -fprofile-update=atomic), an
+ * optimized one /USEPROFILE, both naming the program database
+ * <dir>/<program>.pgd (next to the program without a directory).
+ * Every run of the instrumented program leaves a <program>!<n>.pgc
+ * there. Before an optimized link they are merged into the .pgd with
+ * pgomgr and moved to <dir>/merged, so the next link doesn't count
+ * them again. An instrumented link removes the counts of the previous
+ * instrumented program, which don't fit the new .pgd. Without a .pgd
+ * the program is linked without profile, as GCC does without .gcda
+ * files.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+
+/* the <program>!<n>.pgc files of pgd */
+static std::vector<std::string> pgc_files(const std::string &pgd, std::string &dir)
+{
+  std::vector<std::string> files;
+  size_t slash = pgd.rfind('/');
+  dir = (slash == std::string::npos) ? "." : pgd.substr(0, slash);
+  std::string prefix = pgd.substr(slash + 1, pgd.size() - slash - 5) + "!";
+
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL)
+  {
+    return files;
+  }
+
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    size_t len = strlen(e->d_name);
+    if (strncmp(e->d_name, prefix.c_str(), prefix.size()) == 0 && len > 4 &&
+        strcmp(e->d_name + len - 4, ".pgc") == 0)
+    {
+      files.push_back(dir + "/" + e->d_name);
+    }
+  }
+  closedir(d);
+  return files;
+}
+
+/* get the profile database ready for the link of t; returns 0, or the
+ * exit code of a failed merge */
+int pgo_prepare(struct translation &t)
+{
+  std::string dir;
+  std::vector<std::string> pgc = pgc_files(t.pgo_pgd, dir);
+
+  if (t.pgo == PGO_GENERATE)
+  {
+    if (!mkdirs(dir))
+    {
+      std::cerr << "warning: cannot create " << dir << std::endl;
+    }
+    for (size_t i = 0; i < pgc.size(); ++i)
+    {
+      unlink(pgc[i].c_str());
+    }
+    return 0;
+  }
+
+  if (access(t.pgo_pgd.c_str(), R_OK) != 0)
+  {
+    std::cerr << "warning: profile data " << t.pgo_pgd << " not found, linking without"
+      << std::endl;
+    for (size_t i = 0; i < t.cl_args.size(); ++i)
+    {
+      if (begins(t.cl_args[i].c_str(), "/USEPROFILE"))
+      {
+        t.cl_args.erase(t.cl_args.begin() + i);
+        break;
+      }
+    }
+    return 0;
+  }
+  if (pgc.empty())
+  {
+    return 0;
+  }
+
+  struct tool pgomgr;
+  if (!find_tool("pgomgr.exe", t.driver_paths, pgomgr))
+  {
+    std::cerr << "warning: pgomgr.exe not found in " << t.driver_paths
+      << ", leaving the .pgc files to link.exe" << std::endl;
+    return 0;
+  }
+
+  std::vector<std::string> args;
+  args.push_back("/merge");
+  args.push_back(win_path(t.pgo_pgd.c_str()));
+  if (t.verbose)
+  {
+    std::cout << pgomgr.path << " " << join_cmdline(args, false) << std::endl;
+  }
+
+  int rv = run_tool(pgomgr, args);
+  if (rv != 0)
+  {
+    return rv;
+  }
+
+  std::string merged = dir + "/merged";
+  mkdirs(merged);
+  for (size_t i = 0; i < pgc.size(); ++i)
+  {
+    std::string name = merged + pgc[i].substr(pgc[i].rfind('/'));
+    if (rename(pgc[i].c_str(), name.c_str()) != 0)
+    {
+      unlink(pgc[i].c_str());
+    }
+  }
+  return 0;
+}
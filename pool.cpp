@@ -0,0 +1,565 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Warm pool of cmd.exe processes (--pool).
+ *
+ * Starting a Windows process from Linux costs tens of milliseconds
+ * before it runs any code. With the pool, tools are started by a cmd.exe
+ * that is already running: `cmd.exe /Q' reads one command per line from
+ * its stdin. Every slot of the pool is a set of files in the pool
+ * directory:
+ *
+ *   <key>-<n>.lock   flock()ed while a gcc2msvc uses the slot; holds
+ *                    the pid of the slot's cmd.exe and its job count
+ *   <key>-<n>.in     FIFOs for cmd.exe's stdin, stdout and stderr;
+ *   <key>-<n>.out    cmd.exe keeps them open, so they outlive the
+ *   <key>-<n>.err    gcc2msvc that started it
+ *
+ * The key is a hash of cmd.exe's PATH, which holds the toolchain, and
+ * the other variables passed on to Windows through WSLENV. A job
+ * first sends an echo of a marker to stdout and stderr and reads until
+ * it comes back, which throws away what a killed gcc2msvc didn't read
+ * and tells whether cmd.exe is still healthy (otherwise it is killed and
+ * a new one started). Then it sends `cd /d <cwd> && <tool> <args>'
+ * followed by an echo of another marker and %ERRORLEVEL%; everything
+ * before the markers is the tool's output, the number is its exit code.
+ * After GCC2MSVC_POOL_JOBS jobs a cmd.exe is told to exit. If all slots
+ * are busy or anything fails, the tool is started the usual way.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+#include "ledger.h"
+#include "memlimit.h"
+#include "trace.h"
+
+#define POOL_JOBS        100
+#define PING_TIMEOUT_MS  10000   /* for a new cmd.exe to come up */
+
+struct slot {
+  std::string base;   /* <dir>/<key>-<n> */
+  int lock;           /* the lock file, held while we use the slot */
+  pid_t pid;          /* its cmd.exe, 0 if none */
+  long jobs;          /* jobs that cmd.exe has run */
+  int in, out, err;   /* our ends of the FIFOs */
+};
+
+static int pool_slots = 0;
+static int markers = 0;
+
+
+/* --pool=N */
+void pool_enable(int slots)
+{
+  pool_slots = slots;
+}
+
+/* jobs before a cmd.exe is replaced */
+static long max_jobs()
+{
+  const char *env = getenv("GCC2MSVC_POOL_JOBS");
+  return (env != NULL && *env != 0) ? atol(env) : POOL_JOBS;
+}
+
+static std::string pool_dir()
+{
+  const char *env = getenv("GCC2MSVC_POOL_DIR");
+  if (env != NULL && *env != 0)
+  {
+    return env;
+  }
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir != NULL && *dir != 0)
+  {
+    return std::string(dir) + "/gcc2msvc-pool";
+  }
+  return "/tmp/gcc2msvc-pool-" + std::to_string(getuid());
+}
+
+static std::string find_cmd()
+{
+  const char *path = getenv("PATH");
+  std::string dirs = path ? path : "";
+  size_t pos = 0;
+
+  while (pos <= dirs.size())
+  {
+    size_t end = dirs.find(':', pos);
+    if (end == std::string::npos)
+    {
+      end = dirs.size();
+    }
+    std::string file = dirs.substr(pos, end - pos) + "/cmd.exe";
+    if (end > pos && access(file.c_str(), X_OK) == 0)
+    {
+      return file;
+    }
+    pos = end + 1;
+  }
+  return "";
+}
+
+static bool write_all(int fd, const std::string &data)
+{
+  const char *p = data.data();
+  size_t len = data.size();
+
+  /* cmd.exe may be gone: fail instead of dying of SIGPIPE */
+  void (*old)(int) = signal(SIGPIPE, SIG_IGN);
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { break; }
+    p += n;
+    len -= n;
+  }
+  signal(SIGPIPE, old);
+  return len == 0;
+}
+
+static void read_state(struct slot &s)
+{
+  char buf[64];
+  ssize_t n = pread(s.lock, buf, sizeof(buf) - 1, 0);
+  long pid = 0;
+
+  s.jobs = 0;
+  buf[(n > 0) ? n : 0] = 0;
+  if (sscanf(buf, "%ld %ld", &pid, &s.jobs) != 2 || pid <= 0 || kill(pid, 0) != 0)
+  {
+    pid = 0;
+    s.jobs = 0;
+  }
+  s.pid = pid;
+}
+
+static void write_state(struct slot &s)
+{
+  std::string state = std::to_string(s.pid) + " " + std::to_string(s.jobs) + "\n";
+  if (ftruncate(s.lock, 0) != 0 || pwrite(s.lock, state.data(), state.size(), 0) < 0)
+  {
+    s.pid = 0;
+  }
+}
+
+static void close_fifos(struct slot &s)
+{
+  if (s.in >= 0)  { close(s.in);  }
+  if (s.out >= 0) { close(s.out); }
+  if (s.err >= 0) { close(s.err); }
+  s.in = s.out = s.err = -1;
+}
+
+/* the first slot that isn't locked by somebody else */
+static bool acquire_slot(const std::string &prefix, struct slot &s)
+{
+  for (int n = 0; n < pool_slots; ++n)
+  {
+    s.base = prefix + "-" + std::to_string(n);
+    s.lock = open((s.base + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (s.lock < 0)
+    {
+      return false;
+    }
+    if (flock(s.lock, LOCK_EX | LOCK_NB) == 0)
+    {
+      s.in = s.out = s.err = -1;
+      read_state(s);
+      return true;
+    }
+    close(s.lock);
+  }
+  return false;
+}
+
+static void kill_cmd(struct slot &s)
+{
+  close_fifos(s);
+  if (s.pid > 0)
+  {
+    kill(s.pid, SIGKILL);
+  }
+  s.pid = 0;
+  s.jobs = 0;
+}
+
+/* a new cmd.exe, detached from us: it keeps running when we exit */
+static bool start_cmd(struct slot &s, const struct tool &t, const std::string &cmd)
+{
+  const char *names[3] = { ".in", ".out", ".err" };
+  int fds[3];
+  int pid_pipe[2];
+
+  for (int i = 0; i < 3; ++i)
+  {
+    std::string fifo = s.base + names[i];
+    if (mkfifo(fifo.c_str(), 0600) != 0 && errno != EEXIST)
+    {
+      return false;
+    }
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    /* read-write, so cmd.exe never sees the end of its stdin */
+    fds[i] = open((s.base + names[i]).c_str(), O_RDWR | O_CLOEXEC);
+    if (fds[i] < 0)
+    {
+      while (i-- > 0) { close(fds[i]); }
+      return false;
+    }
+  }
+  if (pipe2(pid_pipe, O_CLOEXEC) != 0)
+  {
+    for (int i = 0; i < 3; ++i) { close(fds[i]); }
+    return false;
+  }
+
+  std::vector<char *> envp;
+  for (size_t i = 0; i < t.env.size(); ++i)
+  {
+    envp.push_back((char *)t.env[i].c_str());
+  }
+  envp.push_back(NULL);
+
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t child = fork();
+  if (child == 0)
+  {
+    setsid();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      dup2(fds[0], STDIN_FILENO);
+      dup2(fds[1], STDOUT_FILENO);
+      dup2(fds[2], STDERR_FILENO);
+
+      /* nothing else of ours, e.g. a pipe make waits on, stays open */
+      for (int fd = 3; fd < 1024; ++fd)
+      {
+        close(fd);
+      }
+      char *argv[] = { (char *)"cmd.exe", (char *)"/Q", NULL };
+      execve(cmd.c_str(), argv, envp.data());
+      _exit(127);
+    }
+    if (write(pid_pipe[1], &pid, sizeof(pid)) != sizeof(pid)) { _exit(1); }
+    _exit(0);
+  }
+
+  pid_t pid = -1;
+  close(pid_pipe[1]);
+  if (child > 0)
+  {
+    waitpid(child, NULL, 0);
+    if (read(pid_pipe[0], &pid, sizeof(pid)) != sizeof(pid))
+    {
+      pid = -1;
+    }
+  }
+  close(pid_pipe[0]);
+  for (int i = 0; i < 3; ++i)
+  {
+    close(fds[i]);
+  }
+
+  s.pid = (pid > 0) ? pid : 0;
+  s.jobs = 0;
+  return s.pid > 0;
+}
+
+static bool open_fifos(struct slot &s)
+{
+  /* without a reader (cmd.exe is gone) this fails with ENXIO */
+  s.in = open((s.base + ".in").c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  s.out = open((s.base + ".out").c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  s.err = open((s.base + ".err").c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (s.in < 0 || s.out < 0 || s.err < 0)
+  {
+    close_fifos(s);
+    return false;
+  }
+  fcntl(s.in, F_SETFL, 0);
+  return true;
+}
+
+static void forward(int fd, const char *p, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { break; }
+    p += n;
+    len -= n;
+  }
+}
+
+/* reads cmd.exe's stdout and stderr until the marker has come on both,
+ * copying what comes before it to ours if echo is set; the number after
+ * the marker on stdout goes to status. False if cmd.exe is gone or
+ * timeout_ms (-1: no limit) passed without output. */
+static bool read_until(struct slot &s, const std::string &marker, bool echo,
+                       int timeout_ms, int *status)
+{
+  std::string pending[2];
+  bool done[2] = { false, false };
+  int fd[2] = { s.out, s.err };
+  char buf[65536];
+
+  while (!done[0] || !done[1])
+  {
+    struct pollfd pfd[2];
+    int n = 0;
+    int which[2];
+
+    for (int k = 0; k < 2; ++k)
+    {
+      if (!done[k])
+      {
+        pfd[n].fd = fd[k];
+        pfd[n].events = POLLIN;
+        pfd[n].revents = 0;
+        which[n++] = k;
+      }
+    }
+
+    int rv = poll(pfd, n, timeout_ms);
+    if (rv < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv <= 0)
+    {
+      return false;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+      if (pfd[i].revents == 0)
+      {
+        continue;
+      }
+      int k = which[i];
+      ssize_t len = read(fd[k], buf, sizeof(buf));
+      if (len < 0 && (errno == EINTR || errno == EAGAIN))
+      {
+        continue;
+      }
+      if (len <= 0)
+      {
+        return false;   /* no writer left: cmd.exe is gone */
+      }
+      pending[k].append(buf, len);
+
+      size_t pos = pending[k].find(marker);
+      size_t keep = (pos != std::string::npos) ? pos : pending[k].rfind('\n') + 1;
+      if (echo && keep > 0)
+      {
+        forward(k == 0 ? STDOUT_FILENO : STDERR_FILENO, pending[k].data(), keep);
+      }
+      if (pos != std::string::npos)
+      {
+        if (k == 0 && status != NULL)
+        {
+          *status = atoi(pending[k].c_str() + pos + marker.size());
+        }
+        done[k] = true;
+      }
+      pending[k].erase(0, keep);
+    }
+  }
+  return true;
+}
+
+/* makes sure the slot has a cmd.exe that answers and that nothing is
+ * left over from a previous job */
+static bool ping(struct slot &s, const struct tool &t, const std::string &cmd)
+{
+  for (int attempt = 0; attempt < 2; ++attempt)
+  {
+    if (s.pid == 0)
+    {
+      TRACE_BEGIN("start pooled cmd.exe");
+      bool ok = start_cmd(s, t, cmd);
+      TRACE_END();
+      if (!ok)
+      {
+        return false;
+      }
+    }
+
+    std::string marker = "gcc2msvc-pool-" + std::to_string(getpid()) + "-" +
+      std::to_string(++markers) + "-ready";
+    if (open_fifos(s) &&
+        write_all(s.in, "echo " + marker + "& echo " + marker + " 1>&2\r\n") &&
+        read_until(s, marker, false, PING_TIMEOUT_MS, NULL))
+    {
+      return true;
+    }
+    kill_cmd(s);
+  }
+  return false;
+}
+
+/* cmd.exe keeps the environment it was started with: the slots of a
+ * pool are those of the same PATH (the toolchain) and the same values
+ * of the variables WSLENV passes on to Windows (CL, LINK, ...) */
+static std::string env_key(const struct tool &t, const std::string &cmd)
+{
+  struct hash_state h;
+  char hex[33];
+  std::string wslenv;
+
+  for (size_t i = 0; i < t.env.size(); ++i)
+  {
+    if (begins(t.env[i].c_str(), "WSLENV="))
+    {
+      wslenv = ":" + t.env[i].substr(7) + ":";
+    }
+  }
+
+  hash_init(&h);
+  hash_string(&h, cmd.c_str());
+  for (size_t i = 0; i < t.env.size(); ++i)
+  {
+    const std::string &e = t.env[i];
+    std::string name = e.substr(0, e.find('='));
+    if (name == "PATH" || name == "WSLENV" ||
+        wslenv.find(":" + name + ":") != std::string::npos ||
+        wslenv.find(":" + name + "/") != std::string::npos)
+    {
+      hash_string(&h, e.c_str());
+      hash_update(&h, "", 1);
+    }
+  }
+  hash_hex(&h, hex);
+  return std::string(hex, 16);
+}
+
+/* runs a tool through a cmd.exe of the pool; -1 if that isn't possible
+ * (pool off, all slots busy, cmd.exe not found or not answering), in
+ * which case the caller starts it itself */
+int pool_run(const struct tool &t, const std::vector<std::string> &args)
+{
+  if (pool_slots <= 0 || t.path.empty())
+  {
+    return -1;
+  }
+
+  /* cmd.exe has no escape for '"' within quotes and expands %VAR% even
+   * there, so such arguments would change the command; they are left
+   * to a direct start */
+  for (size_t i = 0; i < args.size(); ++i)
+  {
+    if (args[i].find_first_of("\"%") != std::string::npos)
+    {
+      return -1;
+    }
+  }
+
+  /* cmd.exe can't cd to UNC paths (\\wsl$\...) */
+  char *cwd = getcwd(NULL, 0);
+  std::string dir = cwd ? win_path(cwd) : "";
+  free(cwd);
+  if (dir.empty() || dir[0] == '/' || dir[0] == '\\' || dir.find('%') != std::string::npos)
+  {
+    return -1;
+  }
+
+  std::string cmd = find_cmd();
+  std::string pdir = pool_dir();
+  if (cmd.empty() || !mkdirs(pdir))
+  {
+    return -1;
+  }
+
+  struct slot s;
+  if (!acquire_slot(pdir + "/" + env_key(t, cmd), s))
+  {
+    return -1;
+  }
+  if (!ping(s, t, cmd))
+  {
+    write_state(s);
+    close(s.lock);
+    return -1;
+  }
+
+  /* cmd.exe's command line is limited to 8191 characters */
+  std::vector<std::string> cmd_args = args;
+  std::string tool_path = win_quote(win_path(t.path.c_str()), true);
+  std::vector<std::string> rsp_files = use_response_files(cmd_args, dir.size() + tool_path.size() + 16, true);
+
+  std::string marker = "gcc2msvc-pool-" + std::to_string(getpid()) + "-" +
+    std::to_string(++markers) + "-done";
+  std::string job = "cd /d " + win_quote(dir, true) + " && " + tool_path + " " +
+    join_cmdline(cmd_args, true) + "\r\n" +
+    "echo " + marker + " %ERRORLEVEL%& echo " + marker + " 1>&2\r\n";
+  int status = 127;
+  long long start = trace_clock();
+
+  std::cout.flush();
+  std::cerr.flush();
+
+  if (!write_all(s.in, job) || !read_until(s, marker, true, -1, &status))
+  {
+    kill_cmd(s);
+  }
+  else if (++s.jobs >= max_jobs())
+  {
+    write_all(s.in, "exit\r\n");
+    s.pid = 0;
+  }
+
+  LEDGER_CHILD(start, NULL);
+  MEM_CHILD(NULL);
+
+  close_fifos(s);
+  write_state(s);
+  close(s.lock);
+  remove_response_files(rsp_files);
+
+  return status;
+}
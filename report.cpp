@@ -0,0 +1,468 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * gcc2msvc-report: summary of a ledger written with --ledger=file or
+ * GCC2MSVC_LEDGER=file (see ledger.cpp).
+ *
+ *   gcc2msvc-report [-n N] [--gap=seconds] [ledger]
+ *
+ * The ledger is mmap()ed and used as an array of records, so millions of
+ * them take a fraction of a second. Printed are the total times, the
+ * last build (invocations that overlap or follow each other with less
+ * than --gap seconds, default 60, in between), an estimate of its
+ * critical path, the N (default 10) translation units taking longest on
+ * average and the N sets of options taking most time. The critical path
+ * is the chain of invocations, each starting after the previous one
+ * ended, with the highest total time: without the makefile's
+ * dependencies that is the longest the build could have taken with
+ * unlimited parallelism.
+ */
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "ledger.h"
+
+/* a slot of the open addressing table of translation units, which
+ * there can be a hundred thousand of: one cache miss per record */
+struct tu_stats {
+  uint64_t key;       /* hash of the name, 0 if the slot is free */
+  int64_t total, max;
+  uint32_t count;
+  uint32_t example;   /* a record of it, for the name */
+};
+
+struct flag_stats {
+  int64_t wall, tools;
+  uint32_t count;
+  uint32_t example;   /* a record using them */
+};
+
+struct flag_key {
+  uint64_t lo, hi;
+  bool operator==(const flag_key &o) const { return lo == o.lo && hi == o.hi; }
+};
+
+struct flag_key_hash {
+  size_t operator()(const flag_key &k) const { return k.lo ^ (k.hi * 31); }
+};
+
+static const struct ledger_record *recs;
+
+
+static double sec(int64_t us)
+{
+  return us / 1e6;
+}
+
+static int64_t wall(uint32_t i)
+{
+  return recs[i].end_us - recs[i].start_us;
+}
+
+/* translation units are told apart by a 64 bit FNV-1a hash of their
+ * name: comparing the names would touch records all over the ledger */
+static uint64_t name_hash(uint32_t i)
+{
+  uint64_t h = 14695981039346656037ULL;
+  const char *name = recs[i].name;
+  for (size_t k = 0; k < sizeof(recs[i].name) && name[k]; ++k)
+  {
+    h = (h ^ (unsigned char)name[k]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+static struct tu_stats &tu_find(std::vector<struct tu_stats> &table, size_t &used, uint64_t key)
+{
+  if (2 * (used + 1) > table.size())
+  {
+    std::vector<struct tu_stats> old(2 * table.size());
+    old.swap(table);
+    used = 0;
+    for (size_t i = 0; i < old.size(); ++i)
+    {
+      if (old[i].key != 0)
+      {
+        tu_find(table, used, old[i].key) = old[i];
+      }
+    }
+  }
+
+  key = key ? key : 1;
+  size_t mask = table.size() - 1;
+  for (size_t i = key & mask; ; i = (i + 1) & mask)
+  {
+    if (table[i].key == key)
+    {
+      return table[i];
+    }
+    if (table[i].key == 0)
+    {
+      table[i].key = key;
+      ++used;
+      return table[i];
+    }
+  }
+}
+
+static std::string name_of(uint32_t i)
+{
+  return std::string(recs[i].name, strnlen(recs[i].name, sizeof(recs[i].name)));
+}
+
+static std::string hex_of(const uint8_t *hash)
+{
+  struct hash_state h;
+  char hex[33];
+
+  memcpy(&h.value, hash, sizeof(h.value));
+  hash_hex(&h, hex);
+  return hex;
+}
+
+/* <ledger>.flags: "<hash> <options>" lines */
+static std::unordered_map<std::string, std::string> read_flags(const std::string &file)
+{
+  std::unordered_map<std::string, std::string> flags;
+  FILE *fp = fopen(file.c_str(), "r");
+  std::string line;
+  int c;
+
+  if (fp == NULL)
+  {
+    return flags;
+  }
+  while ((c = getc(fp)) != EOF)
+  {
+    if (c != '\n')
+    {
+      line += (char)c;
+      continue;
+    }
+    size_t sp = line.find(' ');
+    if (sp != std::string::npos)
+    {
+      flags[line.substr(0, sp)] = line.substr(sp + 1);
+    }
+    line.clear();
+  }
+  fclose(fp);
+  return flags;
+}
+
+/* the chain of invocations, each starting after the previous ended,
+ * with the highest total wall time; seg is sorted by start */
+static std::vector<uint32_t> critical_path(const std::vector<uint32_t> &seg)
+{
+  size_t m = seg.size();
+  std::vector<std::pair<int64_t, uint32_t> > by_end(m);   /* end, position in seg */
+  std::vector<int64_t> dp(m);
+  std::vector<int64_t> pred(m);
+
+  for (size_t i = 0; i < m; ++i)
+  {
+    by_end[i] = std::make_pair(recs[seg[i]].end_us, i);
+  }
+  std::sort(by_end.begin(), by_end.end());
+
+  int64_t best = 0, best_pos = -1;
+  size_t j = 0;
+  for (size_t i = 0; i < m; ++i)
+  {
+    /* the best chain among those that ended before this one started */
+    while (j < m && by_end[j].first <= recs[seg[i]].start_us)
+    {
+      if (dp[by_end[j].second] > best)
+      {
+        best = dp[by_end[j].second];
+        best_pos = by_end[j].second;
+      }
+      ++j;
+    }
+    dp[i] = wall(seg[i]) + best;
+    pred[i] = best_pos;
+  }
+
+  std::vector<uint32_t> chain;
+  int64_t p = std::max_element(dp.begin(), dp.end()) - dp.begin();
+  while (m > 0 && p >= 0)
+  {
+    chain.push_back(seg[p]);
+    p = pred[p];
+  }
+  std::reverse(chain.begin(), chain.end());
+  return chain;
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "usage: %s [-n N] [--gap=seconds] [ledger]\n"
+    "The ledger defaults to $GCC2MSVC_LEDGER.\n", self);
+}
+
+int main(int argc, char **argv)
+{
+  const char *file = getenv("GCC2MSVC_LEDGER");
+  size_t top = 10;
+  int64_t gap_us = 60 * 1000000LL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+    {
+      top = atoi(argv[++i]);
+    }
+    else if (strncmp(argv[i], "--gap=", 6) == 0)
+    {
+      gap_us = atof(argv[i] + 6) * 1e6;
+    }
+    else if (argv[i][0] == '-')
+    {
+      usage(argv[0]);
+      return (strcmp(argv[i], "--help") == 0) ? 0 : 1;
+    }
+    else
+    {
+      file = argv[i];
+    }
+  }
+  if (file == NULL || *file == 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    perror(file);
+    return 1;
+  }
+
+  /* a record being appended right now is left out */
+  size_t count = st.st_size / sizeof(struct ledger_record);
+  if (count == 0)
+  {
+    printf("ledger: %s: no records\n", file);
+    return 0;
+  }
+  void *map = mmap(NULL, count * sizeof(struct ledger_record), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    perror(file);
+    return 1;
+  }
+  madvise(map, count * sizeof(struct ledger_record), MADV_SEQUENTIAL);
+  recs = (const struct ledger_record *)map;
+
+  /* totals */
+  std::vector<std::pair<int64_t, uint32_t> > by_start;   /* start, record */
+  int64_t total = 0, tools = 0, self_cpu = 0, tools_cpu = 0, in = 0, out = 0;
+  size_t failed = 0;
+
+  by_start.reserve(count);
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const struct ledger_record &r = recs[i];
+    if (r.magic != LEDGER_MAGIC || r.size != sizeof(struct ledger_record))
+    {
+      continue;
+    }
+    by_start.push_back(std::make_pair(r.start_us, i));
+    total += wall(i);
+    tools += r.child_wall_us;
+    self_cpu += r.user_us + r.sys_us;
+    tools_cpu += r.child_user_us + r.child_sys_us;
+    in += r.input_bytes;
+    out += r.output_bytes;
+    failed += (r.status != 0);
+  }
+  if (by_start.empty())
+  {
+    printf("ledger: %s: no valid records\n", file);
+    return 1;
+  }
+
+  /* builds: runs of invocations without a gap */
+  std::sort(by_start.begin(), by_start.end());
+  std::vector<uint32_t> valid(by_start.size());
+  for (size_t i = 0; i < by_start.size(); ++i)
+  {
+    valid[i] = by_start[i].second;
+  }
+  std::vector<std::pair<int64_t, uint32_t> >().swap(by_start);
+  size_t builds = 1, last = 0;
+  int64_t end = recs[valid[0]].end_us;
+  for (size_t i = 1; i < valid.size(); ++i)
+  {
+    if (recs[valid[i]].start_us > end + gap_us)
+    {
+      ++builds;
+      last = i;
+    }
+    end = std::max(end, recs[valid[i]].end_us);
+  }
+
+  printf("ledger: %s: %zu invocations (%zu failed), %zu builds\n",
+    file, valid.size(), failed, builds);
+  printf("wall time %.2fs, in tools %.2fs (%.1f%%), in gcc2msvc %.2fs\n",
+    sec(total), sec(tools), total ? 100.0 * tools / total : 0.0, sec(total - tools));
+  printf("CPU time of gcc2msvc %.2fs, of the tools' Linux side %.2fs\n",
+    sec(self_cpu), sec(tools_cpu));
+  printf("read %.1f MB of sources, wrote %.1f MB\n", in / 1e6, out / 1e6);
+
+  /* the last build and its critical path */
+  std::vector<uint32_t> seg(valid.begin() + last, valid.end());
+  int64_t first_start = recs[seg[0]].start_us, last_end = 0, work = 0;
+  for (size_t i = 0; i < seg.size(); ++i)
+  {
+    last_end = std::max(last_end, recs[seg[i]].end_us);
+    work += wall(seg[i]);
+  }
+  int64_t span = last_end - first_start;
+  printf("\nlast build: %.2fs, %zu invocations, %.2fs of work (parallelism %.1f)\n",
+    sec(span), seg.size(), sec(work), span ? (double)work / span : 0.0);
+
+  std::vector<uint32_t> chain = critical_path(seg);
+  int64_t chain_time = 0;
+  for (size_t i = 0; i < chain.size(); ++i)
+  {
+    chain_time += wall(chain[i]);
+  }
+  printf("critical path: %.2fs, %zu invocations\n", sec(chain_time), chain.size());
+  printf("  %9s %9s  %s\n", "start", "time", "name");
+  for (size_t i = 0; i < chain.size(); ++i)
+  {
+    /* the first and the last N of a long one */
+    if (chain.size() > 2 * top && i == top)
+    {
+      printf("  %9s %9s  (%zu more)\n", "...", "", chain.size() - 2 * top);
+      i = chain.size() - top - 1;
+      continue;
+    }
+    printf("  %8.2fs %8.2fs  %s\n", sec(recs[chain[i]].start_us - first_start),
+      sec(wall(chain[i])), name_of(chain[i]).c_str());
+  }
+
+  /* slowest translation units, over all builds */
+  std::vector<struct tu_stats> tus(4096);
+  size_t tus_used = 0;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    if (recs[i].magic != LEDGER_MAGIC || recs[i].size != sizeof(struct ledger_record) ||
+        recs[i].sources == 0)
+    {
+      continue;
+    }
+    struct tu_stats &s = tu_find(tus, tus_used, name_hash(i));
+    s.example = i;
+    int64_t w = wall(i);
+    s.total += w;
+    s.max = std::max(s.max, w);
+    ++s.count;
+  }
+
+  std::vector<std::pair<double, const tu_stats *> > slow;
+  slow.reserve(tus_used);
+  for (size_t i = 0; i < tus.size(); ++i)
+  {
+    if (tus[i].key != 0)
+    {
+      slow.push_back(std::make_pair((double)tus[i].total / tus[i].count, &tus[i]));
+    }
+  }
+  size_t n = std::min(top, slow.size());
+  std::partial_sort(slow.begin(), slow.begin() + n, slow.end(),
+    [](const std::pair<double, const tu_stats *> &a,
+       const std::pair<double, const tu_stats *> &b) { return a.first > b.first; });
+
+  printf("\nslowest translation units (mean wall time):\n");
+  printf("  %9s %9s %7s  %s\n", "mean", "max", "count", "name");
+  for (size_t i = 0; i < n; ++i)
+  {
+    const tu_stats &s = *slow[i].second;
+    printf("  %8.2fs %8.2fs %7u  %s\n", sec(slow[i].first), sec(s.max), s.count,
+      name_of(s.example).c_str());
+  }
+
+  /* time per set of options */
+  std::unordered_map<flag_key, flag_stats, flag_key_hash> sets;
+  for (size_t i = 0; i < valid.size(); ++i)
+  {
+    const struct ledger_record &r = recs[valid[i]];
+    flag_key k;
+    memcpy(&k.lo, r.flags_hash, 8);
+    memcpy(&k.hi, r.flags_hash + 8, 8);
+    flag_stats &s = sets[k];
+    if (s.count++ == 0)
+    {
+      s.example = valid[i];
+    }
+    s.wall += wall(valid[i]);
+    s.tools += r.child_wall_us;
+  }
+
+  std::vector<const flag_stats *> by_time;
+  for (auto it = sets.begin(); it != sets.end(); ++it)
+  {
+    by_time.push_back(&it->second);
+  }
+  n = std::min(top, by_time.size());
+  std::partial_sort(by_time.begin(), by_time.begin() + n, by_time.end(),
+    [](const flag_stats *a, const flag_stats *b) { return a->wall > b->wall; });
+
+  std::unordered_map<std::string, std::string> flags = read_flags(std::string(file) + ".flags");
+  printf("\noptions by total wall time (%zu sets):\n", sets.size());
+  printf("  %9s %9s %7s  %-8s  %s\n", "total", "mean", "count", "hash", "options");
+  for (size_t i = 0; i < n; ++i)
+  {
+    const flag_stats &s = *by_time[i];
+    std::string hex = hex_of(recs[s.example].flags_hash);
+    std::string opts = flags.count(hex) ? flags[hex] : "?";
+    if (opts.size() > 100)
+    {
+      opts = opts.substr(0, 97) + "...";
+    }
+    printf("  %8.2fs %8.2fs %7u  %.8s  %s\n", sec(s.wall), sec(s.wall / s.count), s.count,
+      hex.c_str(), opts.c_str());
+  }
+
+  munmap(map, count * sizeof(struct ledger_record));
+  return 0;
+}
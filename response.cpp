@@ -0,0 +1,357 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Response files in both directions: GCC-style @file arguments we are
+ * given are replaced with the arguments read from the file (like
+ * libiberty's expandargv()), and command lines that are too long for
+ * Windows are handed to cl.exe and link.exe as @file.rsp.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+#define MAX_NESTING 64
+
+/* CreateProcess() takes at most 32767 characters, cmd.exe 8191 */
+#define CMDLINE_LIMIT  32000
+#define CMD_EXE_LIMIT  8000
+
+
+/* GCC quoting: arguments are separated by whitespace, single and double
+ * quotes group characters and a backslash escapes any character; the
+ * file is read in blocks and split as it comes in */
+static int expand_file(const char *file, int depth, std::vector<std::string> &args);
+
+static int add_arg(const std::string &arg, int depth, std::vector<std::string> &args)
+{
+  if (arg.size() > 1 && arg[0] == '@')
+  {
+    return expand_file(arg.c_str() + 1, depth + 1, args);
+  }
+  args.push_back(arg);
+  return 0;
+}
+
+static int expand_file(const char *file, int depth, std::vector<std::string> &args)
+{
+  if (depth > MAX_NESTING)
+  {
+    std::cerr << "error: response files nested too deeply at `@" << file << "'" << std::endl;
+    return -1;
+  }
+
+  struct stat st;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0 || fstat(fd, &st) != 0 || S_ISDIR(st.st_mode))
+  {
+    /* as in GCC, an @ argument that isn't a readable file is kept */
+    if (fd >= 0) { close(fd); }
+    args.push_back(std::string("@") + file);
+    return 0;
+  }
+
+  char buf[65536];
+  std::string arg;
+  bool in_arg = false, squote = false, dquote = false, escape = false;
+  int count = 1;
+  ssize_t n;
+
+  while ((n = read(fd, buf, sizeof(buf))) != 0)
+  {
+    if (n < 0)
+    {
+      if (errno == EINTR) { continue; }
+      std::cerr << "error: cannot read `" << file << "': " << strerror(errno) << std::endl;
+      close(fd);
+      return -1;
+    }
+
+    for (ssize_t i = 0; i < n; ++i)
+    {
+      char c = buf[i];
+
+      if (escape)
+      {
+        arg += c;
+        escape = false;
+      }
+      else if (c == '\\')
+      {
+        escape = in_arg = true;
+      }
+      else if (squote)
+      {
+        if (c == '\'') { squote = false; } else { arg += c; }
+      }
+      else if (dquote)
+      {
+        if (c == '"') { dquote = false; } else { arg += c; }
+      }
+      else if (isspace((unsigned char)c))
+      {
+        if (in_arg)
+        {
+          int rv = add_arg(arg, depth, args);
+          if (rv < 0)
+          {
+            close(fd);
+            return -1;
+          }
+          count += rv;
+          arg.clear();
+          in_arg = false;
+        }
+      }
+      else
+      {
+        in_arg = true;
+        if      (c == '\'') { squote = true; }
+        else if (c == '"')  { dquote = true; }
+        else                { arg += c;      }
+      }
+    }
+  }
+  close(fd);
+
+  if (in_arg)
+  {
+    int rv = add_arg(arg, depth, args);
+    if (rv < 0)
+    {
+      return -1;
+    }
+    count += rv;
+  }
+  return count;
+}
+
+/* replace @file arguments with the contents of the files; args is only
+ * filled if there are any, returns the number of files read or -1 */
+int expand_response_files(int argc, char **argv, std::vector<std::string> &args)
+{
+  int i = 1;
+  while (i < argc && (argv[i][0] != '@' || argv[i][1] == 0))
+  {
+    ++i;
+  }
+  if (i == argc)
+  {
+    return 0;
+  }
+
+  int count = 0;
+  args.assign(argv, argv + i);
+
+  for ( ; i < argc; ++i)
+  {
+    int rv = add_arg(argv[i], 0, args);
+    if (rv < 0)
+    {
+      return -1;
+    }
+    count += rv;
+  }
+  return count;
+}
+
+
+/* cl.exe and link.exe read response files as ANSI or, with a BOM, as
+ * UTF-16; anything beyond ASCII is written as UTF-16 */
+static void append_utf16(std::string &out, const std::string &in)
+{
+  for (size_t i = 0; i < in.size(); )
+  {
+    unsigned char c = in[i];
+    unsigned int cp = c;
+    size_t len = 1;
+
+    if      (c >= 0xf0) { len = 4; cp = c & 0x07; }
+    else if (c >= 0xe0) { len = 3; cp = c & 0x0f; }
+    else if (c >= 0xc0) { len = 2; cp = c & 0x1f; }
+
+    if (len > 1 && i + len <= in.size())
+    {
+      for (size_t k = 1; k < len; ++k)
+      {
+        cp = (cp << 6) | (in[i+k] & 0x3f);
+      }
+    }
+    else
+    {
+      len = 1;
+      cp = c;
+    }
+    i += len;
+
+    if (cp >= 0x10000)
+    {
+      cp -= 0x10000;
+      unsigned int hi = 0xd800 + (cp >> 10), lo = 0xdc00 + (cp & 0x3ff);
+      out += (char)(hi & 0xff); out += (char)(hi >> 8);
+      out += (char)(lo & 0xff); out += (char)(lo >> 8);
+    }
+    else
+    {
+      out += (char)(cp & 0xff); out += (char)(cp >> 8);
+    }
+  }
+}
+
+static bool write_response_file(const std::string &name, std::vector<std::string>::const_iterator begin,
+                                std::vector<std::string>::const_iterator end)
+{
+  std::string text;
+  bool ascii = true;
+
+  for (std::vector<std::string>::const_iterator it = begin; it != end; ++it)
+  {
+    text += win_quote(*it, false);
+    text += "\r\n";
+  }
+  for (size_t i = 0; i < text.size() && ascii; ++i)
+  {
+    ascii = (unsigned char)text[i] < 0x80;
+  }
+  if (!ascii)
+  {
+    std::string utf16 = "\xff\xfe";
+    append_utf16(utf16, text);
+    text.swap(utf16);
+  }
+
+  int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  const char *p = text.data();
+  size_t len = text.size();
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0)
+    {
+      close(fd);
+      unlink(name.c_str());
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  if (close(fd) != 0)
+  {
+    unlink(name.c_str());
+    return false;
+  }
+  return true;
+}
+
+/* longest command line we pass on; GCC2MSVC_RSP_LIMIT overrides it */
+static size_t cmdline_limit(bool for_cmd)
+{
+  const char *env = getenv("GCC2MSVC_RSP_LIMIT");
+  if (env != NULL && *env != 0)
+  {
+    return strtoul(env, NULL, 10);
+  }
+  return for_cmd ? CMD_EXE_LIMIT : CMDLINE_LIMIT;
+}
+
+/* if a command line with args plus overhead characters gets longer than
+ * the limit, move the arguments into response files in the current
+ * directory: one with the cl.exe arguments and, after /link, one with
+ * the link.exe arguments (cl.exe passes @file on to the linker).
+ * Returns the files created, which the caller removes afterwards. */
+std::vector<std::string> use_response_files(std::vector<std::string> &args, size_t overhead,
+                                            bool for_cmd)
+{
+  std::vector<std::string> files;
+
+  if (overhead + join_cmdline(args, for_cmd).size() <= cmdline_limit(for_cmd))
+  {
+    return files;
+  }
+
+  std::vector<std::string>::iterator link = args.begin();
+  while (link != args.end() && *link != "/link")
+  {
+    ++link;
+  }
+
+  std::string base = "gcc2msvc-" + std::to_string(getpid());
+  std::vector<std::string> new_args;
+
+  if (link != args.begin())
+  {
+    files.push_back(base + ".rsp");
+    if (!write_response_file(files.back(), args.begin(), link))
+    {
+      files.pop_back();
+      return files;
+    }
+    new_args.push_back("@" + files.back());
+  }
+  if (link != args.end())
+  {
+    new_args.push_back("/link");
+    if (link + 1 != args.end())
+    {
+      files.push_back(base + "-link.rsp");
+      if (!write_response_file(files.back(), link + 1, args.end()))
+      {
+        remove_response_files(files);
+        return files;
+      }
+      new_args.push_back("@" + files.back());
+    }
+  }
+
+  args.swap(new_args);
+  return files;
+}
+
+void remove_response_files(std::vector<std::string> &files)
+{
+  for (size_t i = 0; i < files.size(); ++i)
+  {
+    unlink(files[i].c_str());
+  }
+  files.clear();
+}
@@ -0,0 +1,502 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Compile server: a long-lived gcc2msvc process listening on a unix socket.
+ *
+ * A client connects, passes its stdin/stdout/stderr as file descriptors
+ * (SCM_RIGHTS) and sends its working directory, argv and environment.
+ * The server queues the connection and, as soon as fewer than --jobs
+ * jobs are running, forks a worker that takes over the client's cwd,
+ * environment and standard streams and runs the driver in-process.
+ * Output therefore goes straight to the client's terminal or pipes and
+ * only the exit code is sent back over the socket. The mount table, the
+ * toolchain and the tools' locations are looked up once at start-up,
+ * so the workers inherit them instead of looking them up per job.
+ */
+
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+#define SERVER_MAGIC    0x67326d73  /* "g2ms" */
+#define SERVER_VERSION  1
+
+struct request_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t size;  /* bytes of string data following the header */
+};
+
+static int sigchld_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t server_quit = 0;
+
+
+static std::string default_socket_path()
+{
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir != NULL && *dir != 0)
+  {
+    return std::string(dir) + "/gcc2msvc.sock";
+  }
+  return "/tmp/gcc2msvc-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool make_address(const char *path, struct sockaddr_un &addr)
+{
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    std::cerr << "error: socket path too long: " << path << std::endl;
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = (const char *)buf;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+  char *p = (char *)buf;
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+
+/* client side */
+
+/* returns the exit code of the remote job, or -1 if no server
+ * could be reached and the caller should run the job itself */
+int client_forward(const char *socket_path, int argc, char **argv)
+{
+  struct sockaddr_un addr;
+  if (!make_address(socket_path, addr))
+  {
+    return -1;
+  }
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+  {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+  {
+    close(sock);
+    return -1;
+  }
+
+  std::string data = std::string(cwd) + '\0';
+  for (int i = 0; i < argc; ++i)
+  {
+    data += std::string(argv[i]) + '\0';
+  }
+  uint32_t envc = 0;
+  for (char **e = environ; *e != NULL; ++e, ++envc)
+  {
+    data += std::string(*e) + '\0';
+  }
+
+  struct request_header hdr;
+  hdr.magic = SERVER_MAGIC;
+  hdr.version = SERVER_VERSION;
+  hdr.argc = argc;
+  hdr.envc = envc;
+  hdr.size = data.size();
+
+  /* the header travels together with our standard streams */
+  int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  memset(cbuf, 0, sizeof(cbuf));
+
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hdr) ||
+      !write_all(sock, data.data(), data.size()))
+  {
+    /* nothing has been run yet, so it's safe to fall back */
+    close(sock);
+    return -1;
+  }
+
+  int32_t status;
+  if (!read_all(sock, &status, sizeof(status)))
+  {
+    std::cerr << "error: lost connection to compile server " << socket_path << std::endl;
+    close(sock);
+    return 1;
+  }
+  close(sock);
+
+  return status;
+}
+
+
+/* server side */
+
+static void on_sigchld(int)
+{
+  int saved = errno;
+  if (write(sigchld_pipe[1], "", 1) < 0) { /* pipe full: a wakeup is already pending */ }
+  errno = saved;
+}
+
+static void on_quit(int)
+{
+  server_quit = 1;
+}
+
+/* what every job needs first: the mount table, the toolchain and where
+ * its tools are; the forked workers inherit all of it */
+static void warm_up()
+{
+  char gcc[] = "gcc", c[] = "-c", source[] = "gcc2msvc-server.c";
+  char *argv[] = { gcc, c, source, NULL };
+  struct translation t;
+  struct tool tool;
+
+  paths_init(NULL);
+  if (translate(3, argv, t) == 0)
+  {
+    find_tool("cl.exe", t.driver_paths, tool);
+    find_tool("link.exe", t.driver_paths, tool);
+  }
+}
+
+/* runs in the forked worker; never returns */
+static void serve_job(int conn)
+{
+  struct request_header hdr;
+  int fds[3] = { -1, -1, -1 };
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  ssize_t n;
+  do {
+    n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+
+  if (n != (ssize_t)sizeof(hdr) || hdr.magic != SERVER_MAGIC || hdr.version != SERVER_VERSION)
+  {
+    _exit(1);
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+  {
+    _exit(1);
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  std::vector<char> data(hdr.size + 1, 0);
+  if (!read_all(conn, data.data(), hdr.size))
+  {
+    _exit(1);
+  }
+
+  /* split the string block into cwd, argv and environment */
+  std::vector<char *> strings;
+  for (size_t off = 0; off < hdr.size; off += strlen(&data[off]) + 1)
+  {
+    strings.push_back(&data[off]);
+  }
+  if (strings.size() != 1 + (size_t)hdr.argc + hdr.envc || hdr.argc < 1)
+  {
+    _exit(1);
+  }
+
+  for (int i = 0; i < 3; ++i)
+  {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+
+  int32_t status = 1;
+
+  if (chdir(strings[0]) != 0)
+  {
+    std::cerr << "error: cannot change to directory " << strings[0] << ": "
+      << strerror(errno) << std::endl;
+  }
+  else
+  {
+    const char *distro = getenv("WSL_DISTRO_NAME");
+    std::string server_distro = (distro != NULL) ? distro : "";
+    clearenv();
+    for (size_t i = 1 + hdr.argc; i < strings.size(); ++i)
+    {
+      putenv(strings[i]);
+    }
+    /* the mount table was read for the server's distribution */
+    distro = getenv("WSL_DISTRO_NAME");
+    if (server_distro != ((distro != NULL) ? distro : ""))
+    {
+      paths_init(NULL);
+    }
+
+    std::vector<char *> args(strings.begin() + 1, strings.begin() + 1 + hdr.argc);
+    args.push_back(NULL);
+    status = run_driver(hdr.argc, args.data());
+  }
+
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(NULL);
+
+  write_all(conn, &status, sizeof(status));
+  _exit(0);
+}
+
+int server_main(int argc, char **argv)
+{
+  std::string path = default_socket_path();
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (begins(argv[i], "--server="))
+    {
+      path = argv[i] + 9;
+    }
+    else if (begins(argv[i], "--jobs="))
+    {
+      jobs = strtol(argv[i] + 7, NULL, 10);
+    }
+    else if (strcmp(argv[i], "--server") != 0)
+    {
+      std::cerr << "warning: ignoring `" << argv[i] << "' in server mode" << std::endl;
+    }
+  }
+  if (jobs < 1)
+  {
+    jobs = 1;
+  }
+
+  struct sockaddr_un addr;
+  if (!make_address(path.c_str(), addr))
+  {
+    return 1;
+  }
+
+  int lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (lsock < 0)
+  {
+    perror("socket()");
+    return 1;
+  }
+
+  if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    /* remove a stale socket left behind by a server that is gone */
+    bool in_use = (errno == EADDRINUSE);
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool alive = (in_use && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    close(probe);
+
+    if (alive || unlink(path.c_str()) != 0 ||
+        bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+      std::cerr << "error: cannot listen on " << path << ": "
+        << (alive ? "another server is running" : strerror(errno)) << std::endl;
+      close(lsock);
+      return 1;
+    }
+  }
+
+  if (listen(lsock, SOMAXCONN) != 0 || pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+  {
+    perror("listen()");
+    unlink(path.c_str());
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+  sa.sa_handler = on_quit;
+  sa.sa_flags = 0;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  warm_up();
+  std::cerr << "gcc2msvc: listening on " << path << " (" << jobs << " jobs)" << std::endl;
+
+  std::deque<int> queue;
+  long running = 0;
+
+  while (!server_quit)
+  {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+    {
+      --running;
+    }
+
+    while (running < jobs && !queue.empty())
+    {
+      int conn = queue.front();
+      queue.pop_front();
+
+      std::cout.flush();
+      std::cerr.flush();
+
+      pid_t pid = fork();
+      if (pid == 0)
+      {
+        close(lsock);
+        close(sigchld_pipe[0]);
+        close(sigchld_pipe[1]);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        serve_job(conn);
+      }
+      else if (pid > 0)
+      {
+        ++running;
+      }
+      else
+      {
+        std::cerr << "failed to fork()" << std::endl;
+      }
+      close(conn);
+    }
+
+    struct pollfd pfd[2];
+    pfd[0].fd = lsock;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sigchld_pipe[0];
+    pfd[1].events = POLLIN;
+
+    if (poll(pfd, 2, -1) < 0)
+    {
+      continue;  /* EINTR */
+    }
+
+    if (pfd[1].revents & POLLIN)
+    {
+      char buf[64];
+      while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {}
+    }
+
+    if (pfd[0].revents & POLLIN)
+    {
+      int conn = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+      if (conn >= 0)
+      {
+        queue.push_back(conn);
+      }
+    }
+  }
+
+  close(lsock);
+  unlink(path.c_str());
+
+  for (size_t i = 0; i < queue.size(); ++i)
+  {
+    close(queue[i]);
+  }
+  while (running > 0 && wait(NULL) > 0)
+  {
+    --running;
+  }
+
+  return 0;
+}
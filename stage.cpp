@@ -0,0 +1,575 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Staging of inputs that only exist within the Linux distribution (--stage).
+ *
+ * cl.exe reaches files outside the drvfs mounts only through
+ * \\wsl$\<distro> (see paths.cpp), which is slow and needs
+ * WSL_DISTRO_NAME; without it generated sources in /tmp or the home
+ * directory can't be read at all. With --stage=DIR, DIR being on a
+ * windows drive, sources, objects, -I directories and -include files
+ * on other filesystems are mirrored into DIR and cl.exe is given the
+ * mirrored paths instead:
+ *
+ *   DIR/tree/<path>          the mirror of /<path>, a hard link to
+ *   DIR/objects/<k0k1>/<k>   the content, by its hash
+ *   DIR/index                size, mtime, inode and hash of every
+ *                            mirrored file, appended to
+ *
+ * The headers a staged file includes are found by scanning it for
+ * #include lines, searched for the way cl.exe does: "x" in the
+ * directories of the including files, then in the -I directories, <x>
+ * only in the -I directories. Files on windows drives are left alone.
+ * A file whose size, mtime and inode match the index is not even read;
+ * one that changed is hashed and only content that isn't in objects/
+ * yet is copied (as a reflink where the filesystem can), so switching
+ * back and forth between versions copies nothing. Dependency files
+ * name the original files (stage_origin()).
+ */
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+#include "trace.h"
+
+/* a file to mirror */
+struct stage_file {
+  std::string path;    /* absolute */
+  bool scan;           /* look for the headers it includes */
+};
+
+/* what DIR/tree/<path> was made from */
+struct index_entry {
+  unsigned long long size, mtime, ino;
+  std::string hash;
+};
+
+static std::string stage_root;                            /* empty if off */
+static std::string base_dir;                              /* of relative paths, empty: cwd */
+static std::map<std::string, std::string> staged;         /* path -> what cl.exe gets */
+static std::vector<std::string> include_dirs;             /* -I, in order */
+static std::vector<std::string> mirror_dirs;
+static std::vector<struct stage_file> pending;
+
+static std::unordered_map<std::string, struct index_entry> index_map;
+static std::string index_root;       /* the stage directory index_map belongs to */
+static unsigned long long index_ino = 0;
+static off_t index_read = 0;         /* how much of the index was read */
+static size_t index_lines = 0;
+
+
+/* /a/./b//../c -> /a/c */
+static std::string normalize(const std::string &path)
+{
+  std::vector<std::string> parts;
+  size_t pos = 0;
+
+  while (pos < path.size())
+  {
+    size_t end = path.find('/', pos);
+    if (end == std::string::npos)
+    {
+      end = path.size();
+    }
+    std::string part = path.substr(pos, end - pos);
+    if (part == "..")
+    {
+      if (!parts.empty()) { parts.pop_back(); }
+    }
+    else if (!part.empty() && part != ".")
+    {
+      parts.push_back(part);
+    }
+    pos = end + 1;
+  }
+
+  std::string str;
+  for (size_t i = 0; i < parts.size(); ++i)
+  {
+    str += "/" + parts[i];
+  }
+  return str.empty() ? "/" : str;
+}
+
+static std::string absolute(const std::string &path)
+{
+  if (path[0] == '/')
+  {
+    return normalize(path);
+  }
+  char cwd[PATH_MAX];
+  std::string dir = (getcwd(cwd, sizeof(cwd)) != NULL) ? cwd : "/";
+  if (!base_dir.empty())
+  {
+    dir = (base_dir[0] == '/') ? base_dir : dir + "/" + base_dir;
+  }
+  return normalize(dir + "/" + path);
+}
+
+static bool inside(const std::string &path, const std::string &dir)
+{
+  return path.compare(0, dir.size(), dir) == 0 &&
+    (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+static std::string dir_name(const std::string &path)
+{
+  return path.substr(0, path.rfind('/'));
+}
+
+/* turn staging on (dir) or off ("" or "unc": \\wsl$ paths); forgets
+ * what the previous command line staged */
+void stage_init(const std::string &dir)
+{
+  static bool warned = false;
+
+  staged.clear();
+  include_dirs.clear();
+  mirror_dirs.clear();
+  pending.clear();
+  stage_root.clear();
+
+  if (dir.empty() || dir == "unc")
+  {
+    return;
+  }
+  stage_root = absolute(dir);
+
+  const char *distro = getenv("WSL_DISTRO_NAME");
+  if (!warned && distro != NULL && *distro != 0 && !drvfs_path(stage_root))
+  {
+    std::cerr << "warning: staging directory " << dir << " is not on a windows drive" << std::endl;
+    warned = true;
+  }
+}
+
+/* relative paths of the following command lines are relative to dir */
+void stage_base(const std::string &dir)
+{
+  base_dir = dir;
+}
+
+/* the path cl.exe is given for an input: its mirror if it is staged,
+ * else win_path(); the headers a source includes are staged with it */
+std::string stage_path(const char *path, bool source)
+{
+  if (stage_root.empty() || *path == 0)
+  {
+    return win_path(path);
+  }
+
+  std::string abs = absolute(path);
+  std::map<std::string, std::string>::iterator it = staged.find(abs);
+  if (it != staged.end())
+  {
+    return it->second;
+  }
+
+  std::string str = win_path(path);
+  struct stat st;
+
+  if (stat(abs.c_str(), &st) == 0)
+  {
+    if (S_ISDIR(st.st_mode))
+    {
+      include_dirs.push_back(abs);
+    }
+    if (!drvfs_path(abs) && !inside(abs, stage_root))
+    {
+      std::string mirror = stage_root + "/tree" + abs;
+      if (S_ISDIR(st.st_mode))
+      {
+        mirror_dirs.push_back(mirror);
+      }
+      else
+      {
+        struct stage_file f = { abs, source };
+        pending.push_back(f);
+      }
+      str = win_path(mirror.c_str());
+    }
+  }
+  staged[abs] = str;
+  return str;
+}
+
+/* the original of a mirrored file, other paths are returned as they are */
+std::string stage_origin(const std::string &path)
+{
+  std::string tree = stage_root + "/tree";
+
+  if (!stage_root.empty() && path.size() > tree.size() && inside(path, tree))
+  {
+    return path.substr(tree.size());
+  }
+  return path;
+}
+
+/* the names of the headers a file includes, "x" or <x> */
+static void includes_of(const std::string &path, std::vector<std::string> &names)
+{
+  FILE *fp = fopen(path.c_str(), "re");
+  if (fp == NULL)
+  {
+    return;
+  }
+
+  char *line = NULL;
+  size_t size = 0;
+
+  while (getline(&line, &size, fp) >= 0)
+  {
+    const char *p = line + strspn(line, " \t");
+    if (*p != '#')
+    {
+      continue;
+    }
+    p += 1 + strspn(p + 1, " \t");
+    if (strncmp(p, "include", 7) != 0)
+    {
+      continue;
+    }
+    p += 7 + strspn(p + 7, " \t");
+
+    const char *end = (*p == '"') ? strchr(p + 1, '"') : (*p == '<') ? strchr(p + 1, '>') : NULL;
+    if (end != NULL && end > p + 1)
+    {
+      names.push_back(std::string(p, end - p));
+    }
+  }
+  free(line);
+  fclose(fp);
+}
+
+static bool is_file(const std::string &path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/* where cl.exe finds a header; chain holds the directories of the
+ * files including it, outermost first */
+static std::string find_header(const std::string &name, const std::vector<std::string> &chain)
+{
+  std::string file = name.substr(1);
+
+  if (file[0] == '/')
+  {
+    return is_file(file) ? normalize(file) : "";
+  }
+  if (name[0] == '"')
+  {
+    for (size_t i = chain.size(); i-- > 0; )
+    {
+      if (is_file(chain[i] + "/" + file))
+      {
+        return normalize(chain[i] + "/" + file);
+      }
+    }
+  }
+  for (size_t i = 0; i < include_dirs.size(); ++i)
+  {
+    if (is_file(include_dirs[i] + "/" + file))
+    {
+      return normalize(include_dirs[i] + "/" + file);
+    }
+  }
+  return "";
+}
+
+/* add the staged headers path includes to files, depth first */
+static void scan(const std::string &path, std::vector<std::string> &chain,
+                 std::set<std::string> &seen, std::vector<std::string> &files)
+{
+  std::vector<std::string> names;
+
+  includes_of(path, names);
+  chain.push_back(dir_name(path));
+
+  for (size_t i = 0; i < names.size(); ++i)
+  {
+    std::string header = find_header(names[i], chain);
+    if (header.empty() || drvfs_path(header) || inside(header, stage_root) ||
+        !seen.insert(header).second)
+    {
+      continue;
+    }
+    files.push_back(header);
+    scan(header, chain, seen, files);
+  }
+  chain.pop_back();
+}
+
+/* read what was appended to the index since the last time */
+static void index_load()
+{
+  if (index_root != stage_root)
+  {
+    index_root = stage_root;
+    index_map.clear();
+    index_ino = 0;
+    index_read = 0;
+    index_lines = 0;
+  }
+
+  int fd = open((stage_root + "/index").c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (fd < 0)
+  {
+    return;
+  }
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return;
+  }
+  if (st.st_ino != index_ino || st.st_size < index_read)
+  {
+    /* rewritten by another process */
+    index_map.clear();
+    index_ino = st.st_ino;
+    index_read = 0;
+    index_lines = 0;
+  }
+
+  std::string data(st.st_size - index_read, 0);
+  ssize_t n = data.empty() ? 0 : pread(fd, &data[0], data.size(), index_read);
+  close(fd);
+  if (n <= 0)
+  {
+    return;
+  }
+  data.resize(n);
+
+  /* only whole lines, another process may be appending one */
+  size_t pos = 0, end;
+  while ((end = data.find('\n', pos)) != std::string::npos)
+  {
+    std::string line = data.substr(pos, end - pos);
+    struct index_entry e;
+    char hex[33];
+    int len = 0;
+
+    if (sscanf(line.c_str(), "%llu %llu %llu %32s %n", &e.size, &e.mtime, &e.ino, hex, &len) == 4 &&
+        len > 0 && line[len] == '/')
+    {
+      e.hash = hex;
+      index_map[line.substr(len)] = e;
+      ++index_lines;
+    }
+    pos = end + 1;
+  }
+  index_read += pos;
+}
+
+static std::string index_line(const std::string &path, const struct index_entry &e)
+{
+  return std::to_string(e.size) + " " + std::to_string(e.mtime) + " " + std::to_string(e.ino) +
+    " " + e.hash + " " + path + "\n";
+}
+
+/* one line per file, without the files that are gone, once most of
+ * the lines are outdated */
+static void index_compact()
+{
+  if (index_lines < 4096 || index_lines < 2 * index_map.size())
+  {
+    return;
+  }
+
+  std::string file = stage_root + "/index";
+  std::string tmp = file + ".tmp" + std::to_string(getpid());
+  std::string data;
+
+  for (std::unordered_map<std::string, struct index_entry>::iterator it = index_map.begin();
+       it != index_map.end(); ++it)
+  {
+    if (access(it->first.c_str(), F_OK) == 0)
+    {
+      data += index_line(it->first, it->second);
+    }
+  }
+
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0)
+  {
+    return;
+  }
+  bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+  if (close(fd) != 0 || !ok || rename(tmp.c_str(), file.c_str()) != 0)
+  {
+    unlink(tmp.c_str());
+  }
+}
+
+/* make DIR/tree<path> a copy of path */
+static bool mirror(const std::string &path, int index_fd)
+{
+  std::string tree = stage_root + "/tree" + path;
+  struct stat st, tree_st;
+
+  if (stat(path.c_str(), &st) != 0)
+  {
+    return false;
+  }
+
+  struct index_entry e;
+  e.size = st.st_size;
+  e.mtime = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  e.ino = st.st_ino;
+
+  std::unordered_map<std::string, struct index_entry>::iterator it = index_map.find(path);
+  bool have = it != index_map.end() && stat(tree.c_str(), &tree_st) == 0;
+
+  if (have && it->second.size == e.size && it->second.mtime == e.mtime && it->second.ino == e.ino)
+  {
+    return true;
+  }
+
+  struct hash_state h;
+  char hex[33];
+
+  hash_init(&h);
+  if (hash_file(&h, path.c_str()) != 0)
+  {
+    return false;
+  }
+  hash_hex(&h, hex);
+  e.hash = hex;
+
+  if (!have || it->second.hash != e.hash)
+  {
+    std::string object = stage_root + "/objects/" + e.hash.substr(0, 2) + "/" + e.hash.substr(2);
+    std::string tmp = tree + ".tmp" + std::to_string(getpid());
+
+    if (access(object.c_str(), F_OK) != 0 &&
+        (!mkdirs(dir_name(object)) || !copy_file(path, object)))
+    {
+      return false;
+    }
+    if (!mkdirs(dir_name(tree)))
+    {
+      return false;
+    }
+    unlink(tmp.c_str());
+    if (link(object.c_str(), tmp.c_str()) == 0)
+    {
+      if (rename(tmp.c_str(), tree.c_str()) != 0)
+      {
+        unlink(tmp.c_str());
+        return false;
+      }
+    }
+    else if (!copy_file(object, tree))
+    {
+      return false;
+    }
+  }
+
+  std::string line = index_line(path, e);
+  if (index_fd >= 0 && write(index_fd, line.data(), line.size()) != (ssize_t)line.size())
+  {
+    return false;
+  }
+  index_map[path] = e;
+  return true;
+}
+
+/* mirror what stage_path() was given and the headers it includes;
+ * returns 0 or 1 if a file could not be staged */
+int stage_sync()
+{
+  if (stage_root.empty() || (pending.empty() && mirror_dirs.empty()))
+  {
+    return 0;
+  }
+  TRACE_BEGIN("stage inputs");
+
+  std::set<std::string> seen;
+  std::vector<std::string> files, chain;
+  int rv = 0;
+
+  for (size_t i = 0; i < pending.size(); ++i)
+  {
+    if (seen.insert(pending[i].path).second)
+    {
+      files.push_back(pending[i].path);
+    }
+    if (pending[i].scan)
+    {
+      scan(pending[i].path, chain, seen, files);
+    }
+  }
+  if (!mkdirs(stage_root))
+  {
+    std::cerr << "error: cannot create staging directory " << stage_root << std::endl;
+    rv = 1;
+  }
+  for (size_t i = 0; i < mirror_dirs.size() && rv == 0; ++i)
+  {
+    if (!mkdirs(mirror_dirs[i]))
+    {
+      std::cerr << "error: cannot create " << mirror_dirs[i] << std::endl;
+      rv = 1;
+    }
+  }
+  index_load();
+  int index_fd = open((stage_root + "/index").c_str(),
+                      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+
+  for (size_t i = 0; i < files.size() && rv == 0; ++i)
+  {
+    if (!mirror(files[i], index_fd))
+    {
+      std::cerr << "error: cannot stage " << files[i] << std::endl;
+      rv = 1;
+    }
+  }
+  if (index_fd >= 0)
+  {
+    close(index_fd);
+  }
+  index_compact();
+
+  pending.clear();
+  mirror_dirs.clear();
+  TRACE_END();
+  return rv;
+}
@@ -22,11 +22,56 @@
  * SOFTWARE.
  */
 
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "ledger.h"
+#include "memlimit.h"
+#include "trace.h"
+
+/* when the last child was started, for the ledger */
+static long long child_start;
+
+int wait_return(pid_t pid)
+{
+  int status;
+  int return_status = 127;
+  pid_t rv;
+  struct rusage ru;
+
+  TRACE_BEGIN("wait");
+  rv = wait4(pid, &status, 0, &ru);
+  TRACE_END();
+
+  if (rv > 0)
+  {
+    LEDGER_CHILD(child_start, &ru);
+  }
+  MEM_CHILD(rv > 0 ? &ru : NULL);
+
+  if (rv > 0)
+  {
+    if (WIFEXITED(status) == 1)
+    {
+      return_status = WEXITSTATUS(status);
+      if (return_status == 127) {
+        fprintf(stderr, "execl() failed\n");
+      }
+    } else {
+      fprintf(stderr, "the program did not terminate normally\n");
+    }
+  } else {
+    fprintf(stderr, "waitpid() failed\n");
+  }
+
+  return return_status;
+}
+
 /**
  * like system() but it returns the exit code of the
  * given command rather than that of the forked shell
@@ -34,37 +79,76 @@
 
 int system_return(const char *command)
 {
-  int status;
-  int return_status = 127;
-  pid_t pid = fork();
+  pid_t pid;
+
+  TRACE_BEGIN("fork/exec");
+  child_start = trace_clock();
+  pid = fork();
 
   if (pid == 0)
   {
     execl("/bin/sh", "sh", "-c", command, (char *)NULL);
     _exit(127);  /* if execl() was successful, this won't be reached */
   }
+  TRACE_END();
 
-  if (pid > 0)
+  if (pid < 0)
   {
-    if (waitpid(pid, &status, 0) > 0)
-    {
-      if (WIFEXITED(status) == 1)
-      {
-        return_status = WEXITSTATUS(status);
-        if (return_status == 127) {
-          fprintf(stderr, "execl() failed\n");
-        }
-      } else {
-        fprintf(stderr, "the program did not terminate normally\n");
-      }
-    } else {
-      fprintf(stderr, "waitpid() failed\n");
-    }
-  } else {
     fprintf(stderr, "failed to fork()\n");
+    return 127;
   }
 
-  return return_status;
+  return wait_return(pid);
+}
+
+/**
+ * start the program at path directly with the given argument vector
+ * and environment (no shell involved); stdout and stderr are redirected
+ * to out_fd and err_fd unless they are -1; returns the pid or -1
+ */
+
+pid_t spawn_start(const char *path, char *const argv[], char *const envp[], int out_fd, int err_fd)
+{
+  pid_t pid;
+  posix_spawn_file_actions_t actions;
+
+  posix_spawn_file_actions_init(&actions);
+  if (out_fd != -1) {
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+  }
+  if (err_fd != -1) {
+    posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+  }
+
+  TRACE_BEGIN("spawn");
+  child_start = trace_clock();
+  int rv = posix_spawn(&pid, path, &actions, NULL, argv, envp);
+  TRACE_END();
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (rv != 0)
+  {
+    fprintf(stderr, "posix_spawn() failed: %s: %s\n", path, strerror(rv));
+    return -1;
+  }
+
+  return pid;
+}
+
+/**
+ * run the program at path directly and return its exit code
+ */
+
+int spawn_return(const char *path, char *const argv[], char *const envp[])
+{
+  pid_t pid = spawn_start(path, argv, envp, -1, -1);
+
+  if (pid < 0)
+  {
+    return 127;
+  }
+
+  return wait_return(pid);
 }
 
 /*
@@ -36,3 +36,16 @@ for m in 32 64 ; do
   ./$exe
 done
 
+
+echo ""
+echo "=== Testing response files ==="
+printf -- "-Wall -O0 '-Wcl,/EHsc'\n" > ${tst}.rsp
+GCC2MSVC_RSP_LIMIT=0 ./gcc2msvc --verbose @${tst}.rsp ${tst}.cpp -o ${tst}.rsp.exe
+./${tst}.rsp.exe
+
+
+echo ""
+echo "=== Testing dependency files ==="
+./gcc2msvc -MMD -MP -Wcl,/EHsc -c ${tst}.cpp -o ${tst}.dep.obj
+cat ${tst}.dep.d
+grep -q "^${tst}.dep.obj: ${tst}.cpp" ${tst}.dep.d
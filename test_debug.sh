@@ -0,0 +1,58 @@
+#!/bin/sh
+# checks the debug info options with the stand-in toolchain in
+# bench/fake (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+unset MAKEFLAGS GCC2MSVC_DEBUG_FORMAT
+rm -f tmp_debug.*
+
+cmd()
+{
+  ./gcc2msvc --print-only "$@" > tmp_debug.out
+}
+
+# a single compile: a PDB of its own
+cmd -g -c tmp_debug.c -o tmp_debug.d/x.obj
+grep -q " /Zi /FS /Fdtmp_debug.d/x.pdb$" tmp_debug.out
+cmd -g -c tmp_debug.c
+grep -q " /Zi /FS /Fdtmp_debug.pdb$" tmp_debug.out
+
+# parallel builds and compile + link: in the objects
+cmd -g -c tmp_debug.c tmp_debug2.c
+grep -q " /Z7$" tmp_debug.out
+mkfifo tmp_debug.fifo
+MAKEFLAGS=" -j4 --jobserver-auth=fifo:$PWD/tmp_debug.fifo" cmd -g -c tmp_debug.c
+grep -q " /Z7$" tmp_debug.out
+cmd -g tmp_debug.c -o tmp_debug.exe
+grep -q " /Z7 /link .* /DEBUG:FULL$" tmp_debug.out
+GCC2MSVC_DEBUG_FORMAT=zi cmd -g -c tmp_debug.c tmp_debug2.c
+grep -q " /Zi /FS$" tmp_debug.out
+cmd --debug-format=z7 -g -c tmp_debug.c
+grep -q " /Z7$" tmp_debug.out
+
+# a link of objects: incremental when it can be
+cmd -g tmp_debug.obj -o tmp_debug.exe
+grep -q "link.exe .* /DEBUG:FASTLINK tmp_debug.obj$" tmp_debug.out
+if grep -q "/DEBUG:FULL" tmp_debug.out; then exit 1; fi
+cmd -g -flto tmp_debug.obj -o tmp_debug.exe
+grep -q "link.exe .* /DEBUG:FULL tmp_debug.obj$" tmp_debug.out
+
+# -g1 and -gsplit-dwarf: /DEBUG:FASTLINK, also for a link of objects
+cmd -g1 tmp_debug.c -o tmp_debug.exe
+grep -q " /Z7 /link .* /DEBUG:FASTLINK$" tmp_debug.out
+cmd -gline-tables-only tmp_debug.obj -o tmp_debug.exe
+grep -q "link.exe .* /DEBUG:FASTLINK tmp_debug.obj$" tmp_debug.out
+cmd -g -gsplit-dwarf tmp_debug.obj -o tmp_debug.exe
+grep -q "link.exe .* /DEBUG:FASTLINK tmp_debug.obj$" tmp_debug.out
+
+# -g0 turns it off, -gsplit-dwarf alone doesn't turn it on
+cmd -g -g0 -c tmp_debug.c
+if grep -q "/Z[i7]" tmp_debug.out; then exit 1; fi
+cmd -gsplit-dwarf tmp_debug.c -o tmp_debug.exe
+if grep -q "/Z[i7]\|/DEBUG" tmp_debug.out; then exit 1; fi
+
+rm -f tmp_debug.*
+echo ">> SUCCESS"
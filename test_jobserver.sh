@@ -0,0 +1,29 @@
+#!/bin/sh
+# checks that parallel compiles take exactly the job slots make grants,
+# using the stand-in toolchain in bench/fake (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_CL_SLEEP=0.3
+export FAKE_CL_LOG="$PWD/tmp_jobserver.log"
+
+{
+  echo "all: one two"
+  echo "one:"
+  printf '\t+@./gcc2msvc -j8 -c a1.c a2.c a3.c a4.c a5.c a6.c\n'
+  echo "two:"
+  printf '\t+@./gcc2msvc -j8 -c b1.c b2.c b3.c b4.c b5.c b6.c\n'
+} > tmp_jobserver.mk
+
+for slots in 1 2 4 ; do
+  : > "$FAKE_CL_LOG"
+  make -s -j$slots -f tmp_jobserver.mk
+  max=$(awk '/^start/ { if (++n > m) m = n } /^end/ { n-- } END { print m }' "$FAKE_CL_LOG")
+  echo "make -j$slots: at most $max cl.exe processes at once"
+  test "$max" -eq $slots
+done
+
+rm -f tmp_jobserver.*
+echo ">> SUCCESS"
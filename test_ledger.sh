@@ -0,0 +1,34 @@
+#!/bin/sh
+# checks the ledger (GCC2MSVC_LEDGER) and gcc2msvc-report with the
+# stand-in toolchain in bench/fake (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export GCC2MSVC_LEDGER="$PWD/tmp_ledger.bin"
+
+rm -f tmp_ledger.* tmp_ledger?.*
+for i in 1 2 3; do echo "int x$i;" > tmp_ledger$i.c; done
+
+# four invocations, one of them running two cl.exe and one failing
+FAKE_CL_SLEEP=0.3 ./gcc2msvc -c tmp_ledger1.c -o tmp_ledger1.obj
+./gcc2msvc -O2 -j2 -c tmp_ledger2.c tmp_ledger3.c
+FAKE_CL_EXIT=2 ./gcc2msvc -O2 -c tmp_ledger3.c > /dev/null 2>&1 || true
+./gcc2msvc --ledger="$PWD/tmp_ledger.bin" tmp_ledger1.obj tmp_ledger2.obj -o tmp_ledger.exe
+
+# ... and one that doesn't count
+./gcc2msvc --print-only -c tmp_ledger1.c > /dev/null
+
+test "$(wc -c < tmp_ledger.bin)" = 1024
+test "$(wc -l < tmp_ledger.bin.flags)" = 3
+grep -q " /O2 /Ot /c$" tmp_ledger.bin.flags
+
+./gcc2msvc-report -n 3 tmp_ledger.bin > tmp_ledger.out
+grep -q "4 invocations (1 failed), 1 builds" tmp_ledger.out
+grep -q "critical path: .*, 4 invocations" tmp_ledger.out
+grep -q "0\.[34].s  .*/tmp_ledger1.c$" tmp_ledger.out
+grep -q "2  .*  /O2 /Ot /c$" tmp_ledger.out
+
+rm -f tmp_ledger.* tmp_ledger?.*
+echo ">> SUCCESS"
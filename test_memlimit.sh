@@ -0,0 +1,51 @@
+#!/bin/sh
+# checks --mem-limit with the stand-in toolchain in bench/fake, whose
+# cl.exe uses FAKE_CL_MEM MiB of memory (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_mem.log"
+export FAKE_CL_LOG="$PWD/tmp_mem.order"
+export GCC2MSVC_CACHE_DIR="$PWD/tmp_mem.cache"
+
+rm -rf tmp_mem*
+for i in 1 2; do echo "int x$i;" > tmp_mem$i.c; done
+
+# unknown tools are expected to need 512M; the peaks are learned
+FAKE_CL_MEM=40 ./gcc2msvc --mem-limit=4G -c tmp_mem1.c
+FAKE_CL_MEM=40 ./gcc2msvc --mem-limit=4G -c tmp_mem2.c
+test -f tmp_mem.cache/mem.db
+
+# ~45M each: two fit in 200M ...
+overlap()
+{
+  : > "$FAKE_CL_LOG"
+  FAKE_CL_MEM=40 FAKE_CL_SLEEP=0.5 ./gcc2msvc "$@" -c tmp_mem1.c &
+  FAKE_CL_MEM=40 FAKE_CL_SLEEP=0.5 ./gcc2msvc "$@" -c tmp_mem2.c
+  wait
+  test "$(sed -n 2p "$FAKE_CL_LOG" | cut -d' ' -f1)" = start
+}
+overlap --mem-limit=200M
+
+# ... but not in 60M, the second one waits for the first
+if overlap --mem-limit=60M; then exit 1; fi
+test "$(cut -d' ' -f1 "$FAKE_CL_LOG" | tr '\n' ' ')" = "start end start end "
+
+# the same for the jobs of one invocation (not under make, where it
+# would be one cl.exe for both), through GCC2MSVC_MEM_LIMIT
+: > "$FAKE_CL_LOG"
+env -u MAKEFLAGS FAKE_CL_MEM=40 FAKE_CL_SLEEP=0.3 GCC2MSVC_MEM_LIMIT=60M ./gcc2msvc -j2 -c tmp_mem1.c tmp_mem2.c
+test "$(cut -d' ' -f1 "$FAKE_CL_LOG" | tr '\n' ' ')" = "start end start end "
+
+# a large job using a precompiled header gets /Zm
+FAKE_CL_MEM=200 ./gcc2msvc --mem-limit=4G -Wcl,/Yupch.h -c tmp_mem1.c
+: > "$FAKE_ARGV_LOG"
+./gcc2msvc --mem-limit=4G -Wcl,/Yupch.h -c tmp_mem1.c
+grep -q "^cl.exe /Zm[0-9]* " "$FAKE_ARGV_LOG"
+./gcc2msvc --mem-limit=4G -c tmp_mem2.c
+if grep -q "/Zm.* tmp_mem2.c" "$FAKE_ARGV_LOG"; then exit 1; fi
+
+rm -rf tmp_mem*
+echo ">> SUCCESS"
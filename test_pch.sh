@@ -0,0 +1,65 @@
+#!/bin/sh
+# checks --pch with the stand-in toolchain in bench/fake (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_pch.log"
+export GCC2MSVC_PCH_DIR=tmp_pch.d GCC2MSVC_PCH_MIN=1
+export WSL_DISTRO_NAME=Ubuntu
+unset MAKEFLAGS GCC2MSVC_DEBUG_FORMAT GCC2MSVC_STAGE
+
+rm -rf tmp_pch.*
+echo 'int x;' > tmp_pch.h
+echo 'int main(void) { return x; }' > tmp_pch.c
+
+# a header compiled like GCC does is used by -include of its absolute path
+./gcc2msvc --pch -c "$PWD/tmp_pch.h"
+test -f tmp_pch.h.gch
+test -f tmp_pch.h.gch.key
+: > tmp_pch.log
+./gcc2msvc --pch -c -include "$PWD/tmp_pch.h" tmp_pch.c
+grep -q "^cl.exe .*/Yu.*tmp_pch.h /Fp.*tmp_pch.h.gch " tmp_pch.log
+if grep -q "/Yc" tmp_pch.log; then exit 1; fi
+
+# the language: -x, otherwise g++ compiles C++ and gcc C
+: > tmp_pch.log
+./gcc2msvc --pch -x c++-header -c tmp_pch.h -o tmp_pch.x.gch
+grep -q "^cl.exe .*/TP .*/Yctmp_pch.h .*stub[0-9]*\.cpp$" tmp_pch.log
+ln -s "$PWD/gcc2msvc" tmp_pch.g++
+: > tmp_pch.log
+./tmp_pch.g++ --pch -c tmp_pch.h -o tmp_pch.x.gch
+grep -q "^cl.exe .*/Yctmp_pch.h .*stub[0-9]*\.cpp$" tmp_pch.log
+: > tmp_pch.log
+./gcc2msvc --pch -c tmp_pch.h -o tmp_pch.x.gch
+grep -q "^cl.exe .*/Yctmp_pch.h .*stub[0-9]*\.c$" tmp_pch.log
+
+# with debug info the header is compiled with /Z7, its object is kept
+# and linked into a program using it
+: > tmp_pch.log
+./gcc2msvc --pch -g -c "$PWD/tmp_pch.h"
+grep -q "^cl.exe .* /Z7 .*/Yc.*tmp_pch.h" tmp_pch.log
+if grep -q "/Zi\|/FS" tmp_pch.log; then exit 1; fi
+test -f tmp_pch.h.gch.obj
+: > tmp_pch.log
+./gcc2msvc --pch -g -include "$PWD/tmp_pch.h" tmp_pch.c -o tmp_pch.exe
+grep -q "^cl.exe .*/Yu.*tmp_pch.h /Fp.*tmp_pch.h.gch .* /Z7 .*tmp_pch.h.gch.obj /link" tmp_pch.log
+if grep -q "/Yc" tmp_pch.log; then exit 1; fi
+rm -f tmp_pch.h.gch*
+
+# /Z7: the PCH's object is linked in
+: > tmp_pch.log
+./gcc2msvc --pch -g -include tmp_pch.h tmp_pch.c -o tmp_pch.exe
+grep -q "^cl.exe .*/Yctmp_pch.h" tmp_pch.log
+grep -q "^cl.exe .*/Yutmp_pch.h .* /Z7 tmp_pch.d/.*/pch.obj /link" tmp_pch.log
+test -f tmp_pch.d/*/*/pch.obj
+
+# debug info and -c: no PCH, but a warning
+: > tmp_pch.log
+./gcc2msvc --pch -g -c -include tmp_pch.h tmp_pch.c 2> tmp_pch.err
+grep -q "not using a precompiled header" tmp_pch.err
+if grep -q "/Yu" tmp_pch.log; then exit 1; fi
+
+rm -rf tmp_pch.*
+echo ">> SUCCESS"
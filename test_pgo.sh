@@ -0,0 +1,49 @@
+#!/bin/sh
+# checks the PGO flags and the handling of .pgd/.pgc files with the
+# stand-in toolchain in bench/fake (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_pgo.log"
+dir=tmp_pgo.d
+
+rm -rf tmp_pgo.* tmp_pgo2.* $dir
+echo "int main(void) { return 0; }" > tmp_pgo.c
+
+# instrumented build: /GL, /LTCG and /GENPROFILE with exact counters
+./gcc2msvc -fprofile-generate=$dir -fprofile-update=atomic -O2 -c tmp_pgo.c -o tmp_pgo.obj
+./gcc2msvc -fprofile-generate=$dir tmp_pgo.obj -o tmp_pgo.exe
+./gcc2msvc -fprofile-generate=$dir -fprofile-update=atomic tmp_pgo.c -o tmp_pgo2.exe
+grep -q "^cl.exe /GL .*/c " "$FAKE_ARGV_LOG"
+grep -q "^link.exe .*/LTCG /GENPROFILE:PGD=$dir/tmp_pgo.pgd" "$FAKE_ARGV_LOG"
+grep -q "^cl.exe .*/LTCG /GENPROFILE:EXACT,PGD=$dir/tmp_pgo2.pgd" "$FAKE_ARGV_LOG"
+test -f $dir/tmp_pgo.pgd
+
+# two training runs
+echo "run1" > "$dir/tmp_pgo!1.pgc"
+echo "run2" > "$dir/tmp_pgo!2.pgc"
+
+# optimized build: the runs are merged once, then used
+./gcc2msvc -fprofile-use=$dir tmp_pgo.obj -o tmp_pgo.exe
+grep -q "^pgomgr.exe /merge $dir/tmp_pgo.pgd" "$FAKE_ARGV_LOG"
+grep -q "^link.exe .*/LTCG /USEPROFILE:PGD=$dir/tmp_pgo.pgd" "$FAKE_ARGV_LOG"
+test "$(cat $dir/tmp_pgo.pgd)" = "$(printf 'pgd\nrun1\nrun2')"
+test -f "$dir/merged/tmp_pgo!1.pgc" -a ! -f "$dir/tmp_pgo!1.pgc"
+
+: > "$FAKE_ARGV_LOG"
+./gcc2msvc -fprofile-use=$dir tmp_pgo.obj -o tmp_pgo.exe
+if grep -q "^pgomgr.exe" "$FAKE_ARGV_LOG"; then exit 1; fi
+
+# a new instrumented link drops counts of the old program
+echo "old" > "$dir/tmp_pgo!3.pgc"
+./gcc2msvc -fprofile-generate=$dir tmp_pgo.obj -o tmp_pgo.exe
+test ! -f "$dir/tmp_pgo!3.pgc"
+
+# no profile data: linked without /USEPROFILE
+./gcc2msvc -fprofile-use=tmp_pgo.none tmp_pgo.obj -o tmp_pgo.exe 2> tmp_pgo.err
+grep -q "not found" tmp_pgo.err
+
+rm -rf tmp_pgo.* tmp_pgo2.* $dir
+echo ">> SUCCESS"
@@ -0,0 +1,86 @@
+#!/bin/sh
+# checks --pool with the stand-in toolchain in bench/fake (runs on Linux):
+# one cmd.exe for several invocations, exit codes and output, recycling,
+# replacing a dead cmd.exe and falling back when the slot is busy
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_pool.log"
+export GCC2MSVC_POOL_DIR="$PWD/tmp_pool.d"
+dir=tmp_pool.d
+
+stop_pool()
+{
+  for f in $dir/*.lock; do
+    [ -f "$f" ] || continue
+    pid=$(cut -d' ' -f1 "$f")
+    [ "$pid" -gt 0 ] && kill "$pid" 2>/dev/null || true
+  done
+}
+cmd_pid()
+{
+  cut -d' ' -f1 $lock
+}
+
+stop_pool
+rm -rf tmp_pool.* $dir
+echo "int x;" > tmp_pool.c
+trap stop_pool EXIT
+
+# three compiles, one cmd.exe
+./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj
+lock=$(ls $dir/*-0.lock)
+pid=$(cmd_pid)
+./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj
+./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj
+test "$(cmd_pid)" = "$pid"
+test "$(grep -c '^cmd.exe< cd /d .* && .*cl.exe /c tmp_pool.c' "$FAKE_ARGV_LOG")" = 3
+test -f tmp_pool.obj
+
+# exit code, stdout and stderr of the tool; a variable passed on to
+# Windows means another cmd.exe
+rc=0
+WSLENV=FAKE_CL_EXIT FAKE_CL_EXIT=2 ./gcc2msvc --pool=2 -c tmp_pool.c > tmp_pool.out 2> tmp_pool.err || rc=$?
+test $rc = 2
+grep -q "^tmp_pool.c" tmp_pool.out
+grep -q "error C2059" tmp_pool.err
+if grep -q "gcc2msvc-pool" tmp_pool.out tmp_pool.err; then exit 1; fi
+test "$(cmd_pid)" = "$pid"
+
+# recycled after GCC2MSVC_POOL_JOBS jobs
+GCC2MSVC_POOL_JOBS=4 ./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj
+test "$(cmd_pid)" = 0
+./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj
+test "$(cmd_pid)" != 0 && test "$(cmd_pid)" != "$pid"
+
+# a dead cmd.exe is replaced
+pid=$(cmd_pid)
+kill $pid
+./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj
+test "$(cmd_pid)" != "$pid"
+
+# all slots busy: cl.exe is run directly
+: > "$FAKE_ARGV_LOG"
+flock $lock ./gcc2msvc --pool=1 -c tmp_pool.c -o tmp_pool.obj
+grep -q "^cl.exe /c tmp_pool.c" "$FAKE_ARGV_LOG"
+if grep -q "^cmd.exe" "$FAKE_ARGV_LOG"; then exit 1; fi
+
+# --shell goes through the pool as well
+: > "$FAKE_ARGV_LOG"
+./gcc2msvc --shell --pool=2 -c tmp_pool.c -o tmp_pool.obj
+grep -q "^cmd.exe< cd /d .* && .*cl.exe /c tmp_pool.c" "$FAKE_ARGV_LOG"
+if grep -q "^cmd.exe /C" "$FAKE_ARGV_LOG"; then exit 1; fi
+
+# cmd.exe would end the quoting at \" and expand %VAR%: run directly
+for d in '-DS="a&b"' '-DP=%PATH%'; do
+  : > "$FAKE_ARGV_LOG"
+  ./gcc2msvc --pool=2 -c tmp_pool.c -o tmp_pool.obj "$d"
+  grep -qF "cl.exe /c tmp_pool.c /D${d#-D} " "$FAKE_ARGV_LOG"
+  if grep -q "^cmd.exe" "$FAKE_ARGV_LOG"; then exit 1; fi
+done
+
+stop_pool
+rm -rf tmp_pool.* $dir
+echo ">> SUCCESS"
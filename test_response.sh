@@ -0,0 +1,43 @@
+#!/bin/sh
+# checks that long command lines go into response files on every path
+# that starts cl.exe, with the stand-in toolchain in bench/fake (runs
+# on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_response.log"
+export GCC2MSVC_RSP_LIMIT=100
+unset MAKEFLAGS GCC2MSVC_CACHE GCC2MSVC_STAGE
+
+rm -rf tmp_response*
+mkdir tmp_response.d
+echo "int a(void) { return 0; }" > tmp_response.d/a.c
+echo "int b(void) { return 0; }" > tmp_response.d/b.c
+
+check()
+{
+  test "$(grep -c "^cl.exe " tmp_response.log)" = "$1"
+  if grep "^cl.exe " tmp_response.log | grep -qv "^cl.exe @gcc2msvc-[0-9]*\.rsp$"; then
+    exit 1
+  fi
+  test "$(ls gcc2msvc-*.rsp 2> /dev/null | wc -l)" = 0
+}
+
+# one cl.exe per source
+: > tmp_response.log
+./gcc2msvc -j2 -c tmp_response.d/a.c tmp_response.d/b.c -Itmp_response.d
+check 2
+test -f a.obj -a -f b.obj
+rm -f a.obj b.obj
+
+# the object cache: the preprocessor run and the compile
+: > tmp_response.log
+GCC2MSVC_CACHE=1 GCC2MSVC_CACHE_DIR="$PWD/tmp_response.cache" \
+  ./gcc2msvc -c tmp_response.d/a.c -o tmp_response.obj
+check 2
+test -f tmp_response.obj
+
+rm -rf tmp_response* a.obj b.obj
+echo ">> SUCCESS"
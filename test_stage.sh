@@ -0,0 +1,95 @@
+#!/bin/sh
+# checks --stage with the stand-in toolchain in bench/fake (runs on
+# Linux, where nothing is on a windows drive, so every input is staged)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_stage.log"
+unset MAKEFLAGS GCC2MSVC_STAGE WSL_DISTRO_NAME
+
+stage="$PWD/tmp_stage.d"
+src="$PWD/tmp_stage.src"
+tree="$stage/tree$src"
+
+rm -rf "$stage" "$src" tmp_stage.log
+mkdir -p "$src/gen" "$src/inc"
+printf '#include "gen.h"\n  #  include <inc.h>\nint main(void) { return 0; }\n' > "$src/gen/main.c"
+printf '#include "../other.h"\n#include "missing.h"\n' > "$src/gen/gen.h"
+echo '/* other */' > "$src/other.h"
+echo '/* inc */' > "$src/inc/inc.h"
+echo '/* forced */' > "$src/forced.h"
+
+build()
+{
+  : > tmp_stage.log
+  ./gcc2msvc "$@" -c tmp_stage.src/gen/main.c -Itmp_stage.src/inc -include tmp_stage.src/forced.h \
+    -o tmp_stage.obj
+}
+
+# cl.exe gets the mirrors, which hold the sources and what they include
+build --stage="$stage"
+grep -qF " /I.$tree/inc " tmp_stage.log
+grep -qF " /FI.$tree/forced.h " tmp_stage.log
+grep -qF " .$tree/gen/main.c " tmp_stage.log
+for f in gen/main.c gen/gen.h other.h inc/inc.h forced.h; do
+  cmp "$src/$f" "$tree/$f"
+  test "$(stat -c %h "$tree/$f")" = 2
+done
+test "$(ls "$stage"/objects/*/* | wc -l)" = 5
+lines=$(wc -l < "$stage/index")
+ino=$(stat -c %i "$tree/gen/gen.h")
+
+# nothing changed: nothing is copied or linked again
+GCC2MSVC_STAGE="$stage" build
+test "$(wc -l < "$stage/index")" = "$lines"
+test "$(stat -c %i "$tree/gen/gen.h")" = "$ino"
+
+# a changed header is copied, the same content again is only linked
+cp "$src/gen/gen.h" tmp_stage.old
+echo '/* changed */' >> "$src/gen/gen.h"
+build --stage="$stage"
+cmp "$src/gen/gen.h" "$tree/gen/gen.h"
+test "$(ls "$stage"/objects/*/* | wc -l)" = 6
+cp tmp_stage.old "$src/gen/gen.h"
+build --stage="$stage"
+test "$(stat -c %i "$tree/gen/gen.h")" = "$ino"
+test "$(ls "$stage"/objects/*/* | wc -l)" = 6
+
+# touched but the same: hashed, not copied
+touch "$src/other.h"
+ino=$(stat -c %i "$tree/other.h")
+build --stage="$stage"
+test "$(stat -c %i "$tree/other.h")" = "$ino"
+
+# off: --stage=unc, and --print-only stages nothing
+build --stage=unc
+grep -qF " /Itmp_stage.src/inc " tmp_stage.log
+rm -rf "$stage"
+./gcc2msvc --print-only --stage="$stage" -c tmp_stage.src/gen/main.c > /dev/null
+test ! -e "$stage"
+
+# --batch stages only the entries it runs
+printf '[{"directory": "%s", "file": "tmp_stage.src/gen/main.c", "arguments": ["gcc", "--stage=%s", "-c", "tmp_stage.src/gen/main.c", "-o", "tmp_stage.obj"]}]\n' \
+  "$PWD" "$stage" > tmp_stage.json
+./gcc2msvc --batch=tmp_stage.json --output=tmp_stage.out
+test ! -e "$stage"
+./gcc2msvc --batch=tmp_stage.json --output=tmp_stage.out --run
+cmp "$src/gen/main.c" "$tree/gen/main.c"
+rm -rf "$stage"
+
+# the default: a source in /tmp is passed as \\wsl$\<distro>\..., which
+# cl.exe doesn't take for an option
+tmp=$(mktemp -d /tmp/gcc2msvc-stage.XXXXXX)
+echo 'int main(void) { return 0; }' > "$tmp/m.c"
+WSL_DISTRO_NAME=Ubuntu ./gcc2msvc --print-only -c "$tmp/m.c" -include "$tmp/m.c" -o "$tmp/m.obj" \
+  > tmp_stage.out
+unc="\\\\wsl\$\\Ubuntu$(printf '%s' "$tmp" | tr / '\\\\')"
+grep -qF "cl.exe /c $unc\\m.c /FI$unc\\m.c " tmp_stage.out
+grep -qF " /Fo$unc\\m.obj" tmp_stage.out
+rm -rf "$tmp"
+
+rm -rf "$stage" "$src"
+rm -f tmp_stage.*
+echo ">> SUCCESS"
@@ -0,0 +1,55 @@
+#!/bin/sh
+# checks -ftime-trace with the stand-in toolchain in bench/fake, whose
+# cl.exe writes made up timing reports (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_timetrace.log"
+
+rm -rf tmp_timetrace*
+echo "int main(void) { return 0; }" > tmp_timetrace1.c
+echo "int f(void) { return 1; }" > tmp_timetrace2.c
+
+# next to the object, the reports taken out of cl.exe's output
+./gcc2msvc -ftime-trace -O2 -c tmp_timetrace1.c -o tmp_timetrace1.obj > tmp_timetrace.out
+grep -q "^cl.exe /Bt+ /d1reportTime /d2cgsummary .*/c " "$FAKE_ARGV_LOG"
+grep -q "tmp_timetrace1.c" tmp_timetrace.out
+if grep -q "Include Headers\|time(\|instrs" tmp_timetrace.out; then exit 1; fi
+f=tmp_timetrace1.json
+grep -q '"ts":0,"dur":250000,"name":"Frontend"' $f
+grep -q '"ts":250000,"dur":120000,"name":"Backend"' $f
+grep -q '"ts":0,"dur":40000,"name":"Source","args":{"detail":".*vcruntime.h"}' $f
+grep -q '"ts":100000,"dur":50000,"name":"Source","args":{"detail":".*stdlib.h"}' $f
+grep -q '"name":"ParseClass","args":{"detail":"point"}' $f
+grep -q '"name":"ParseFunctionDefinition","args":{"detail":"main"}' $f
+grep -q '"ts":250000,"dur":100000,"name":"CodeGen Function","args":{"detail":"main"}' $f
+grep -q '"name":"Total Source","args":{"count":3,' $f
+if command -v python3 > /dev/null; then python3 -m json.tool $f > /dev/null; fi
+
+# a directory, one cl.exe per source even with -j1, along with -MD
+: > "$FAKE_ARGV_LOG"
+./gcc2msvc -ftime-trace=tmp_timetrace.d -MD -j1 -c tmp_timetrace1.c tmp_timetrace2.c > /dev/null
+test "$(grep -c "^cl.exe /Bt+ .*/showIncludes" "$FAKE_ARGV_LOG")" = 2
+test -f tmp_timetrace.d/tmp_timetrace1.json -a -f tmp_timetrace.d/tmp_timetrace2.json
+test -f tmp_timetrace1.d -a -f tmp_timetrace2.d
+grep -q "^ *tmp_timetrace2.h$" tmp_timetrace2.d
+
+# the notes of a cl.exe in another language
+export FAKE_CL_NOTE="Remarque : inclusion du fichier :"
+GCC2MSVC_SHOWINCLUDES_PREFIX="$FAKE_CL_NOTE" ./gcc2msvc -MD -c tmp_timetrace1.c > tmp_timetrace.out
+grep -q "^ *tmp_timetrace1.h$" tmp_timetrace1.d
+if grep -q "Remarque" tmp_timetrace.out; then exit 1; fi
+unset FAKE_CL_NOTE
+
+# compiled and linked: named after the program
+./gcc2msvc -ftime-trace tmp_timetrace2.c -o tmp_timetrace.exe > /dev/null
+test -f tmp_timetrace.exe-tmp_timetrace2.json
+
+# a failed compile leaves no trace
+FAKE_CL_EXIT=1 ./gcc2msvc -ftime-trace=tmp_timetrace3.json -c tmp_timetrace1.c > /dev/null 2>&1 || true
+test ! -f tmp_timetrace3.json
+
+rm -rf tmp_timetrace*
+echo ">> SUCCESS"
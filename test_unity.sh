@@ -0,0 +1,37 @@
+#!/bin/sh
+# checks --unity with the stand-in toolchain in bench/fake (runs on Linux)
+set -e
+
+fake="$PWD/bench/fake"
+export PATH="$fake:$PATH"
+export CL_PATH="$fake"
+export FAKE_ARGV_LOG="$PWD/tmp_unity.log"
+unset MAKEFLAGS GCC2MSVC_STAGE WSL_DISTRO_NAME
+
+rm -rf tmp_unity*
+mkdir tmp_unity.d
+for f in a b c; do echo "int $f(void) { return 0; }" > tmp_unity.d/$f.c; done
+build()
+{
+  : > tmp_unity.log
+  ./gcc2msvc --unity=3 -j2 -c tmp_unity.d/a.c tmp_unity.d/b.c tmp_unity.d/c.c
+}
+
+# one cl.exe for the code, one for the object of the others, which
+# names the archive the code is put in
+build
+grep -q "^cl.exe .* gcc2msvc-unity-[0-9a-f]*\.c /Foa.obj$" tmp_unity.log
+grep -q "^cl.exe .* gcc2msvc-unity-[0-9a-f]*\.c /Fob.obj$" tmp_unity.log
+test "$(grep -c "^cl.exe" tmp_unity.log)" = 2
+grep -q "^link.exe /lib /nologo /out:.*gcc2msvc-unity-[0-9a-f]*\.lib .*a.obj$" tmp_unity.log
+test -f a.obj -a -f b.obj -a -f c.obj
+ls gcc2msvc-unity-*.lib > /dev/null
+test "$(ls gcc2msvc-unity-*.c* 2> /dev/null | wc -l)" = 0
+
+# the same group gets the same names, so the object cache can find it
+grep -o "gcc2msvc-unity-[0-9a-f]*\.[a-z]*" tmp_unity.log | sort > tmp_unity.names
+build
+grep -o "gcc2msvc-unity-[0-9a-f]*\.[a-z]*" tmp_unity.log | sort | cmp - tmp_unity.names
+
+rm -rf tmp_unity* gcc2msvc-unity-*.lib a.obj b.obj c.obj
+echo ">> SUCCESS"
@@ -0,0 +1,393 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * -ftime-trace: where cl.exe spends its time, as a Chrome trace.
+ *
+ * cl.exe is run with /Bt+ (time of the front end and the back end),
+ * /d1reportTime (time of every header, class and function the front
+ * end parses) and /d2cgsummary (functions the back end was slow on).
+ * Their reports are taken out of its stdout while it runs and written
+ * to a .json file in the format of clang's -ftime-trace, so the tools
+ * made for that (chrome://tracing, Perfetto, ClangBuildAnalyzer) can
+ * be used. cl.exe only reports how long things took, not when, so
+ * headers are laid out one after another within their parent and
+ * classes and functions get a thread of their own.
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+
+enum trace_section {
+  SECTION_INCLUDES,
+  SECTION_CLASSES,
+  SECTION_FUNCTIONS,
+  SECTION_CODEGEN,
+  SECTION_COUNT,
+  SECTION_NONE = SECTION_COUNT
+};
+
+/* event names of clang's -ftime-trace */
+static const char *section_event[SECTION_COUNT] = {
+  "Source",
+  "ParseClass",
+  "ParseFunctionDefinition",
+  "CodeGen Function"
+};
+
+struct trace_entry {
+  std::string name;
+  int depth;
+  int64_t dur;                   /* microseconds */
+};
+
+struct time_trace {
+  std::string file;
+  enum trace_section section;
+  int64_t frontend, backend;     /* from /Bt+ */
+  int64_t start, realtime;       /* when cl.exe was started */
+  std::vector<trace_entry> entries[SECTION_COUNT];
+};
+
+
+static int64_t monotonic_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t seconds_us(const char *str, const char *unit)
+{
+  char *end;
+  double s = strtod(str, &end);
+  if (end == str || strncmp(end, unit, strlen(unit)) != 0 || s < 0)
+  {
+    return -1;
+  }
+  return (int64_t)(s * 1e6 + 0.5);
+}
+
+/* "time(C:\...\c1xx.dll)=0.31253s < 123 - 456 > BB [C:\src\a.cpp]" */
+static bool bt_line(struct time_trace &tt, const std::string &line)
+{
+  size_t close = line.find(")=");
+  if (line.compare(0, 5, "time(") != 0 || close == std::string::npos)
+  {
+    return false;
+  }
+  int64_t us = seconds_us(line.c_str() + close + 2, "s");
+  if (us < 0)
+  {
+    return false;
+  }
+  size_t slash = line.find_last_of("\\/", close);
+  const char *dll = line.c_str() + (slash == std::string::npos ? 5 : slash + 1);
+  if (strncasecmp(dll, "c2", 2) == 0)
+  {
+    tt.backend += us;
+  }
+  else
+  {
+    tt.frontend += us;
+  }
+  return true;
+}
+
+/* an entry of /d1reportTime ("\t\tname: 0.0012s") or /d2cgsummary
+ * ("\t\tname: 1.234 sec, 123 instrs"), nested ones indented further */
+static void entry_line(struct time_trace &tt, const std::string &line, size_t tabs)
+{
+  size_t colon = line.rfind(": ");
+  if (colon == std::string::npos || colon <= tabs)
+  {
+    return;
+  }
+  int64_t us = seconds_us(line.c_str() + colon + 2,
+                          tt.section == SECTION_CODEGEN ? " sec" : "s");
+  if (us < 0)
+  {
+    return;
+  }
+  struct trace_entry e;
+  e.name = line.substr(tabs, colon - tabs);
+  e.depth = tabs - 2;
+  e.dur = us;
+  if (tt.section == SECTION_INCLUDES)
+  {
+    e.name = stage_origin(unix_path(e.name));
+  }
+  tt.entries[tt.section].push_back(e);
+}
+
+/* run_tool_filter() callback, ctx is a struct time_trace */
+bool time_trace_filter(const std::string &raw, void *ctx)
+{
+  struct time_trace &tt = *(struct time_trace *)ctx;
+  size_t end = raw.find_last_not_of("\r\n");
+  std::string line = raw.substr(0, end == std::string::npos ? 0 : end + 1);
+
+  if (bt_line(tt, line))
+  {
+    return true;
+  }
+  if (line == "Include Headers:")
+  {
+    tt.section = SECTION_INCLUDES;
+    return true;
+  }
+  if (line == "Class Definitions:")
+  {
+    tt.section = SECTION_CLASSES;
+    return true;
+  }
+  if (line == "Function Definitions:")
+  {
+    tt.section = SECTION_FUNCTIONS;
+    return true;
+  }
+  if (line == "Code Generation Summary" || line == "RdrReadProc Caching Stats")
+  {
+    tt.section = SECTION_CODEGEN;
+    return true;
+  }
+  if (tt.section == SECTION_NONE)
+  {
+    return false;
+  }
+
+  size_t tabs = line.find_first_not_of('\t');
+  if (line.empty())
+  {
+    /* the reports end with an empty line */
+    tt.section = SECTION_NONE;
+    return true;
+  }
+  if (tabs == 0)
+  {
+    tt.section = SECTION_NONE;
+    return false;
+  }
+  /* one tab: "Count:", "Total:" and the like */
+  if (tabs >= 2 && tabs != std::string::npos)
+  {
+    entry_line(tt, line, tabs);
+  }
+  return true;
+}
+
+static void add_event(std::string &out, const char *name, int tid, int64_t ts, int64_t dur,
+                      const std::string &args)
+{
+  char buf[128];
+  snprintf(buf, sizeof(buf), ",\n{\"pid\":1,\"tid\":%d,\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"name\":",
+           tid, (long long)ts, (long long)dur);
+  out += buf;
+  out += json_quote(name);
+  if (!args.empty())
+  {
+    out += ",\"args\":{" + args + "}";
+  }
+  out += "}";
+}
+
+static void add_name(std::string &out, const char *what, int tid, const std::string &name)
+{
+  out += ",\n{\"pid\":1,\"tid\":" + std::to_string(tid) + ",\"ph\":\"M\",\"ts\":0,\"name\":\"";
+  out += what;
+  out += "\",\"args\":{\"name\":" + json_quote(name) + "}}";
+}
+
+/* sum of the outermost entries of a section */
+static int64_t section_total(const std::vector<trace_entry> &entries)
+{
+  int64_t total = 0;
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    if (entries[i].depth == 0)
+    {
+      total += entries[i].dur;
+    }
+  }
+  return total;
+}
+
+/* the entries of a section one after another from begin, each nested
+ * one within its parent and nothing beyond end */
+static void add_section(std::string &out, const std::vector<trace_entry> &entries,
+                        const char *name, int tid, int64_t begin, int64_t end)
+{
+  std::vector<int64_t> next(1, begin), limit(1, end);   /* per depth */
+
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    const struct trace_entry &e = entries[i];
+    size_t depth = std::min((size_t)std::max(e.depth, 0), next.size() - 1);
+    next.resize(depth + 1);
+    limit.resize(depth + 1);
+
+    int64_t ts = std::min(next[depth], limit[depth]);
+    int64_t dur = std::min(e.dur, limit[depth] - ts);
+    add_event(out, name, tid, ts, dur, "\"detail\":" + json_quote(e.name));
+
+    next[depth] = ts + dur;
+    next.push_back(ts);
+    limit.push_back(ts + dur);
+  }
+}
+
+static bool write_trace(const struct time_trace &tt, const std::string &source, int64_t wall)
+{
+  int64_t frontend = tt.frontend, backend = tt.backend;
+  for (int s = SECTION_INCLUDES; s < SECTION_CODEGEN; ++s)
+  {
+    frontend = std::max(frontend, section_total(tt.entries[s]));
+  }
+  backend = std::max(backend, section_total(tt.entries[SECTION_CODEGEN]));
+  int64_t total = std::max(wall, frontend + backend);
+
+  std::string out = "{\"traceEvents\":[";
+  out += "\n{\"pid\":1,\"tid\":0,\"ph\":\"X\",\"ts\":0,\"dur\":" + std::to_string(total) +
+    ",\"name\":\"ExecuteCompiler\"}";
+  add_event(out, "Frontend", 0, 0, frontend, "");
+  add_section(out, tt.entries[SECTION_INCLUDES], section_event[SECTION_INCLUDES], 0,
+              0, frontend);
+  add_section(out, tt.entries[SECTION_CLASSES], section_event[SECTION_CLASSES], 1,
+              0, frontend);
+  add_section(out, tt.entries[SECTION_FUNCTIONS], section_event[SECTION_FUNCTIONS], 2,
+              0, frontend);
+  add_event(out, "Backend", 0, frontend, backend, "");
+  add_section(out, tt.entries[SECTION_CODEGEN], section_event[SECTION_CODEGEN], 0,
+              frontend, frontend + backend);
+
+  /* clang's "Total ..." events, one thread each */
+  int tid = 3;
+  for (int s = SECTION_INCLUDES; s < SECTION_COUNT; ++s, ++tid)
+  {
+    const std::vector<trace_entry> &e = tt.entries[s];
+    int64_t sum = section_total(e);
+    char args[64];
+    snprintf(args, sizeof(args), "\"count\":%zu,\"avg ms\":%lld", e.size(),
+             (long long)(e.empty() ? 0 : sum / 1000 / (int64_t)e.size()));
+    add_event(out, ("Total " + std::string(section_event[s])).c_str(), tid, 0, sum, args);
+  }
+
+  add_name(out, "process_name", 0, "cl.exe " + source);
+  add_name(out, "thread_name", 0, "cl.exe");
+  add_name(out, "thread_name", 1, "class definitions");
+  add_name(out, "thread_name", 2, "function definitions");
+  out += "],\n\"beginningOfTime\":" + std::to_string(tt.realtime) + "}\n";
+
+  size_t slash = tt.file.rfind('/');
+  if (slash != std::string::npos && slash > 0)
+  {
+    mkdirs(tt.file.substr(0, slash));
+  }
+  std::string tmp = tt.file + ".tmp" + std::to_string(getpid());
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if (fp == NULL)
+  {
+    return false;
+  }
+  bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+  ok = (fclose(fp) == 0) && ok && rename(tmp.c_str(), tt.file.c_str()) == 0;
+  if (!ok)
+  {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+/* where the trace of an object goes: next to it without -ftime-trace=,
+ * else the file given or, for a directory, a file in it */
+std::string time_trace_file(const std::string &where, const std::string &object)
+{
+  size_t slash = object.rfind('/');
+  size_t dot = object.rfind('.');
+  std::string stem = (dot != std::string::npos && (slash == std::string::npos || dot > slash)) ?
+    object.substr(0, dot) : object;
+
+  if (where.empty())
+  {
+    return stem + ".json";
+  }
+  if (where.size() > 5 && where.compare(where.size() - 5, 5, ".json") == 0)
+  {
+    return where;
+  }
+  return where + (where[where.size()-1] == '/' ? "" : "/") +
+    stem.substr(slash == std::string::npos ? 0 : slash + 1) + ".json";
+}
+
+/* adds the timing options to args; the trace is written by time_trace_end() */
+struct time_trace *time_trace_begin(const std::string &file, std::vector<std::string> &args)
+{
+  struct time_trace *tt = new time_trace;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  tt->file = file;
+  tt->section = SECTION_NONE;
+  tt->frontend = tt->backend = 0;
+  tt->realtime = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  tt->start = monotonic_us();
+
+  const char *opts[] = { "/Bt+", "/d1reportTime", "/d2cgsummary" };
+  args.insert(args.begin(), opts, opts + 3);
+  return tt;
+}
+
+/* writes the trace if cl.exe succeeded and frees tt; returns the
+ * exit code to use */
+int time_trace_end(struct time_trace *tt, const std::string &source, int status)
+{
+  if (status == 0 && !write_trace(*tt, source, monotonic_us() - tt->start))
+  {
+    fprintf(stderr, "error: cannot write %s\n", tt->file.c_str());
+    status = 1;
+  }
+  delete tt;
+  return status;
+}
+
+/* compile source with the timing options and write its trace to file */
+int time_trace_compile(const struct tool &cl, const std::vector<std::string> &args,
+                       const std::string &source, const std::string &file)
+{
+  std::vector<std::string> cl_args = args;
+  struct time_trace *tt = time_trace_begin(file, cl_args);
+
+  int rv = run_tool_filter(cl, cl_args, time_trace_filter, tt);
+  return time_trace_end(tt, source, rv);
+}
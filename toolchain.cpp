@@ -0,0 +1,522 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Toolchains found at run time (--toolchain=name).
+ *
+ * Without --toolchain the paths from config.h are used. Otherwise the
+ * Visual Studio installations under the Program Files directories
+ * (GCC2MSVC_PROGRAM_FILES, default "C:/Program Files (x86);C:/Program
+ * Files") are scanned for .../Microsoft Visual Studio/<year>/<edition>/
+ * VC/Tools/MSVC/<version> and the newest Windows 10 SDK. A toolchain
+ * is named vs<year>-<edition>-<version>; --toolchain picks the newest
+ * whose name is the given one or starts with it and a dash ("vs2019",
+ * "vs2022-BuildTools", "auto" for any). With a ":vcvars" suffix the
+ * INCLUDE, LIB and PATH set by the installation's vcvarsall.bat are
+ * used instead of the standard directory layout.
+ *
+ * The result is kept in a snapshot file in the cache directory along
+ * with the mtimes of every directory looked at; as long as none of
+ * them changed (no version installed or removed), later invocations
+ * just read the snapshot and stat those directories.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "gcc2msvc.h"
+
+#define SNAPSHOT_VERSION  "gcc2msvc toolchain 1"
+
+/* a directory whose mtime the snapshot depends on */
+struct stamp {
+  std::string dir;
+  long long mtime;
+};
+
+struct install {
+  std::string name;       /* vs<year>-<edition>-<version> */
+  std::string edition;    /* .../<year>/<edition> */
+  std::string msvc;       /* .../VC/Tools/MSVC/<version> */
+  int year;
+  std::string version;
+};
+
+static std::unordered_map<std::string, struct toolchain> loaded;
+
+
+const struct toolchain &toolchain_builtin()
+{
+  static struct toolchain builtin;
+
+  if (builtin.name.empty())
+  {
+    builtin.name = "config.h";
+    builtin.cl_path_x64 = DEFAULT_CL_PATH_X64;
+    builtin.cl_path_x86 = DEFAULT_CL_PATH_X86;
+    builtin.includes = DEFAULT_INCLUDES;
+    builtin.libpaths_x64 = DEFAULT_LIBPATHS_X64;
+    builtin.libpaths_x86 = DEFAULT_LIBPATHS_X86;
+  }
+  return builtin;
+}
+
+static long long dir_mtime(const std::string &dir)
+{
+  struct stat st;
+  return (stat(dir.c_str(), &st) == 0) ? (long long)st.st_mtime : -1;
+}
+
+/* the subdirectories of dir, recorded in stamps */
+static std::vector<std::string> list_dirs(const std::string &dir, std::vector<struct stamp> &stamps)
+{
+  std::vector<std::string> names;
+  struct stamp s = { dir, dir_mtime(dir) };
+  DIR *d = opendir(dir.c_str());
+
+  stamps.push_back(s);
+  if (d == NULL)
+  {
+    return names;
+  }
+
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    struct stat st;
+    if (e->d_name[0] != '.' && stat((dir + "/" + e->d_name).c_str(), &st) == 0 &&
+        S_ISDIR(st.st_mode))
+    {
+      names.push_back(e->d_name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+/* 14.9 < 14.10 < 14.10.25017 */
+static bool version_less(const std::string &a, const std::string &b)
+{
+  const char *p = a.c_str(), *q = b.c_str();
+
+  for (;;)
+  {
+    char *pe, *qe;
+    unsigned long x = strtoul(p, &pe, 10), y = strtoul(q, &qe, 10);
+    if (x != y)
+    {
+      return x < y;
+    }
+    if (*pe != '.' || *qe != '.')
+    {
+      return *pe != '.' && *qe == '.';
+    }
+    p = pe + 1;
+    q = qe + 1;
+  }
+}
+
+static std::vector<std::string> program_files()
+{
+  const char *env = getenv("GCC2MSVC_PROGRAM_FILES");
+  std::string list = (env != NULL && *env != 0) ? env : "C:/Program Files (x86);C:/Program Files";
+  std::vector<std::string> dirs;
+  size_t pos = 0;
+
+  while (pos <= list.size())
+  {
+    size_t end = list.find(';', pos);
+    if (end == std::string::npos)
+    {
+      end = list.size();
+    }
+    if (end > pos)
+    {
+      dirs.push_back(unix_path(list.substr(pos, end - pos)));
+    }
+    pos = end + 1;
+  }
+  return dirs;
+}
+
+static void find_installs(std::vector<struct install> &installs, std::string &sdk_root,
+                          std::string &sdk_version, std::vector<struct stamp> &stamps)
+{
+  std::vector<std::string> roots = program_files();
+
+  for (size_t r = 0; r < roots.size(); ++r)
+  {
+    std::string vs = roots[r] + "/Microsoft Visual Studio";
+    std::vector<std::string> years = list_dirs(vs, stamps);
+
+    for (size_t y = 0; y < years.size(); ++y)
+    {
+      int year = atoi(years[y].c_str());
+      if (year < 2017)
+      {
+        continue;
+      }
+
+      std::vector<std::string> editions = list_dirs(vs + "/" + years[y], stamps);
+      for (size_t e = 0; e < editions.size(); ++e)
+      {
+        std::string edition = vs + "/" + years[y] + "/" + editions[e];
+        std::vector<std::string> versions = list_dirs(edition + "/VC/Tools/MSVC", stamps);
+
+        for (size_t v = 0; v < versions.size(); ++v)
+        {
+          struct install in;
+          in.name = "vs" + years[y] + "-" + editions[e] + "-" + versions[v];
+          in.edition = edition;
+          in.msvc = edition + "/VC/Tools/MSVC/" + versions[v];
+          in.year = year;
+          in.version = versions[v];
+          installs.push_back(in);
+        }
+      }
+    }
+
+    /* the newest SDK with the C runtime */
+    std::string kits = roots[r] + "/Windows Kits/10";
+    std::vector<std::string> sdks = list_dirs(kits + "/Include", stamps);
+    for (size_t s = 0; s < sdks.size(); ++s)
+    {
+      if (access((kits + "/Include/" + sdks[s] + "/ucrt").c_str(), F_OK) == 0 &&
+          (sdk_version.empty() || version_less(sdk_version, sdks[s])))
+      {
+        sdk_root = kits;
+        sdk_version = sdks[s];
+      }
+    }
+  }
+}
+
+static std::string quoted_list(const char *opt, const std::vector<std::string> &dirs)
+{
+  std::string str;
+  for (size_t i = 0; i < dirs.size(); ++i)
+  {
+    str += (i > 0 ? " " : "") + std::string(opt) + "\"" + win_path(dirs[i].c_str()) + "\"";
+  }
+  return str;
+}
+
+/* the standard layout of an installation */
+static void from_layout(const struct install &in, const std::string &sdk_root,
+                        const std::string &sdk, struct toolchain &tc)
+{
+  std::vector<std::string> inc, lib64, lib32;
+
+  inc.push_back(in.msvc + "/include");
+  lib64.push_back(in.msvc + "/lib/x64");
+  lib32.push_back(in.msvc + "/lib/x86");
+  if (!sdk.empty())
+  {
+    inc.push_back(sdk_root + "/Include/" + sdk + "/shared");
+    inc.push_back(sdk_root + "/Include/" + sdk + "/ucrt");
+    inc.push_back(sdk_root + "/Include/" + sdk + "/um");
+    lib64.push_back(sdk_root + "/Lib/" + sdk + "/ucrt/x64");
+    lib64.push_back(sdk_root + "/Lib/" + sdk + "/um/x64");
+    lib32.push_back(sdk_root + "/Lib/" + sdk + "/ucrt/x86");
+    lib32.push_back(sdk_root + "/Lib/" + sdk + "/um/x86");
+  }
+
+  std::string bin = win_path((in.msvc + "/bin/HostX64").c_str());
+  tc.cl_path_x64 = bin + "/x64";
+  tc.cl_path_x86 = bin + "/x86;" + bin + "/x64";
+  tc.includes = "/I. " + quoted_list("/I", inc);
+  tc.libpaths_x64 = quoted_list("/libpath:", lib64);
+  tc.libpaths_x86 = quoted_list("/libpath:", lib32);
+}
+
+/* split a ; separated list of win32 directories into unix paths */
+static std::vector<std::string> split_list(const std::string &list)
+{
+  std::vector<std::string> dirs;
+  std::stringstream ss(list);
+  std::string dir;
+
+  while (std::getline(ss, dir, ';'))
+  {
+    if (!dir.empty() && dir != "\r")
+    {
+      if (dir[dir.size()-1] == '\r') { dir.erase(dir.size() - 1); }
+      dirs.push_back(unix_path(dir));
+    }
+  }
+  return dirs;
+}
+
+/* INCLUDE, LIB and PATH as set by vcvarsall.bat <arch> */
+static bool run_vcvars(const struct install &in, const char *arch, std::vector<std::string> &inc,
+                       std::vector<std::string> &lib, std::string &cl_dirs)
+{
+  struct tool cmd;
+  cmd.name = "cmd.exe";
+  cmd.path = unix_path("C:/Windows/System32") + "/cmd.exe";
+
+  std::vector<std::string> args;
+  args.push_back("/C");
+  args.push_back("call");
+  args.push_back(win_path((in.edition + "/VC/Auxiliary/Build/vcvarsall.bat").c_str()));
+  args.push_back(arch);
+  args.push_back(">nul");
+  args.push_back("&&");
+  args.push_back("set");
+
+  struct capture cap;
+  cap.echo = false;
+  cap.out_hash = NULL;
+  if (run_tool_capture(cmd, args, cap) != 0)
+  {
+    std::cerr << cap.err;
+    return false;
+  }
+
+  std::stringstream ss(cap.out);
+  std::string line, path;
+  while (std::getline(ss, line))
+  {
+    if (strncasecmp(line.c_str(), "INCLUDE=", 8) == 0) { inc = split_list(line.substr(8)); }
+    else if (strncasecmp(line.c_str(), "LIB=", 4) == 0) { lib = split_list(line.substr(4)); }
+    else if (strncasecmp(line.c_str(), "PATH=", 5) == 0) { path = line.substr(5); }
+  }
+
+  /* the directories on PATH that belong to the installation, those with
+   * cl.exe first and in PATH order: a cross compiling environment (x64_x86)
+   * has the target's cl.exe before the host's */
+  std::vector<std::string> dirs = split_list(path);
+  std::string others;
+  cl_dirs.clear();
+  for (size_t i = 0; i < dirs.size(); ++i)
+  {
+    if (access((dirs[i] + "/cl.exe").c_str(), X_OK) == 0)
+    {
+      cl_dirs += (cl_dirs.empty() ? "" : ";") + win_path(dirs[i].c_str());
+    }
+    else if (dirs[i].compare(0, in.edition.size(), in.edition) == 0)
+    {
+      others += ";" + win_path(dirs[i].c_str());
+    }
+  }
+  if (cl_dirs.empty())
+  {
+    return false;
+  }
+  cl_dirs += others;
+  return !inc.empty();
+}
+
+static bool from_vcvars(const struct install &in, struct toolchain &tc)
+{
+  std::vector<std::string> inc, lib64, lib32;
+
+  if (!run_vcvars(in, "x64", inc, lib64, tc.cl_path_x64) ||
+      !run_vcvars(in, "x64_x86", inc, lib32, tc.cl_path_x86))
+  {
+    return false;
+  }
+  tc.includes = "/I. " + quoted_list("/I", inc);
+  tc.libpaths_x64 = quoted_list("/libpath:", lib64);
+  tc.libpaths_x86 = quoted_list("/libpath:", lib32);
+  return true;
+}
+
+static bool discover(const std::string &request, struct toolchain &tc,
+                     std::vector<struct stamp> &stamps)
+{
+  std::vector<struct install> installs;
+  std::string sdk_root, sdk;
+  std::string name = request;
+  bool vcvars = false;
+
+  if (name.size() > 7 && name.compare(name.size() - 7, 7, ":vcvars") == 0)
+  {
+    name.erase(name.size() - 7);
+    vcvars = true;
+  }
+
+  find_installs(installs, sdk_root, sdk, stamps);
+
+  const struct install *best = NULL;
+  for (size_t i = 0; i < installs.size(); ++i)
+  {
+    const struct install &in = installs[i];
+    if ((name == "auto" || in.name == name ||
+         (in.name.compare(0, name.size(), name) == 0 && in.name[name.size()] == '-')) &&
+        (best == NULL || best->year < in.year ||
+         (best->year == in.year && version_less(best->version, in.version))))
+    {
+      best = &in;
+    }
+  }
+
+  if (best == NULL)
+  {
+    std::cerr << "error: no toolchain `" << request << "' found (see --toolchains)" << std::endl;
+    return false;
+  }
+
+  tc.name = best->name;
+  if (vcvars)
+  {
+    return from_vcvars(*best, tc);
+  }
+  from_layout(*best, sdk_root, sdk, tc);
+  return true;
+}
+
+static std::string snapshot_file(const std::string &name)
+{
+  std::string file = cache_dir() + "/toolchain-";
+  for (size_t i = 0; i < name.size(); ++i)
+  {
+    file += isalnum((unsigned char)name[i]) || name[i] == '-' || name[i] == '.' ? name[i] : '_';
+  }
+  return file;
+}
+
+/* the snapshot if it is there and no directory it depends on changed */
+static bool load_snapshot(const std::string &file, struct toolchain &tc)
+{
+  std::ifstream in(file.c_str());
+  std::string line;
+
+  if (!std::getline(in, line) || line != SNAPSHOT_VERSION)
+  {
+    return false;
+  }
+
+  while (std::getline(in, line))
+  {
+    size_t sp = line.find(' ');
+    std::string key = line.substr(0, sp);
+    std::string value = (sp == std::string::npos) ? "" : line.substr(sp + 1);
+
+    if (key == "stamp")
+    {
+      size_t sp2 = value.find(' ');
+      if (sp2 == std::string::npos ||
+          atoll(value.substr(0, sp2).c_str()) != dir_mtime(value.substr(sp2 + 1)))
+      {
+        return false;
+      }
+    }
+    else if (key == "name")         { tc.name = value;         }
+    else if (key == "cl_path_x64")  { tc.cl_path_x64 = value;  }
+    else if (key == "cl_path_x86")  { tc.cl_path_x86 = value;  }
+    else if (key == "includes")     { tc.includes = value;     }
+    else if (key == "libpaths_x64") { tc.libpaths_x64 = value; }
+    else if (key == "libpaths_x86") { tc.libpaths_x86 = value; }
+  }
+  return !tc.name.empty();
+}
+
+static void save_snapshot(const std::string &file, const struct toolchain &tc,
+                          const std::vector<struct stamp> &stamps)
+{
+  std::string tmp = file + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(tmp.c_str());
+    out << SNAPSHOT_VERSION << "\n";
+    for (size_t i = 0; i < stamps.size(); ++i)
+    {
+      out << "stamp " << stamps[i].mtime << " " << stamps[i].dir << "\n";
+    }
+    out << "name " << tc.name << "\n"
+      << "cl_path_x64 " << tc.cl_path_x64 << "\n"
+      << "cl_path_x86 " << tc.cl_path_x86 << "\n"
+      << "includes " << tc.includes << "\n"
+      << "libpaths_x64 " << tc.libpaths_x64 << "\n"
+      << "libpaths_x86 " << tc.libpaths_x86 << "\n";
+    if (!out)
+    {
+      unlink(tmp.c_str());
+      return;
+    }
+  }
+  rename(tmp.c_str(), file.c_str());
+}
+
+/* the toolchain called name, from its snapshot or found again;
+ * NULL if there is none */
+const struct toolchain *toolchain_get(const std::string &name)
+{
+  std::unordered_map<std::string, struct toolchain>::iterator it = loaded.find(name);
+  if (it != loaded.end())
+  {
+    return &it->second;
+  }
+
+  struct toolchain tc;
+  std::string file = snapshot_file(name);
+
+  if (!load_snapshot(file, tc))
+  {
+    std::vector<struct stamp> stamps;
+    tc = toolchain();
+    if (!discover(name, tc, stamps))
+    {
+      return NULL;
+    }
+    if (mkdirs(cache_dir()))
+    {
+      save_snapshot(file, tc, stamps);
+    }
+  }
+  return &(loaded[name] = tc);
+}
+
+/* print every installation that was found */
+int toolchain_list()
+{
+  std::vector<struct install> installs;
+  std::vector<struct stamp> stamps;
+  std::string sdk_root, sdk;
+
+  find_installs(installs, sdk_root, sdk, stamps);
+  for (size_t i = 0; i < installs.size(); ++i)
+  {
+    std::cout << installs[i].name << "  " << win_path(installs[i].msvc.c_str()) << std::endl;
+  }
+  if (!sdk.empty())
+  {
+    std::cout << "Windows SDK " << sdk << "  " << win_path(sdk_root.c_str()) << std::endl;
+  }
+  return installs.empty() ? 1 : 0;
+}
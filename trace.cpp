@@ -0,0 +1,192 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * --trace=file.json: Chrome trace events of what the driver spends its
+ * time on, viewable with Perfetto or chrome://tracing.
+ *
+ * Every invocation is a process track of its own (pid) and appends its
+ * events to the file in a single write when it is done, so all
+ * invocations of a `make -j' run can share one file. Timestamps come
+ * from CLOCK_MONOTONIC and line up across processes. The file is a
+ * JSON array without the closing bracket, which the trace viewers
+ * allow for exactly this purpose.
+ *
+ * When tracing is off, each trace point costs one test of trace_on.
+ */
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "trace.h"
+
+int trace_on = 0;
+
+static std::string trace_file;
+static std::string trace_buf;
+static std::vector<const char *> trace_stack;
+static pid_t trace_pid;
+
+
+long long trace_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void add_event(const char *name, char ph, int track, long long ts, long long dur)
+{
+  char buf[160];
+
+  trace_buf += "{\"name\": ";
+  trace_buf += json_quote(name);
+  snprintf(buf, sizeof(buf), ", \"cat\": \"gcc2msvc\", \"ph\": \"%c\", \"ts\": %lld, ", ph, ts);
+  trace_buf += buf;
+  if (ph == 'X')
+  {
+    snprintf(buf, sizeof(buf), "\"dur\": %lld, ", dur);
+    trace_buf += buf;
+  }
+  snprintf(buf, sizeof(buf), "\"pid\": %d, \"tid\": %d},\n", (int)trace_pid,
+           track ? track : (int)trace_pid);
+  trace_buf += buf;
+}
+
+/* the process track is named after the invocation's arguments */
+void trace_init(const char *file, int argc, char **argv)
+{
+  std::string name = "gcc2msvc";
+
+  trace_file = file;
+  trace_pid = getpid();
+  trace_buf.reserve(4096);
+  trace_on = 1;
+
+  for (int i = 1; i < argc && name.size() < 200; ++i)
+  {
+    if (!begins(argv[i], "--trace="))
+    {
+      name += " ";
+      name += argv[i];
+    }
+  }
+
+  char buf[64];
+  trace_buf += "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": ";
+  snprintf(buf, sizeof(buf), "%d, \"args\": {\"name\": ", (int)trace_pid);
+  trace_buf += buf;
+  trace_buf += json_quote(name);
+  trace_buf += "}},\n";
+}
+
+void trace_begin(const char *name)
+{
+  trace_stack.push_back(name);
+  add_event(name, 'B', 0, trace_clock(), 0);
+}
+
+void trace_end(void)
+{
+  if (trace_stack.empty())
+  {
+    return;
+  }
+  add_event(trace_stack.back(), 'E', 0, trace_clock(), 0);
+  trace_stack.pop_back();
+}
+
+/* a span measured by someone else, e.g. a parallel job; track 0 is the
+ * main thread, other tracks show up as threads of the process */
+void trace_complete(const char *name, int track, long long start, long long end)
+{
+  add_event(name, 'X', track, start, end - start);
+}
+
+static bool write_all(int fd, const std::string &str)
+{
+  const char *p = str.data();
+  size_t len = str.size();
+
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* write out the events */
+void trace_finish(void)
+{
+  if (!trace_on || getpid() != trace_pid)
+  {
+    return;
+  }
+  while (!trace_stack.empty())
+  {
+    trace_end();
+  }
+  trace_on = 0;
+
+  /* whoever creates the file writes the opening bracket; it is put in
+   * place with link() so no one can append before it is there */
+  if (access(trace_file.c_str(), F_OK) != 0)
+  {
+    std::string tmp = trace_file + "." + std::to_string(trace_pid) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+      bool ok = write_all(fd, "[\n");
+      close(fd);
+      if (ok)
+      {
+        link(tmp.c_str(), trace_file.c_str());
+      }
+      unlink(tmp.c_str());
+    }
+  }
+
+  int fd = open(trace_file.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0 || !write_all(fd, trace_buf))
+  {
+    fprintf(stderr, "warning: cannot write trace to %s: %s\n", trace_file.c_str(), strerror(errno));
+  }
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  trace_buf.clear();
+}
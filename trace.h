@@ -0,0 +1,26 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* set by trace_init() if --trace=file was given; everything
+ * else is only called when it is set */
+extern int trace_on;
+
+#define TRACE_BEGIN(name) do { if (trace_on) { trace_begin(name); } } while (0)
+#define TRACE_END()       do { if (trace_on) { trace_end(); } } while (0)
+
+void trace_init(const char *file, int argc, char **argv);
+long long trace_clock(void);
+void trace_begin(const char *name);
+void trace_end(void);
+void trace_complete(const char *name, int track, long long start, long long end);
+void trace_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TRACE_H */
@@ -0,0 +1,557 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Translation of a gcc command line into a cl.exe command line, using
+ * the option table generated from commands.txt.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "options.h"
+#include "options_table.h"
+#include "trace.h"
+
+#define STR(x) std::string(x)
+
+
+/* check if the beginning of p equals str and if p is longer than str */
+bool begins(const char *p, const char *str)
+{
+  size_t n = strlen(str);
+
+  if (strncmp(p, str, n) == 0 && strlen(p) > n)
+  {
+    return true;
+  }
+  return false;
+}
+
+/* the variable itself is left alone: translate() may read it many times */
+static void split_env(const char *env_var, const char *msvc_arg, std::vector<std::string> &args)
+{
+  const char *env = getenv(env_var);
+  if (env == NULL)
+  {
+    return;
+  }
+
+  std::vector<std::string> paths;
+
+  while (*env != 0)
+  {
+    const char *end = strchr(env, ';');
+    if (end == NULL)
+    {
+      end = env + strlen(env);
+    }
+    if (end > env)
+    {
+      paths.push_back(std::string(env, end - env));
+    }
+    env = (*end == 0) ? end : end + 1;
+  }
+
+  win_paths(paths, msvc_arg, args);
+}
+
+/* append a space separated list of msvc options from the option
+ * table; %s and %d are replaced with value, %p with win_path(value),
+ * %i with stage_path(value) */
+static void add_translated(std::vector<std::string> &args, const char *msvc, const char *value)
+{
+  const char *p = msvc;
+
+  while (*p != 0)
+  {
+    const char *end = strchr(p, ' ');
+    if (end == NULL)
+    {
+      end = p + strlen(p);
+    }
+
+    std::string opt(p, end - p);
+    size_t pos = opt.find('%');
+
+    if (pos != std::string::npos && pos + 1 < opt.size() && value != NULL)
+    {
+      std::string val = (opt[pos+1] == 'p') ? win_path(value) :
+                        (opt[pos+1] == 'i') ? stage_path(value, true) : STR(value);
+      opt.replace(pos, 2, val);
+    }
+    args.push_back(opt);
+
+    p = (*end == 0) ? end : end + 1;
+  }
+}
+
+/* files cl.exe compiles rather than passes on to the linker */
+static bool is_source_file(const std::string &file)
+{
+  std::string ext = file.substr(file.rfind('.') + 1);
+  for (size_t i = 0; i < ext.size(); ++i)
+  {
+    ext[i] = tolower(ext[i]);
+  }
+  return file.find('.') == std::string::npos ||
+    (ext != "obj" && ext != "o" && ext != "lib" && ext != "a" &&
+     ext != "res" && ext != "def" && ext != "exp");
+}
+
+/* -flto=N, -flto=auto (or jobserver): threads for code generation,
+ * at most 8 (cl.exe's and link.exe's limit); -flto keeps the last value */
+static int lto_threads(const char *value, int threads)
+{
+  if (value == NULL)
+  {
+    return threads;
+  }
+  int n = isdigit(value[0]) ? atoi(value) : sysconf(_SC_NPROCESSORS_ONLN);
+  return (n < 1) ? 1 : (n > 8) ? 8 : n;
+}
+
+/* cl.exe writes dir/file.c to file.obj in the current directory */
+std::string object_name(const std::string &source)
+{
+  std::string name = source.substr(source.rfind('/') + 1);
+  return name.substr(0, name.rfind('.')) + ".obj";
+}
+
+/* /Z7, or /Zi with a PDB next to the object of a single compile */
+void debug_args(struct translation &t, bool embed)
+{
+  t.debug_pending = false;
+  if (embed)
+  {
+    t.cl_args.push_back("/Z7");
+    return;
+  }
+  t.cl_args.push_back("/Zi");
+  t.cl_args.push_back("/FS");
+  if (!t.do_link && t.sources.size() == 1)
+  {
+    std::string object = t.have_outname ? t.outname : object_name(t.sources[0]);
+    size_t dot = object.rfind('.');
+    std::string pdb = ((dot != std::string::npos && dot > object.rfind('/') + 1) ?
+      object.substr(0, dot) : object) + ".pdb";
+    t.cl_args.push_back("/Fd" + win_path(pdb.c_str()));
+  }
+}
+
+/* translate a gcc command line into t; the environment (CL_PATH,
+ * INCLUDE, LIB, GCC2MSVC_CACHE, GCC2MSVC_PCH, GCC2MSVC_STAGE) is read
+ * but nothing is run or printed besides warnings, so it can be used for
+ * many command lines in one process; returns 0, or 1 if the command
+ * line is unusable */
+int translate(int argc, char **argv, struct translation &t)
+{
+  std::string str;
+  std::vector<std::string> lnk_args;
+  std::string toolchain_name;
+
+  bool use_default_driver = true;
+  bool use_default_inc_paths = true;
+  bool default_lib_paths = true;
+  bool dll = false;
+  std::string arch, march, tune;    /* /arch option, -march, -mtune */
+
+  t.cl_args.clear();
+  t.sources.clear();
+  t.source_args.clear();
+  t.driver_paths.clear();
+  t.outname.clear();
+  t.toolchain = &toolchain_builtin();
+  t.bits = 64;
+  t.jobs = 0;
+  t.info = INFO_NONE;
+  t.do_link = true;
+  t.have_outname = false;
+  t.make_deps = false;
+  t.deps = dep_options();
+  t.unity = unity_options();
+  t.pgo = PGO_NONE;
+  t.pgo_dir.clear();
+  t.pgo_pgd.clear();
+  t.pgo_exact = false;
+  t.lto = false;
+  t.lto_threads = 0;
+  t.debug = DEBUG_NONE;
+  t.debug_format.clear();
+  t.debug_split = false;
+  t.debug_pending = false;
+  t.jobserver = false;
+  t.time_trace.clear();
+  t.use_time_trace = false;
+  t.pool = 0;
+  t.mem_limit.clear();
+  t.verbose = false;
+  t.print_only = false;
+  t.use_shell = false;
+  t.use_cache = false;
+  t.use_mp = false;
+  t.use_pch = false;
+
+  /* g++ compiles a header as C++, gcc as C */
+  const char *driver_name = strrchr(argv[0], '/');
+  t.cxx = strstr(driver_name != NULL ? driver_name + 1 : argv[0], "++") != NULL;
+
+  char *cache_env = getenv("GCC2MSVC_CACHE");
+  if (cache_env != NULL && *cache_env != 0 && STR(cache_env) != "0")
+  {
+    t.use_cache = true;
+  }
+
+  char *pch_env = getenv("GCC2MSVC_PCH");
+  if (pch_env != NULL && *pch_env != 0 && STR(pch_env) != "0")
+  {
+    t.use_pch = true;
+  }
+
+  char *pool_env = getenv("GCC2MSVC_POOL");
+  if (pool_env != NULL && *pool_env != 0)
+  {
+    t.pool = atoi(pool_env);
+  }
+
+  char *debug_env = getenv("GCC2MSVC_DEBUG_FORMAT");
+  if (debug_env != NULL)
+  {
+    t.debug_format = debug_env;
+  }
+
+  char *mem_env = getenv("GCC2MSVC_MEM_LIMIT");
+  if (mem_env != NULL)
+  {
+    t.mem_limit = mem_env;
+  }
+
+  char *toolchain_env = getenv("GCC2MSVC_TOOLCHAIN");
+  if (toolchain_env != NULL)
+  {
+    toolchain_name = toolchain_env;
+  }
+
+  /* input paths are staged as they are translated, so --stage has to
+   * be known before the first one */
+  char *stage_env = getenv("GCC2MSVC_STAGE");
+  std::string stage_dir = (stage_env != NULL) ? stage_env : "";
+  for (int i = 1; i < argc; ++i)
+  {
+    if (begins(argv[i], "--stage=")) { stage_dir = argv[i]+8; }
+  }
+  stage_init(stage_dir);
+
+  char *driver_env = getenv("CL_PATH");
+  if (driver_env != NULL)
+  {
+    t.driver_paths = driver_env;
+    use_default_driver = false;
+  }
+
+
+  /* parse arguments */
+
+  TRACE_BEGIN("parse arguments");
+  for (int i = 1; i < argc; ++i)
+  {
+    char *arg = argv[i];
+    str = STR(argv[i]);
+
+    if (arg[0] != '-')
+    {
+      if (is_source_file(arg))
+      {
+        t.sources.push_back(arg);
+        t.source_args.push_back(t.cl_args.size());
+      }
+      t.cl_args.push_back(stage_path(arg, is_source_file(arg)));
+    }
+    else if (arg[1] == '-')
+    {
+      if      (begins(arg, "--path=")) { t.driver_paths = arg+7;
+                                         use_default_driver = false;      }
+      else if (begins(arg, "--toolchain=")) { toolchain_name = arg+12;    }
+      else if (begins(arg, "--unity="))  { t.unity.size = atoi(arg+8);       }
+      else if (begins(arg, "--unity-exclude=")) { t.unity.exclude = arg+16; }
+      else if (begins(arg, "--unity-report="))  { t.unity.report = arg+15;  }
+      else if (str == "--toolchains")  { t.info = INFO_TOOLCHAINS; return 0; }
+      else if (str == "--verbose")     { t.verbose = true;                }
+      else if (str == "--print-only")  { t.verbose = t.print_only = true; }
+      else if (str == "--shell")       { t.use_shell = true;              }
+      else if (str == "--cache")       { t.use_cache = true;              }
+      else if (str == "--mp")          { t.use_mp = true;                 }
+      else if (str == "--pch")         { t.use_pch = true;                }
+      else if (str == "--pool")        { t.pool = sysconf(_SC_NPROCESSORS_ONLN); }
+      else if (begins(arg, "--pool="))  { t.pool = atoi(arg+7);             }
+      else if (begins(arg, "--debug-format=")) { t.debug_format = arg+15; }
+      else if (str == "--mem-limit")   { t.mem_limit = "80%";             }
+      else if (begins(arg, "--mem-limit=")) { t.mem_limit = arg+12;        }
+      else if (str == "--cache-stats") { t.info = INFO_CACHE_STATS; return 0; }
+      else if (str == "--cache-clear") { t.info = INFO_CACHE_CLEAR; return 0; }
+      else if (str == "--help")        { t.info = INFO_HELP;        return 0; }
+      else if (begins(arg, "--help-"))
+      {
+        if      (str == "--help-cl")   { t.info = INFO_HELP_CL;   }
+        else if (str == "--help-link") { t.info = INFO_HELP_LINK; }
+      }
+      else if (str == "--version")     { t.info = INFO_VERSION;   }
+    }
+    else
+    {
+      /* everything else is looked up in the table generated from commands.txt */
+      const char *value;
+      int consumed;
+      const struct option_entry *opt = option_lookup(argc, argv, i, &value, &consumed);
+
+      i += consumed;
+      if (opt == NULL)
+      {
+        continue;
+      }
+
+      add_translated(opt->link ? lnk_args : t.cl_args, opt->msvc, value);
+
+      switch (opt->action)
+      {
+        case ACT_NONE:                                          break;
+        case ACT_NOLINK:        t.do_link = false;              break;
+        case ACT_M32:           t.bits = 32;                    break;
+        case ACT_M64:           t.bits = 64;                    break;
+        case ACT_DLL:           dll = true;                     break;
+        case ACT_OUTNAME:       t.have_outname = true;
+                                t.outname = value;              break;
+        case ACT_NOSTDINC:      use_default_inc_paths = false;  break;
+        case ACT_NOSTDLIB:      default_lib_paths = false;      break;
+        case ACT_JOBS:          t.jobs = atoi(value);           break;
+        case ACT_DEPS:          t.make_deps = true;
+                                t.deps.system = true;           break;
+        case ACT_DEPS_USER:     t.make_deps = true;
+                                t.deps.system = false;          break;
+        case ACT_DEPS_FILE:     t.deps.file = value;            break;
+        case ACT_DEPS_TARGET:   t.deps.targets.push_back(value); break;
+        case ACT_DEPS_QUOTED_TARGET:
+                                t.deps.targets.push_back(make_quote(value)); break;
+        case ACT_DEPS_PHONY:    t.deps.phony = true;            break;
+        case ACT_PROFILE_GENERATE:
+        case ACT_PROFILE_USE:   t.pgo = (opt->action == ACT_PROFILE_USE) ? PGO_USE : PGO_GENERATE;
+                                t.pgo_dir = value ? value : ""; break;
+        case ACT_PROFILE_EXACT: t.pgo_exact = true;             break;
+        case ACT_LTO:           t.lto = true;
+                                t.lto_threads = lto_threads(value, t.lto_threads); break;
+        case ACT_NO_LTO:        t.lto = false;                  break;
+        case ACT_LTO_PARTITION: if (STR(value) == "one" || STR(value) == "none")
+                                {
+                                  t.lto_threads = 1;
+                                }
+                                break;
+        case ACT_DEBUG:         t.debug = DEBUG_FULL;           break;
+        case ACT_DEBUG_LINES:   t.debug = DEBUG_LINES;          break;
+        case ACT_NO_DEBUG:      t.debug = DEBUG_NONE;           break;
+        case ACT_DEBUG_SPLIT:   t.debug_split = true;           break;
+        case ACT_TIME_TRACE:    t.use_time_trace = true;
+                                t.time_trace = value ? value : ""; break;
+        case ACT_MARCH:         if (!arch_option(value, arch))
+                                {
+                                  std::cerr << "warning: ignoring unknown `-march=" << value << "'" << std::endl;
+                                  break;
+                                }
+                                if (!arch.empty()) { t.cl_args.push_back(arch); }
+                                march = value;
+                                break;
+        case ACT_MTUNE:         tune = value;                   break;
+        case ACT_SEARCH_DIRS:   t.info = INFO_SEARCH_DIRS;      break;
+        case ACT_HELP:          t.info = INFO_HELP;             return 0;
+      }
+    }
+  }
+  TRACE_END();
+
+  t.unity.verbose = t.verbose;
+
+  if (!toolchain_name.empty())
+  {
+    t.toolchain = toolchain_get(toolchain_name);
+    if (t.toolchain == NULL)
+    {
+      return 1;
+    }
+  }
+
+  const struct toolchain &tc = *t.toolchain;
+  const std::string &lib_paths_default = (t.bits == 32) ? tc.libpaths_x86 : tc.libpaths_x64;
+
+  if (t.bits == 32 && !use_default_driver)
+  {
+    std::cerr << "warning: ignoring `-m32' when using a custom cl.exe" << std::endl;
+  }
+  if (use_default_driver)
+  {
+    t.driver_paths = (t.bits == 32) ? tc.cl_path_x86 : tc.cl_path_x64;
+  }
+  if (t.info != INFO_NONE)
+  {
+    return 0;
+  }
+
+
+  /* turn lists obtained from environment variables INCLUDE and
+   * and LIB into command line arguments /Idir and /libpath:dir */
+  TRACE_BEGIN("split_env");
+  size_t system_includes = t.cl_args.size();
+  split_env("INCLUDE", "/I", t.cl_args);
+  split_env("LIB", "/libpath:", lnk_args);
+  TRACE_END();
+
+
+  /* create the final command to execute */
+
+  TRACE_BEGIN("assemble command");
+  if (use_default_inc_paths) { split_cmdline(tc.includes, t.cl_args); }
+
+  /* -MMD leaves out the headers of the system include directories; they
+   * have to be collected before any other option is appended */
+  if (t.make_deps && !t.deps.system)
+  {
+    for (size_t i = system_includes; i < t.cl_args.size(); ++i)
+    {
+      if (begins(t.cl_args[i].c_str(), "/I"))
+      {
+        t.deps.system_dirs.push_back(stage_origin(unix_path(t.cl_args[i].substr(2))));
+      }
+    }
+  }
+
+  /* -mtune, or what -march implies */
+  if (tune.empty()) { tune = march; }
+  if (!tune.empty())
+  {
+    std::string favor;
+    if (!favor_option(tune, t.bits, favor))
+    {
+      std::cerr << "warning: ignoring unknown `-mtune=" << tune << "'" << std::endl;
+    }
+    else if (!favor.empty())
+    {
+      t.cl_args.push_back(favor);
+    }
+  }
+
+  /* whole program optimization; objects built with /GL are linked with
+   * /LTCG, incrementally (reusing .iobj files) for -flto */
+  bool whole_program = std::find(t.cl_args.begin(), t.cl_args.end(), "/GL") != t.cl_args.end();
+  if (t.lto && !whole_program)
+  {
+    t.cl_args.push_back("/GL");
+    whole_program = true;
+  }
+  if (t.lto && t.lto_threads > 0)
+  {
+    t.cl_args.push_back("/cgthreads" + std::to_string(t.lto_threads));
+  }
+
+  /* debug info: /Z7 keeps it in the objects, so cl.exe processes running
+   * at the same time don't queue up at mspdbsrv for a shared PDB; that is
+   * the default for parallel builds and when the objects only go into a
+   * program. Otherwise /Zi writes a PDB per object. Whether make runs
+   * other jobs beside a single compile is left to run_translation(). */
+  if (t.debug != DEBUG_NONE)
+  {
+    if (t.debug_format == "z7" || t.debug_format == "zi" ||
+        t.do_link || t.use_mp || t.sources.size() > 1)
+    {
+      debug_args(t, t.debug_format != "zi");
+    }
+    else
+    {
+      t.debug_pending = true;
+    }
+  }
+
+  if (!t.do_link && t.have_outname)
+  {
+    t.cl_args.push_back("/Fo" + win_path(t.outname.c_str()));
+  }
+  if (t.do_link)
+  {
+    if (!t.have_outname)
+    {
+      if (dll) { lnk_args.push_back("/out:a.dll"); }
+      else     { lnk_args.push_back("/out:a.exe"); }
+    }
+    if (default_lib_paths) { split_cmdline(lib_paths_default, lnk_args); }
+    /* cl.exe has no mode for line tables only; -g1 and -gsplit-dwarf
+     * leave the debug info in the objects instead of merging it. A link
+     * of objects alone is left to link_objects(), which links with
+     * /DEBUG:FASTLINK when it can link incrementally. */
+    if (t.debug != DEBUG_NONE && (t.debug_split || t.debug == DEBUG_LINES))
+    {
+      lnk_args.push_back("/DEBUG:FASTLINK");
+    }
+    else if (t.debug != DEBUG_NONE && (!t.sources.empty() || t.use_shell))
+    {
+      lnk_args.push_back("/DEBUG:FULL");
+    }
+    if (whole_program || t.pgo != PGO_NONE)
+    {
+      /* profile-guided builds can't be incremental */
+      lnk_args.push_back((t.lto && t.pgo == PGO_NONE) ? "/LTCG:INCREMENTAL" : "/LTCG");
+      if (t.lto && t.lto_threads > 0)
+      {
+        lnk_args.push_back("/CGTHREADS:" + std::to_string(t.lto_threads));
+      }
+    }
+    if (t.pgo != PGO_NONE)
+    {
+      /* <dir>/<program>.pgd, or next to the program like link.exe does */
+      std::string out = t.have_outname ? t.outname : (dll ? "a.dll" : "a.exe");
+      size_t dot = out.rfind('.');
+      std::string base = (dot != std::string::npos && dot > out.rfind('/') + 1) ?
+        out.substr(0, dot) : out;
+      if (!t.pgo_dir.empty())
+      {
+        base = t.pgo_dir + "/" + base.substr(base.rfind('/') + 1);
+      }
+      t.pgo_pgd = unix_path(base + ".pgd");
+
+      std::string pgd = "PGD=" + win_path(t.pgo_pgd.c_str());
+      if (t.pgo == PGO_USE)        { lnk_args.push_back("/USEPROFILE:" + pgd); }
+      else if (t.pgo_exact)        { lnk_args.push_back("/GENPROFILE:EXACT," + pgd); }
+      else                         { lnk_args.push_back("/GENPROFILE:" + pgd); }
+    }
+    t.cl_args.push_back("/link");
+    t.cl_args.insert(t.cl_args.end(), lnk_args.begin(), lnk_args.end());
+  }
+  TRACE_END();
+
+  return 0;
+}
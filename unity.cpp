@@ -0,0 +1,464 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (C) 2017, djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Unity builds (--unity=N): up to N sources are compiled as one.
+ *
+ * Sources compiled with the same options and in the same language go
+ * into generated files gcc2msvc-unity-<hash>.c/.cpp in the current
+ * directory that #include them, N at a time, and each of those is one
+ * cl.exe run. They are named after what they include, so the object
+ * cache finds a group that was compiled before. With -c the object of
+ * a group is written to the object name of its first source and also
+ * put in gcc2msvc-unity-<hash>.lib next to it; the other sources get
+ * an object that only makes link.exe search that archive. Makefiles
+ * find every object they expect, the code is linked once, and a link
+ * without the first object still gets it from the archive. Compiled
+ * and linked in one call, the unity files simply take the place of
+ * the sources.
+ *
+ * Sources that don't survive being compiled together (static names
+ * used twice, macros leaking into the next file) stay on their own:
+ * those containing the text "gcc2msvc:no-unity" (e.g. in a comment)
+ * and those matching a line of --unity-exclude=file (shell patterns,
+ * against the path or the file name). --verbose prints the groups,
+ * --unity-report=file appends them as JSON lines.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gcc2msvc.h"
+#include "hash.h"
+
+#define NO_UNITY_MARKER  "gcc2msvc:no-unity"
+
+struct unity_group {
+  std::vector<size_t> members;   /* indices of the jobs */
+  bool cpp;
+};
+
+
+static std::vector<std::string> exclude_patterns(const std::string &file)
+{
+  std::vector<std::string> patterns;
+  std::ifstream in(file.c_str());
+  std::string line;
+
+  if (!file.empty() && !in)
+  {
+    std::cerr << "warning: cannot read " << file << std::endl;
+  }
+  while (std::getline(in, line))
+  {
+    size_t end = line.find_last_not_of(" \t\r");
+    if (end != std::string::npos && line[0] != '#')
+    {
+      patterns.push_back(line.substr(0, end + 1));
+    }
+  }
+  return patterns;
+}
+
+static bool has_marker(const std::string &source)
+{
+  int fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  bool found = false;
+
+  if (fd < 0)
+  {
+    return false;
+  }
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      found = memmem(data, st.st_size, NO_UNITY_MARKER, sizeof(NO_UNITY_MARKER) - 1) != NULL;
+      munmap(data, st.st_size);
+    }
+  }
+  close(fd);
+  return found;
+}
+
+/* why source must be compiled on its own, NULL if it needn't */
+static const char *excluded(const std::string &source, const std::vector<std::string> &patterns)
+{
+  std::string base = source.substr(source.rfind('/') + 1);
+
+  for (size_t i = 0; i < patterns.size(); ++i)
+  {
+    if (fnmatch(patterns[i].c_str(), source.c_str(), 0) == 0 ||
+        fnmatch(patterns[i].c_str(), base.c_str(), 0) == 0)
+    {
+      return "exclude list";
+    }
+  }
+  return has_marker(source) ? "marker" : NULL;
+}
+
+static bool is_cpp(const std::vector<std::string> &args, const std::string &source)
+{
+  for (size_t i = 0; i < args.size() && args[i] != "/link"; ++i)
+  {
+    if (args[i] == "/TC") { return false; }
+    if (args[i] == "/TP") { return true; }
+  }
+  return !(source.size() > 2 && source.compare(source.size() - 2, 2, ".c") == 0);
+}
+
+static std::string absolute(const std::string &path)
+{
+  char cwd[PATH_MAX];
+
+  if (path[0] == '/' || getcwd(cwd, sizeof(cwd)) == NULL)
+  {
+    return path;
+  }
+  return std::string(cwd) + "/" + path;
+}
+
+/* write a generated source; it is named after its text, so the same
+ * group gets the same name every time and the object cache finds it */
+static std::string write_generated(bool cpp, const std::string &text)
+{
+  struct hash_state h;
+  char hex[33];
+
+  hash_init(&h);
+  hash_string(&h, text.c_str());
+  hash_hex(&h, hex);
+  std::string name = "gcc2msvc-unity-" + std::string(hex, 16) + (cpp ? ".cpp" : ".c");
+  std::string tmp = name + ".tmp" + std::to_string(getpid());
+
+  std::ofstream(tmp.c_str()) << "/* generated by gcc2msvc --unity */\n" << text;
+  rename(tmp.c_str(), name.c_str());
+  return name;
+}
+
+/* a file that includes the sources; returns its name */
+static std::string write_unity(bool cpp, const std::vector<std::string> &sources)
+{
+  std::string text;
+
+  for (size_t i = 0; i < sources.size(); ++i)
+  {
+    text += "#include \"" + stage_path(absolute(sources[i]).c_str(), false) + "\"\n";
+  }
+  return write_generated(cpp, text);
+}
+
+/* a file whose object only makes link.exe search lib */
+static std::string write_stub(bool cpp, const std::string &lib)
+{
+  std::string path = win_path(lib.c_str());
+  std::string text = "#pragma comment(lib, \"";
+
+  for (size_t i = 0; i < path.size(); ++i)
+  {
+    text += (path[i] == '\\') ? "\\\\" : path.substr(i, 1);
+  }
+  return write_generated(cpp, text + "\")\n");
+}
+
+static void report(const struct unity_options &u, const std::string &unity, bool cpp,
+                   const std::string &object, const std::vector<std::string> &sources)
+{
+  if (u.verbose)
+  {
+    std::cout << "unity " << unity << " (" << (cpp ? "C++" : "C") << "):";
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+      std::cout << " " << sources[i];
+    }
+    std::cout << std::endl;
+  }
+  if (!u.report.empty())
+  {
+    std::string line = "{\"unity\": " + json_quote(unity) + ", \"language\": \"" +
+      (cpp ? "C++" : "C") + "\", \"object\": " + json_quote(object) + ", \"sources\": [";
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+      line += (i > 0 ? ", " : "") + json_quote(sources[i]);
+    }
+    line += "]}\n";
+
+    /* a single write, so concurrent builds don't mix their lines */
+    int fd = open(u.report.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd >= 0)
+    {
+      if (write(fd, line.data(), line.size()) < 0) { /* only a report */ }
+      close(fd);
+    }
+  }
+}
+
+static void report_excluded(const struct unity_options &u, const std::string &source,
+                            const char *why)
+{
+  if (u.verbose)
+  {
+    std::cout << "unity: " << source << " compiled on its own (" << why << ")" << std::endl;
+  }
+  if (!u.report.empty())
+  {
+    std::string line = "{\"excluded\": " + json_quote(source) + ", \"reason\": \"" + why + "\"}\n";
+    int fd = open(u.report.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd >= 0)
+    {
+      if (write(fd, line.data(), line.size()) < 0) { /* only a report */ }
+      close(fd);
+    }
+  }
+}
+
+/* sort the jobs into groups of at most u.size with the same options
+ * and language; jobs that are left alone are put in single */
+static std::vector<struct unity_group> make_groups(const std::vector<struct compile_job> &jobs,
+                                                   const struct unity_options &u,
+                                                   std::vector<size_t> &single)
+{
+  std::vector<std::string> patterns = exclude_patterns(u.exclude);
+  std::map<std::string, size_t> open_group;   /* options -> group being filled */
+  std::vector<struct unity_group> groups;
+
+  for (size_t i = 0; i < jobs.size(); ++i)
+  {
+    const struct compile_job &job = jobs[i];
+    const char *why = excluded(job.source, patterns);
+
+    if (why != NULL)
+    {
+      report_excluded(u, job.source, why);
+      single.push_back(i);
+      continue;
+    }
+
+    /* the options without the source and /Fo at the end */
+    bool cpp = is_cpp(job.args, job.source);
+    std::string key = cpp ? "C++" : "C";
+    for (size_t k = 0; k + 2 < job.args.size(); ++k)
+    {
+      key += '\0' + job.args[k];
+    }
+
+    std::map<std::string, size_t>::iterator it = open_group.find(key);
+    if (it == open_group.end() || groups[it->second].members.size() >= (size_t)u.size)
+    {
+      struct unity_group g;
+      g.cpp = cpp;
+      groups.push_back(g);
+      open_group[key] = groups.size() - 1;
+      it = open_group.find(key);
+    }
+    groups[it->second].members.push_back(i);
+  }
+
+  /* a group of one is just the source */
+  std::vector<struct unity_group> real;
+  for (size_t g = 0; g < groups.size(); ++g)
+  {
+    if (groups[g].members.size() == 1)
+    {
+      single.push_back(groups[g].members[0]);
+    }
+    else
+    {
+      real.push_back(groups[g]);
+    }
+  }
+  return real;
+}
+
+/* compile the jobs (from split_sources(): options, source, /Fo) in
+ * unity groups; returns the highest exit code like compile_parallel() */
+int unity_compile(const struct tool &cl, const std::vector<struct compile_job> &jobs,
+                  const struct unity_options &u, int max_jobs, bool use_cache)
+{
+  std::vector<size_t> single;
+  std::vector<struct unity_group> groups = make_groups(jobs, u, single);
+  std::vector<struct compile_job> run;
+  std::vector<std::string> files, libs;
+
+  for (size_t g = 0; g < groups.size(); ++g)
+  {
+    const std::vector<size_t> &m = groups[g].members;
+    const struct compile_job &first = jobs[m[0]];
+    std::vector<std::string> sources;
+
+    for (size_t i = 0; i < m.size(); ++i)
+    {
+      sources.push_back(jobs[m[i]].source);
+    }
+
+    std::string unity = write_unity(groups[g].cpp, sources);
+    files.push_back(unity);
+    report(u, unity, groups[g].cpp, first.object, sources);
+
+    struct compile_job job;
+    job.args.assign(first.args.begin(), first.args.end() - 2);
+    job.args.push_back(unity);
+    job.args.push_back(first.args.back());
+    job.source = unity;
+    job.object = first.object;
+    run.push_back(job);
+
+    /* the group's object is also put in an archive next to it; the
+     * other sources get an object that only names the archive, so
+     * linking any of them without the first pulls in the code */
+    std::string dir = first.object.substr(0, first.object.rfind('/') + 1);
+    std::string lib = dir + unity.substr(0, unity.rfind('.')) + ".lib";
+    std::string stub = write_stub(groups[g].cpp, absolute(lib));
+    libs.push_back(lib);
+    files.push_back(stub);
+
+    const struct compile_job &second = jobs[m[1]];
+    job.args.assign(second.args.begin(), second.args.end() - 2);
+    job.args.push_back(stub);
+    job.args.push_back(second.args.back());
+    job.source = stub;
+    job.object = second.object;
+    run.push_back(job);
+  }
+  for (size_t i = 0; i < single.size(); ++i)
+  {
+    run.push_back(jobs[single[i]]);
+  }
+
+  int rv = compile_parallel(cl, run, max_jobs, use_cache, NULL);
+
+  /* link.exe /lib is lib.exe */
+  struct tool lib = cl;
+  lib.name = "link.exe";
+  lib.path = cl.path.substr(0, cl.path.rfind('/') + 1) + lib.name;
+
+  for (size_t g = 0; g < groups.size() && rv == 0; ++g)
+  {
+    const std::vector<size_t> &m = groups[g].members;
+    std::vector<std::string> args;
+    args.push_back("/lib");
+    args.push_back("/nologo");
+    args.push_back("/out:" + win_path(libs[g].c_str()));
+    args.push_back(win_path(jobs[m[0]].object.c_str()));
+    if (run_tool(lib, args) != 0)
+    {
+      std::cerr << "error: cannot write " << libs[g] << std::endl;
+      rv = 1;
+    }
+    for (size_t i = 2; i < m.size(); ++i)
+    {
+      if (!copy_file(jobs[m[1]].object, jobs[m[i]].object))
+      {
+        std::cerr << "error: cannot write " << jobs[m[i]].object << std::endl;
+        rv = 1;
+      }
+    }
+  }
+  for (size_t i = 0; i < files.size(); ++i)
+  {
+    unlink(files[i].c_str());
+  }
+  return rv;
+}
+
+/* compile and link: the sources in t.cl_args are replaced with unity
+ * files; returns the files to remove afterwards */
+std::vector<std::string> unity_rewrite(struct translation &t)
+{
+  std::vector<struct compile_job> jobs;
+  std::vector<std::string> files;
+
+  std::vector<std::string> common;
+  for (size_t i = 0, k = 0; i < t.cl_args.size(); ++i)
+  {
+    if (k < t.source_args.size() && t.source_args[k] == i) { ++k; }
+    else                                                   { common.push_back(t.cl_args[i]); }
+  }
+
+  for (size_t k = 0; k < t.sources.size(); ++k)
+  {
+    struct compile_job job;
+    job.args = common;
+    job.args.push_back(t.cl_args[t.source_args[k]]);
+    job.args.push_back("");
+    job.source = t.sources[k];
+    jobs.push_back(job);
+  }
+
+  std::vector<size_t> single;
+  std::vector<struct unity_group> groups = make_groups(jobs, t.unity, single);
+  if (groups.empty())
+  {
+    return files;
+  }
+
+  std::vector<std::string> sources, paths;
+  for (size_t g = 0; g < groups.size(); ++g)
+  {
+    std::vector<std::string> members;
+    for (size_t i = 0; i < groups[g].members.size(); ++i)
+    {
+      members.push_back(jobs[groups[g].members[i]].source);
+    }
+    std::string unity = write_unity(groups[g].cpp, members);
+    report(t.unity, unity, groups[g].cpp, object_name(unity), members);
+    files.push_back(unity);
+    files.push_back(object_name(unity));
+    sources.push_back(unity);
+    paths.push_back(win_path(unity.c_str()));
+  }
+  for (size_t i = 0; i < single.size(); ++i)
+  {
+    sources.push_back(t.sources[single[i]]);
+    paths.push_back(t.cl_args[t.source_args[single[i]]]);
+  }
+
+  /* the new sources go where the first one was */
+  std::vector<std::string> &args = common;
+  size_t at = t.source_args[0];
+
+  t.sources = sources;
+  t.source_args.clear();
+  for (size_t k = 0; k < sources.size(); ++k)
+  {
+    t.source_args.push_back(at + k);
+    args.insert(args.begin() + at + k, paths[k]);
+  }
+  t.cl_args = args;
+  return files;
+}